@@ -0,0 +1,276 @@
+#include "AllocProfiler.h"
+#include <atomic>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#define ALLOC_PROFILER_BACKTRACE
+#endif
+
+// Deepest call stack recorded per sample
+static const INT MAX_DEPTH = 32;
+
+// Distinct call stack and type combinations kept. Further samples are dropped.
+static const INT MAX_SAMPLES = 1024;
+
+// Frames of the profiler and allocator itself skipped at the top of each stack
+static const INT SKIP_FRAMES = 2;
+
+// With sampling off, each thread rechecks the interval after this many bytes
+static const INT64 DISABLED_RECHECK_BYTES = 1024 * 1024;
+
+/// @brief A unique call stack and type with its sample count
+struct AllocSample
+{
+	const CHAR* tag;
+	void* stack[MAX_DEPTH];
+	INT depth;
+	UINT64 samples;
+	UINT64 bytes;
+};
+
+/// @brief A sample taken by a thread, awaiting attribution to a type
+struct PendingSample
+{
+	BOOL valid;
+	CHAR* pBlock;
+	size_t size;
+	const CHAR* tag;
+	void* stack[MAX_DEPTH];
+	INT depth;
+	UINT64 bytes;
+};
+
+static std::atomic<size_t> _sampleInterval(0);
+static std::atomic_flag _samplesLock = ATOMIC_FLAG_INIT;
+static AllocSample _samples[MAX_SAMPLES];
+static UINT64 _droppedSamples = 0;
+
+static thread_local PendingSample _pending;
+static thread_local BOOL _inSample = FALSE;
+static thread_local UINT64 _random = 0;
+
+//------------------------------------------------------------------------------
+// NextInterval
+//------------------------------------------------------------------------------
+static INT64 NextInterval(size_t interval)
+{
+	// Exponentially distributed intervals avoid locking onto periodic allocation
+	// patterns. xorshift64 seeded per thread.
+	if (_random == 0)
+		_random = (UINT64)(size_t)&_random ^ 0x9E3779B97F4A7C15ULL;
+	_random ^= _random << 13;
+	_random ^= _random >> 7;
+	_random ^= _random << 17;
+	double u = ((_random >> 11) + 1) * (1.0 / 9007199254740992.0);
+	return (INT64)(-log(u) * (double)interval) + 1;
+}
+
+//------------------------------------------------------------------------------
+// Commit
+//------------------------------------------------------------------------------
+static void Commit(PendingSample& pending)
+{
+	if (!pending.valid)
+		return;
+	pending.valid = FALSE;
+
+	// Hash the call stack and type into the sample table
+	size_t hash = (size_t)pending.tag;
+	for (INT i = 0; i < pending.depth; i++)
+		hash = hash * 31 + (size_t)pending.stack[i];
+
+	while (_samplesLock.test_and_set(std::memory_order_acquire))
+		;
+
+	for (INT probe = 0; probe < MAX_SAMPLES; probe++)
+	{
+		AllocSample& sample = _samples[(hash + probe) % MAX_SAMPLES];
+		if (sample.samples == 0)
+		{
+			sample.tag = pending.tag;
+			sample.depth = pending.depth;
+			memcpy(sample.stack, pending.stack, sizeof(void*) * pending.depth);
+		}
+		else if (sample.tag != pending.tag || sample.depth != pending.depth ||
+			memcmp(sample.stack, pending.stack, sizeof(void*) * pending.depth) != 0)
+		{
+			continue;
+		}
+
+		sample.samples++;
+		sample.bytes += pending.bytes;
+		_samplesLock.clear(std::memory_order_release);
+		return;
+	}
+
+	_droppedSamples++;
+	_samplesLock.clear(std::memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+// SetSampleInterval
+//------------------------------------------------------------------------------
+void AllocProfiler::SetSampleInterval(size_t bytes)
+{
+#ifdef ALLOC_PROFILER_BACKTRACE
+	// The first backtrace() loads the unwinder, which allocates. Do that now
+	// rather than from within an allocation.
+	void* stack[1];
+	backtrace(stack, 1);
+#endif
+	_sampleInterval.store(bytes, std::memory_order_relaxed);
+	m_bytesUntilSample = bytes ? NextInterval(bytes) : 0;
+}
+
+//------------------------------------------------------------------------------
+// Sample
+//------------------------------------------------------------------------------
+void AllocProfiler::Sample(void* pBlock, size_t size, const CHAR* name)
+{
+	size_t interval = _sampleInterval.load(std::memory_order_relaxed);
+	if (interval == 0)
+	{
+		m_bytesUntilSample = DISABLED_RECHECK_BYTES;
+		return;
+	}
+
+	// Each sample represents interval bytes, plus any bytes beyond the interval
+	// within this allocation
+	INT64 overshoot = -m_bytesUntilSample;
+	m_bytesUntilSample = NextInterval(interval);
+
+	// Allocations made while recording a sample aren't sampled
+	if (_inSample)
+		return;
+	_inSample = TRUE;
+
+	// An unattributed sample keeps the allocator name
+	Commit(_pending);
+
+	_pending.pBlock = (CHAR*)pBlock;
+	_pending.size = size;
+	_pending.tag = name ? name : "unknown";
+	_pending.bytes = interval + overshoot;
+#ifdef ALLOC_PROFILER_BACKTRACE
+	void* stack[MAX_DEPTH + SKIP_FRAMES];
+	INT depth = backtrace(stack, MAX_DEPTH + SKIP_FRAMES);
+	_pending.depth = depth > SKIP_FRAMES ? depth - SKIP_FRAMES : 0;
+	memcpy(_pending.stack, stack + SKIP_FRAMES, sizeof(void*) * _pending.depth);
+#else
+	_pending.depth = 0;
+#endif
+	_pending.valid = TRUE;
+
+	_inSample = FALSE;
+}
+
+//------------------------------------------------------------------------------
+// Attribute
+//------------------------------------------------------------------------------
+void AllocProfiler::Attribute(const void* pObject, const CHAR* tag)
+{
+	if (!_pending.valid)
+		return;
+
+	// The object may follow a block header, as with xallocator
+	const CHAR* pChar = (const CHAR*)pObject;
+	if (pChar >= _pending.pBlock && pChar < _pending.pBlock + _pending.size)
+	{
+		_pending.tag = tag;
+		Commit(_pending);
+	}
+}
+
+//------------------------------------------------------------------------------
+// WriteFrame
+//------------------------------------------------------------------------------
+static void WriteFrame(FILE* fp, const CHAR* name)
+{
+	// Semicolons and spaces delimit the folded format
+	for (; *name; name++)
+		fputc((*name == ';' || *name == ' ') ? '_' : *name, fp);
+}
+
+//------------------------------------------------------------------------------
+// WriteSymbol
+//------------------------------------------------------------------------------
+static void WriteSymbol(FILE* fp, const CHAR* symbol, void* address)
+{
+	if (symbol == NULL)
+	{
+		fprintf(fp, "%p", address);
+		return;
+	}
+
+#ifdef ALLOC_PROFILER_BACKTRACE
+	INT status = 0;
+	CHAR* demangled = abi::__cxa_demangle(symbol, NULL, NULL, &status);
+	if (status == 0 && demangled != NULL)
+	{
+		WriteFrame(fp, demangled);
+		free(demangled);
+		return;
+	}
+#endif
+	WriteFrame(fp, symbol);
+}
+
+//------------------------------------------------------------------------------
+// DumpFolded
+//------------------------------------------------------------------------------
+void AllocProfiler::DumpFolded(FILE* fp)
+{
+	_inSample = TRUE;
+	Commit(_pending);
+
+	while (_samplesLock.test_and_set(std::memory_order_acquire))
+		;
+
+	for (INT i = 0; i < MAX_SAMPLES; i++)
+	{
+		const AllocSample& sample = _samples[i];
+		if (sample.samples == 0)
+			continue;
+
+		WriteSymbol(fp, sample.tag, NULL);
+
+		// Folded stacks run from the root to the leaf
+		for (INT frame = sample.depth - 1; frame >= 0; frame--)
+		{
+			fputc(';', fp);
+#ifdef ALLOC_PROFILER_BACKTRACE
+			Dl_info info;
+			const CHAR* symbol = NULL;
+			if (dladdr(sample.stack[frame], &info) && info.dli_sname)
+				symbol = info.dli_sname;
+			WriteSymbol(fp, symbol, sample.stack[frame]);
+#else
+			WriteSymbol(fp, NULL, sample.stack[frame]);
+#endif
+		}
+		fprintf(fp, " %llu\n", (unsigned long long)sample.bytes);
+	}
+
+	if (_droppedSamples)
+		fprintf(fp, "dropped_samples %llu\n", (unsigned long long)_droppedSamples);
+
+	_samplesLock.clear(std::memory_order_release);
+	_inSample = FALSE;
+}
+
+//------------------------------------------------------------------------------
+// Reset
+//------------------------------------------------------------------------------
+void AllocProfiler::Reset()
+{
+	while (_samplesLock.test_and_set(std::memory_order_acquire))
+		;
+	memset(_samples, 0, sizeof(_samples));
+	_droppedSamples = 0;
+	_samplesLock.clear(std::memory_order_release);
+	_pending.valid = FALSE;
+}
@@ -0,0 +1,65 @@
+#ifndef _ALLOC_PROFILER_H
+#define _ALLOC_PROFILER_H
+
+#include "DataTypes.h"
+#include <stddef.h>
+#include <stdio.h>
+
+// Define ALLOC_SAMPLING to compile the sampling hooks into Allocator, xallocator
+// and the state machine event functions. Normally defined by the build (see the
+// ALLOC_SAMPLING CMake option). Sampling is then switched on at runtime with
+// AllocProfiler::SetSampleInterval().
+//#define ALLOC_SAMPLING
+
+/// @brief Sampling allocation profiler. On average one allocation is sampled per
+/// sample interval bytes and its call stack recorded. A sample is attributed to
+/// the EventData type once the block is passed to InternalEvent(), otherwise to
+/// the allocator name. Each sample stands for interval bytes of allocation, so
+/// the profile estimates the bytes allocated per call stack.
+///
+/// The profile is dumped in the folded stack format used by flamegraph.pl and
+/// speedscope, with the type as the root frame:
+///
+///     MotorData;main;Motor::SetSpeed(MotorData*);... 65536
+class AllocProfiler
+{
+public:
+	/// Set the average number of bytes between samples.
+	/// @param[in] bytes - the sample interval, or 0 to stop sampling.
+	static void SetSampleInterval(size_t bytes);
+
+	/// Called on every allocation. Only counts down the bytes until the next
+	/// sample unless a sample is due.
+	/// @param[in] pBlock - the allocated block.
+	/// @param[in] size - the block size in bytes.
+	/// @param[in] name - the allocator name or NULL.
+	static void OnAllocate(void* pBlock, size_t size, const CHAR* name)
+	{
+		m_bytesUntilSample -= (INT64)size;
+		if (m_bytesUntilSample < 0)
+			Sample(pBlock, size, name);
+	}
+
+	/// Attribute the pending sample of the calling thread to a type if the object
+	/// lies within the sampled block.
+	/// @param[in] pObject - the object, such as event data.
+	/// @param[in] tag - the type name, such as typeid(*pObject).name().
+	static void Attribute(const void* pObject, const CHAR* tag);
+
+	/// Write the profile in folded stack format.
+	/// @param[in] fp - the output file.
+	static void DumpFolded(FILE* fp);
+
+	/// Discard all samples.
+	static void Reset();
+
+private:
+	/// Take a sample and compute the bytes until the next one.
+	static void Sample(void* pBlock, size_t size, const CHAR* name);
+
+	/// Bytes until the calling thread takes its next sample. Defined inline so the
+	/// countdown is a direct thread local access. 
+	static inline thread_local INT64 m_bytesUntilSample = 0;
+};
+
+#endif
@@ -1,38 +1,93 @@
 #include "Allocator.h"
 #include "DataTypes.h"
 #include "Fault.h"
+#ifdef ALLOC_SAMPLING
+#include "AllocProfiler.h"
+#endif
 #include <new>
+#include <stdlib.h>
+#if WIN32
+#include <malloc.h>
+#endif
+
+// When malloc/free are interposed by xallocator, system heap memory must come
+// from the C runtime's own entry points to avoid recursing into xallocator.
+#if defined(XALLOCATOR_MALLOC_INTERPOSE) && defined(__GLIBC__)
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+extern "C" void __libc_free(void* ptr);
+#endif
+
+//------------------------------------------------------------------------------
+// RoundBlockSize
+//------------------------------------------------------------------------------
+static size_t RoundBlockSize(size_t size, size_t alignment)
+{
+	// Every block must hold at least the free-list pointer
+	if (size < sizeof(long*))
+		size = sizeof(long*);
+
+	// Round up so that consecutive blocks within a pool or chunk stay aligned
+	if (alignment > 1)
+		size = (size + alignment - 1) & ~(alignment - 1);
+	return size;
+}
 
 //------------------------------------------------------------------------------
 // Constructor
 //------------------------------------------------------------------------------
-Allocator::Allocator(size_t size, UINT objects, CHAR* memory, const CHAR* name) :
-    m_blockSize(size < sizeof(long*) ? sizeof(long*):size),
+Allocator::Allocator(size_t size, UINT objects, CHAR* memory, const CHAR* name, UINT chunkBlocks, size_t alignment,
+	MemoryProvider* provider) :
+    m_blockSize(RoundBlockSize(size, alignment)),
     m_objectSize(size),
+    m_alignment(alignment),
     m_maxObjects(objects),
     m_pHead(NULL),
+    m_pPool(NULL),
     m_poolIndex(0),
+    m_pChunkHead(NULL),
+    m_pChunkNext(NULL),
+    m_chunkBlocksLeft(0),
+    m_nextChunkBlocks(chunkBlocks),
+    m_chunkCnt(0),
     m_blockCnt(0),
     m_blocksInUse(0),
+    m_peakBlocksInUse(0),
     m_allocations(0),
     m_deallocations(0),
+    m_bytesReserved(0),
+    m_peakBytesReserved(0),
+    m_highWaterMark(0),
+    m_trimKeepBlocks(0),
+    m_pProvider(provider ? provider : HeapMemoryProvider::GetInstance()),
+    m_overflowPolicy(OVERFLOW_ASSERT),
+    m_pOverflow(NULL),
+    m_overflows(0),
+    m_failures(0),
     m_name(name)
 {
+	// Alignment must be a power of two
+	ASSERT_TRUE((m_alignment & (m_alignment - 1)) == 0);
+
     // If using a fixed memory pool 
 	if (m_maxObjects)
 	{
 		// If caller provided an external memory pool
 		if (memory)
 		{
+			// Caller's memory pool must meet the block alignment
+			ASSERT_TRUE(m_alignment == 0 || ((size_t)memory & (m_alignment - 1)) == 0);
 			m_pPool = memory;
 			m_allocatorMode = STATIC_POOL;
 		}
 		else 
 		{
-			m_pPool = (CHAR*)new CHAR[m_blockSize * m_maxObjects];
+			m_pPool = NewMemory(m_blockSize * m_maxObjects);
 			m_allocatorMode = HEAP_POOL;
 		}
+		Reserve(m_blockSize * m_maxObjects);
 	}
+	else if (chunkBlocks)
+		m_allocatorMode = HEAP_CHUNKS;
 	else
 		m_allocatorMode = HEAP_BLOCKS;
 }
@@ -42,14 +97,30 @@ Allocator::Allocator(size_t size, UINT objects, CHAR* memory, const CHAR* name)
 //------------------------------------------------------------------------------
 Allocator::~Allocator()
 {
-	// If using pool then destroy it, otherwise traverse free-list and 
-	// destroy each individual block
+	// Destroy the secondary overflow allocator, if any
+	if (m_pOverflow)
+	{
+		m_pOverflow->~Allocator();
+		SystemFree(m_pOverflow);
+	}
+
+	// If using pool then destroy it, if using chunks then destroy each whole 
+	// chunk, otherwise traverse free-list and destroy each individual block
 	if (m_allocatorMode == HEAP_POOL)
-		delete [] m_pPool;
+		DeleteMemory(m_pPool, m_blockSize * m_maxObjects);
+	else if (m_allocatorMode == HEAP_CHUNKS)
+	{
+		while (m_pChunkHead)
+		{
+			Chunk* pChunk = m_pChunkHead;
+			m_pChunkHead = m_pChunkHead->pNext;
+			DeleteMemory((CHAR*)pChunk, ChunkHeaderSize() + pChunk->blocks * m_blockSize);
+		}
+	}
 	else if (m_allocatorMode == HEAP_BLOCKS)
 	{
 		while(m_pHead)
-			delete [] (CHAR*)Pop();
+			DeleteMemory((CHAR*)Pop(), m_blockSize);
 	}
 }
 
@@ -75,26 +146,43 @@ void* Allocator::Allocate(size_t size)
             }
             else
             {
-                // Get the pointer to the new handler
-                std::new_handler handler = std::set_new_handler(0);
-                std::set_new_handler(handler);
-
-                // If a new handler is defined, call it
-                if (handler)
-                    (*handler)();
-                else
-                    ASSERT();
+                // Pool exhausted so apply the overflow policy
+                pBlock = Overflow(size);
+                if (!pBlock)
+                {
+                    m_failures++;
+                    return NULL;
+                }
             }
         }
+        else if (m_allocatorMode == HEAP_CHUNKS)
+        {
+            // If the current chunk is used up then get a new, larger one
+            if (m_chunkBlocksLeft == 0)
+                NewChunk();
+
+            // Carve the next block from the current chunk
+            m_blockCnt++;
+            m_chunkBlocksLeft--;
+            pBlock = (void*)m_pChunkNext;
+            m_pChunkNext += m_blockSize;
+        }
         else
         {
         	m_blockCnt++;
-            pBlock = (void*)new CHAR[m_blockSize];
+            pBlock = (void*)NewMemory(m_blockSize);
+            Reserve(m_blockSize);
         }
     }
 
     m_blocksInUse++;
     m_allocations++;
+    if (m_blocksInUse > m_peakBlocksInUse)
+        m_peakBlocksInUse = m_blocksInUse;
+
+#ifdef ALLOC_SAMPLING
+    AllocProfiler::OnAllocate(pBlock, m_blockSize, m_name);
+#endif
 	
     return pBlock;
 }
@@ -104,9 +192,295 @@ void* Allocator::Allocate(size_t size)
 //------------------------------------------------------------------------------
 void Allocator::Deallocate(void* pBlock)
 {
+    // Blocks outside of the pool came from the overflow allocator
+    if (m_pOverflow && !IsPoolBlock(pBlock))
+    {
+        m_pOverflow->Deallocate(pBlock);
+        m_blocksInUse--;
+        m_deallocations++;
+        return;
+    }
+
     Push(pBlock);
 	m_blocksInUse--;
 	m_deallocations++;
+
+	// Periodically give idle memory back once above the high water mark
+	if (m_highWaterMark && m_bytesReserved > m_highWaterMark &&
+		(m_deallocations & TRIM_CHECK_MASK) == 0)
+		Trim(m_trimKeepBlocks);
+}
+
+//------------------------------------------------------------------------------
+// AllocateN
+//------------------------------------------------------------------------------
+UINT Allocator::AllocateN(void** pBlocks, UINT count, size_t size)
+{
+    ASSERT_TRUE(size <= m_objectSize);
+
+    // Detach a run of blocks from the head of the free-list
+    UINT allocated = 0;
+    Block* pBlock = m_pHead;
+    while (allocated < count && pBlock)
+    {
+        pBlocks[allocated++] = pBlock;
+        pBlock = pBlock->pNext;
+    }
+    m_pHead = pBlock;
+    m_blocksInUse += allocated;
+    m_allocations += allocated;
+    if (m_blocksInUse > m_peakBlocksInUse)
+        m_peakBlocksInUse = m_blocksInUse;
+
+#ifdef ALLOC_SAMPLING
+    if (allocated)
+        AllocProfiler::OnAllocate(pBlocks[0], allocated * m_blockSize, m_name);
+#endif
+
+    // The free-list is empty so create the remaining blocks
+    for (; allocated < count; allocated++)
+    {
+        pBlocks[allocated] = Allocate(size);
+        if (!pBlocks[allocated])
+            break;
+    }
+    return allocated;
+}
+
+//------------------------------------------------------------------------------
+// DeallocateN
+//------------------------------------------------------------------------------
+void Allocator::DeallocateN(void** pBlocks, UINT count)
+{
+    if (count == 0)
+        return;
+
+    // Overflow blocks must be sorted back to their own allocator
+    if (m_pOverflow)
+    {
+        for (UINT i = 0; i < count; i++)
+            Deallocate(pBlocks[i]);
+        return;
+    }
+
+    // Link the blocks into a chain and splice it onto the free-list head
+    for (UINT i = 0; i < count - 1; i++)
+        ((Block*)pBlocks[i])->pNext = (Block*)pBlocks[i + 1];
+    ((Block*)pBlocks[count - 1])->pNext = m_pHead;
+    m_pHead = (Block*)pBlocks[0];
+
+    UINT64 deallocations = m_deallocations;
+    m_blocksInUse -= count;
+    m_deallocations += count;
+
+    // Check the high water mark if the batch crossed a check interval
+    if (m_highWaterMark && m_bytesReserved > m_highWaterMark &&
+        (deallocations & ~(UINT64)TRIM_CHECK_MASK) != (m_deallocations & ~(UINT64)TRIM_CHECK_MASK))
+        Trim(m_trimKeepBlocks);
+}
+
+//------------------------------------------------------------------------------
+// Overflow
+//------------------------------------------------------------------------------
+void* Allocator::Overflow(size_t size)
+{
+	if (m_overflowPolicy == OVERFLOW_FAIL)
+		return NULL;
+
+	if (m_overflowPolicy == OVERFLOW_HEAP)
+	{
+		// Chain to a secondary heap allocator handling the same block size
+		if (!m_pOverflow)
+		{
+			void* pMemory = SystemAllocate(sizeof(Allocator));
+			if (!pMemory)
+				return NULL;
+			m_pOverflow = new (pMemory) Allocator(m_objectSize, 0, NULL, m_name, 
+				OVERFLOW_CHUNK_BLOCKS, m_alignment, m_pProvider);
+		}
+		m_overflows++;
+		return m_pOverflow->Allocate(size);
+	}
+
+	// Get the pointer to the new handler
+	std::new_handler handler = std::set_new_handler(0);
+	std::set_new_handler(handler);
+
+	// If a new handler is defined, call it and retry the free-list since
+	// the handler may have released blocks
+	if (handler)
+	{
+		(*handler)();
+		return Pop();
+	}
+
+	ASSERT();
+	return NULL;
+}
+
+//------------------------------------------------------------------------------
+// SetOverflowPolicy
+//------------------------------------------------------------------------------
+void Allocator::SetOverflowPolicy(OverflowPolicy policy)
+{
+	m_overflowPolicy = policy;
+}
+
+//------------------------------------------------------------------------------
+// Trim
+//------------------------------------------------------------------------------
+UINT Allocator::Trim(UINT keepBlocks)
+{
+	if (m_allocatorMode == HEAP_CHUNKS)
+		return TrimChunks(keepBlocks);
+
+	// A pool has a fixed budget, only its overflow allocator can give memory back
+	if (m_allocatorMode != HEAP_BLOCKS)
+		return m_pOverflow ? m_pOverflow->Trim(keepBlocks) : 0;
+
+	// Every created block not in use is on the free-list
+	UINT released = 0;
+	UINT freeBlocks = m_blockCnt - m_blocksInUse;
+	while (freeBlocks > keepBlocks && m_pHead)
+	{
+		DeleteMemory((CHAR*)Pop(), m_blockSize);
+		freeBlocks--;
+		released++;
+	}
+
+	m_blockCnt -= released;
+	Reserve(-(ptrdiff_t)(released * m_blockSize));
+	return released;
+}
+
+//------------------------------------------------------------------------------
+// FindChunk
+//------------------------------------------------------------------------------
+UINT Allocator::FindChunk(const ChunkInfo* chunks, UINT cnt, const void* pBlock)
+{
+	// Binary search for the last chunk starting at or below the block address
+	UINT lo = 0, hi = cnt;
+	while (hi - lo > 1)
+	{
+		UINT mid = (lo + hi) / 2;
+		if ((const CHAR*)chunks[mid].pChunk <= (const CHAR*)pBlock)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+//------------------------------------------------------------------------------
+// TrimChunks
+//------------------------------------------------------------------------------
+UINT Allocator::TrimChunks(UINT keepBlocks)
+{
+	UINT freeBlocks = m_blockCnt - m_blocksInUse;
+	if (freeBlocks <= keepBlocks || m_chunkCnt == 0)
+		return 0;
+
+	// Build a table of chunks sorted by address to count the free blocks 
+	// within each chunk. Trimming is rare so the table is created on demand.
+	ChunkInfo* chunks = (ChunkInfo*)SystemAllocate(m_chunkCnt * sizeof(ChunkInfo));
+	if (chunks == NULL)
+		return 0;
+	UINT cnt = 0;
+	for (Chunk* pChunk = m_pChunkHead; pChunk; pChunk = pChunk->pNext)
+	{
+		// Only part of the newest chunk may have been carved into blocks
+		UINT carved = pChunk->blocks;
+		if (pChunk == m_pChunkHead)
+			carved -= m_chunkBlocksLeft;
+
+		// Insertion sort by chunk address
+		UINT i = cnt++;
+		while (i > 0 && chunks[i-1].pChunk > pChunk)
+		{
+			chunks[i] = chunks[i-1];
+			i--;
+		}
+		chunks[i].pChunk = pChunk;
+		chunks[i].carved = carved;
+		chunks[i].free = 0;
+	}
+
+	// Attribute each free block to the chunk holding it
+	for (Block* pBlock = m_pHead; pBlock; pBlock = pBlock->pNext)
+		chunks[FindChunk(chunks, cnt, pBlock)].free++;
+
+	// Pick idle chunks to release while still keeping enough free blocks
+	UINT released = 0;
+	for (UINT i = 0; i < cnt; i++)
+	{
+		if (chunks[i].free == chunks[i].carved && 
+			freeBlocks - chunks[i].carved >= keepBlocks)
+		{
+			freeBlocks -= chunks[i].carved;
+			released += chunks[i].carved;
+			chunks[i].carved = (UINT)-1;	// Mark for release
+		}
+	}
+
+	if (released)
+	{
+		// Remove blocks within released chunks from the free-list
+		Block** ppBlock = &m_pHead;
+		while (*ppBlock)
+		{
+			if (chunks[FindChunk(chunks, cnt, *ppBlock)].carved == (UINT)-1)
+				*ppBlock = (*ppBlock)->pNext;
+			else
+				ppBlock = &(*ppBlock)->pNext;
+		}
+
+		// Unlink and destroy the released chunks
+		Chunk** ppChunk;
+		for (UINT i = 0; i < cnt; i++)
+		{
+			if (chunks[i].carved != (UINT)-1)
+				continue;
+
+			// Blocks are carved from the newest chunk at the head of the list
+			Chunk* pChunk = chunks[i].pChunk;
+			if (pChunk == m_pChunkHead)
+			{
+				m_pChunkNext = NULL;
+				m_chunkBlocksLeft = 0;
+			}
+
+			for (ppChunk = &m_pChunkHead; *ppChunk != pChunk; ppChunk = &(*ppChunk)->pNext)
+				;
+			*ppChunk = pChunk->pNext;
+
+			Reserve(-(ptrdiff_t)(ChunkHeaderSize() + pChunk->blocks * m_blockSize));
+			DeleteMemory((CHAR*)pChunk, ChunkHeaderSize() + pChunk->blocks * m_blockSize);
+			m_chunkCnt--;
+		}
+		m_blockCnt -= released;
+	}
+
+	SystemFree(chunks);
+	return released;
+}
+
+//------------------------------------------------------------------------------
+// SetHighWaterMark
+//------------------------------------------------------------------------------
+void Allocator::SetHighWaterMark(size_t bytes, UINT keepBlocks)
+{
+	m_highWaterMark = bytes;
+	m_trimKeepBlocks = keepBlocks;
+}
+
+//------------------------------------------------------------------------------
+// Reserve
+//------------------------------------------------------------------------------
+void Allocator::Reserve(ptrdiff_t bytes)
+{
+	m_bytesReserved += bytes;
+	if (m_bytesReserved > m_peakBytesReserved)
+		m_peakBytesReserved = m_bytesReserved;
 }
 
 //------------------------------------------------------------------------------
@@ -135,7 +509,86 @@ void* Allocator::Pop()
     return (void*)pBlock;
 }
 
+//------------------------------------------------------------------------------
+// NewChunk
+//------------------------------------------------------------------------------
+void Allocator::NewChunk()
+{
+    UINT blocks = m_nextChunkBlocks;
+
+    // Get one contiguous chunk off the heap with the chunk header at the front
+    CHAR* pMemory = NewMemory(ChunkHeaderSize() + blocks * m_blockSize);
+    Chunk* pChunk = (Chunk*)pMemory;
+    pChunk->blocks = blocks;
+    pChunk->pNext = m_pChunkHead;
+    m_pChunkHead = pChunk;
+    m_chunkCnt++;
+    Reserve(ChunkHeaderSize() + blocks * m_blockSize);
+
+    // Blocks are carved from the chunk on demand so untouched pages stay untouched
+    m_pChunkNext = pMemory + ChunkHeaderSize();
+    m_chunkBlocksLeft = blocks;
+
+    // Grow the next chunk geometrically until it reaches the maximum chunk size
+    if ((size_t)blocks * 2 * m_blockSize <= MAX_CHUNK_SIZE)
+        m_nextChunkBlocks = blocks * 2;
+}
+
+
 
 
 
 
+//------------------------------------------------------------------------------
+// NewMemory
+//------------------------------------------------------------------------------
+CHAR* Allocator::NewMemory(size_t size)
+{
+	CHAR* pMemory = (CHAR*)m_pProvider->Allocate(size, m_alignment);
+	if (pMemory == NULL)
+		throw std::bad_alloc();
+	return pMemory;
+}
+
+//------------------------------------------------------------------------------
+// DeleteMemory
+//------------------------------------------------------------------------------
+void Allocator::DeleteMemory(CHAR* pMemory, size_t size)
+{
+	m_pProvider->Free(pMemory, size, m_alignment);
+}
+
+//------------------------------------------------------------------------------
+// SystemAllocate
+//------------------------------------------------------------------------------
+void* Allocator::SystemAllocate(size_t size, size_t alignment)
+{
+	// Never go through operator new here. It may itself be routed to the
+	// allocators when global new/delete replacement is enabled. 
+	if (alignment < sizeof(void*))
+		alignment = sizeof(void*);
+#if WIN32
+	return _aligned_malloc(size, alignment);
+#elif defined(XALLOCATOR_MALLOC_INTERPOSE) && defined(__GLIBC__)
+	return __libc_memalign(alignment, size);
+#else
+	void* pMemory = NULL;
+	if (posix_memalign(&pMemory, alignment, size) != 0)
+		return NULL;
+	return pMemory;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// SystemFree
+//------------------------------------------------------------------------------
+void Allocator::SystemFree(void* pMemory)
+{
+#if WIN32
+	_aligned_free(pMemory);
+#elif defined(XALLOCATOR_MALLOC_INTERPOSE) && defined(__GLIBC__)
+	__libc_free(pMemory);
+#else
+	free(pMemory);
+#endif
+}
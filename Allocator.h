@@ -2,13 +2,47 @@
 #define __ALLOCATOR_H
 
 #include "DataTypes.h"
+#include "MemoryProvider.h"
 #include <stddef.h>
+#include <new>
+#include <atomic>
+
+/// @brief A statistics counter with a single writer and lock-free readers. The 
+/// writer is serialized by the allocator's caller, so updates are relaxed load
+/// and store pairs rather than atomic read-modify-write instructions. A reader 
+/// never sees a torn value, even for 64-bit counters on 32-bit targets.
+template <class T>
+class StatCounter
+{
+public:
+    StatCounter(T value = 0) : m_value(value) {}
+    operator T() const { return m_value.load(std::memory_order_relaxed); }
+    StatCounter& operator=(T value) { m_value.store(value, std::memory_order_relaxed); return *this; }
+    StatCounter& operator=(const StatCounter& other) { return *this = (T)other; }
+    StatCounter& operator+=(T value) { return *this = *this + value; }
+    StatCounter& operator-=(T value) { return *this = *this - value; }
+    StatCounter& operator++() { return *this += 1; }
+    StatCounter& operator--() { return *this -= 1; }
+    T operator++(int) { T value = *this; *this = value + 1; return value; }
+    T operator--(int) { T value = *this; *this = value - 1; return value; }
+private:
+    StatCounter(const StatCounter&);
+    std::atomic<T> m_value;
+};
 
 /// @see https://github.com/endurodave/Allocator
 /// David Lafreniere
 class Allocator
 {
 public:
+    /// Action taken when a pool allocator has no free blocks left
+    enum OverflowPolicy
+    {
+        OVERFLOW_ASSERT,    ///< Call the new-handler if one is set, otherwise ASSERT() (default)
+        OVERFLOW_HEAP,      ///< Chain to a secondary heap allocator of the same block size
+        OVERFLOW_FAIL       ///< Return NULL from Allocate()
+    };
+
     /// Constructor
     /// @param[in]  size - size of the fixed blocks
     /// @param[in]  objects - maximum number of object. If 0, new blocks are
@@ -17,7 +51,17 @@ public:
 	///		to obtain memory from global heap. If not NULL, the objects argument 
 	///		defines the size of the memory block (size x objects = memory size in bytes).
 	///	@param[in]	name - optional allocator name string.
-    Allocator(size_t size, UINT objects=0, CHAR* memory = NULL, const CHAR* name=NULL);
+	///	@param[in]	chunkBlocks - if objects is 0 and chunkBlocks is not 0, new blocks
+	///		are obtained from the heap in contiguous chunks instead of one block at a 
+	///		time. The first chunk holds chunkBlocks blocks and each refill doubles the
+	///		chunk size up to MAX_CHUNK_SIZE bytes.
+	///	@param[in]	alignment - block alignment in bytes, a power of two, or 0 for the
+	///		default heap alignment. The block size is rounded up to a multiple of the
+	///		alignment. A static memory argument must be aligned by the caller. 
+	///	@param[in]	provider - the backing memory provider for heap pools, chunks and 
+	///		blocks, or NULL for the system heap. Must outlive the allocator.
+    Allocator(size_t size, UINT objects=0, CHAR* memory = NULL, const CHAR* name=NULL, UINT chunkBlocks=0, size_t alignment=0, 
+        MemoryProvider* provider=NULL);
 
     /// Destructor
     ~Allocator();
@@ -31,6 +75,51 @@ public:
     /// @param[in]  pBlock - block of memory deallocate (i.e push onto free-list)
     void Deallocate(void* pBlock);
 
+    /// Get a batch of memory blocks. Free blocks are detached from the free-list 
+    /// in a single pass and any shortfall is obtained as Allocate() would.
+    /// @param[out] pBlocks - array receiving count block pointers.
+    /// @param[in]  count - the number of blocks to allocate.
+    /// @param[in]  size - size of each block to allocate.
+    /// @return     The number of blocks allocated. Less than count only if the 
+    ///     overflow policy returned NULL.
+    UINT AllocateN(void** pBlocks, UINT count, size_t size);
+
+    /// Return a batch of memory blocks. The blocks are linked together and pushed
+    /// onto the free-list at once.
+    /// @param[in]  pBlocks - array of count blocks to deallocate.
+    /// @param[in]  count - the number of blocks.
+    void DeallocateN(void** pBlocks, UINT count);
+
+    /// Release idle heap memory back to the system. In HEAP_BLOCKS mode free blocks
+    /// are deleted individually. In HEAP_CHUNKS mode only whole chunks with no blocks
+    /// in use are released. Pool modes have a fixed memory budget and only trim their
+    /// overflow allocator, if any.
+    /// @param[in]  keepBlocks - the number of free blocks to retain for reuse.
+    /// @return     The number of blocks released. 
+    UINT Trim(UINT keepBlocks = 0);
+
+    /// Set a high water mark policy. Once the bytes reserved exceed the high water
+    /// mark, Deallocate() periodically calls Trim() to give idle memory back.
+    /// @param[in]  bytes - the high water mark in bytes, or 0 to disable the policy.
+    /// @param[in]  keepBlocks - the number of free blocks to retain when trimming.
+    void SetHighWaterMark(size_t bytes, UINT keepBlocks = 0);
+
+    /// Set the action taken when a pool allocator is exhausted. Heap allocators
+    /// never run out of blocks so the policy has no effect on them. 
+    /// @param[in]  policy - the overflow policy.
+    void SetOverflowPolicy(OverflowPolicy policy);
+
+    /// Get memory directly from the system heap. Allocator memory never comes from
+    /// operator new or malloc since either may be routed back to xallocator.
+    /// @param[in]  size - the number of bytes to obtain.
+    /// @param[in]  alignment - the memory alignment, a power of two, or 0 for default.
+    /// @return     A pointer to the memory, or NULL if the system heap is exhausted.
+    static void* SystemAllocate(size_t size, size_t alignment = 0);
+
+    /// Return memory obtained with SystemAllocate() to the system heap.
+    /// @param[in]  pMemory - the memory to release.
+    static void SystemFree(void* pMemory);
+
     /// Get the allocator name string.
     /// @return		A pointer to the allocator name or NULL if none was assigned.
     const CHAR* GetName() { return m_name; }
@@ -39,21 +128,54 @@ public:
     /// @return		The fixed block size in bytes.
     size_t GetBlockSize() { return m_blockSize; }
 
+    /// Gets the block alignment handled by the allocator.
+    /// @return		The block alignment in bytes, or 0 if default heap alignment.
+    size_t GetAlignment() { return m_alignment; }
+
     /// Gets the maximum number of blocks created by the allocator.
     /// @return		The number of fixed memory blocks created.
     UINT GetBlockCount() { return m_blockCnt; }
 
+    /// Gets the number of heap chunks obtained by the allocator. 
+    /// @return		The number of chunks, or 0 if not using heap chunks.
+    UINT GetChunkCount() { return m_chunkCnt; }
+
+    /// Gets the number of bytes currently reserved from the heap or pool.
+    /// @return		The bytes reserved by the allocator.
+    size_t GetBytesReserved() { return m_bytesReserved; }
+
+    /// Gets the highest number of bytes ever reserved by the allocator.
+    /// @return		The peak bytes reserved.
+    size_t GetPeakBytesReserved() { return m_peakBytesReserved; }
+
+    /// Gets the number of bytes handed out to the application.
+    /// @return		The bytes in use.
+    size_t GetBytesInUse() { return m_blocksInUse * m_blockSize; }
+
     /// Gets the number of blocks in use.
     /// @return		The number of blocks in use by the application.
     UINT GetBlocksInUse() { return m_blocksInUse; }
 
+    /// Gets the highest number of blocks ever in use at once.
+    /// @return		The peak number of blocks in use.
+    UINT GetPeakBlocksInUse() { return m_peakBlocksInUse; }
+
     /// Gets the total number of allocations for this allocator instance.
     /// @return		The total number of allocations.
-    UINT GetAllocations() { return m_allocations; }
+    UINT64 GetAllocations() { return m_allocations; }
 
     /// Gets the total number of deallocations for this allocator instance.
     /// @return		The total number of deallocations.
-    UINT GetDeallocations() { return m_deallocations; }
+    UINT64 GetDeallocations() { return m_deallocations; }
+
+    /// Gets the number of allocations served by the secondary heap allocator
+    /// because the pool was exhausted. 
+    /// @return		The number of overflow allocations.
+    UINT64 GetOverflows() { return m_overflows; }
+
+    /// Gets the number of allocations that returned NULL.
+    /// @return		The number of failed allocations.
+    UINT64 GetFailures() { return m_failures; }
 	
 private:
     /// Push a memory block onto head of free-list.
@@ -64,24 +186,120 @@ private:
     /// @return     Returns pointer to the block. Otherwise NULL if unsuccessful.
     void* Pop();
 
+    /// Get memory from the memory provider honoring the allocator alignment.
+    /// @param[in]  size - the number of bytes to obtain.
+    /// @return     A pointer to the memory.
+    CHAR* NewMemory(size_t size);
+
+    /// Return memory obtained with NewMemory() to the heap.
+    /// @param[in]  pMemory - the memory to release.
+    /// @param[in]  size - the size passed to NewMemory().
+    void DeleteMemory(CHAR* pMemory, size_t size);
+
+    /// Gets the chunk header size keeping the first block in a chunk aligned.
+    /// @return     The chunk header size in bytes.
+    size_t ChunkHeaderSize() const 
+    { 
+        return m_alignment > CHUNK_HEADER_SIZE ? m_alignment : (size_t)CHUNK_HEADER_SIZE; 
+    }
+
+    /// Apply the overflow policy when the pool is exhausted.
+    /// @param[in]  size - size of the block to allocate.
+    /// @return     Returns pointer to the block. Otherwise NULL if unsuccessful.
+    void* Overflow(size_t size);
+
+    /// Check whether a block lies within the pool memory.
+    /// @param[in]  pBlock - the block to check.
+    /// @return     TRUE if the block is a pool block.
+    BOOL IsPoolBlock(void* pBlock) const
+    {
+        return (CHAR*)pBlock >= m_pPool && (CHAR*)pBlock < m_pPool + m_blockSize * m_maxObjects;
+    }
+
+    /// Obtain a new heap chunk to carve blocks from. Each new chunk is twice
+    /// the size of the previous one, up to MAX_CHUNK_SIZE bytes. 
+    void NewChunk();
+
+    /// Release whole chunks that have no blocks in use. 
+    /// @param[in]  keepBlocks - the number of free blocks to retain.
+    /// @return     The number of blocks released.
+    UINT TrimChunks(UINT keepBlocks);
+
+    struct ChunkInfo;
+
+    /// Find the chunk holding a block within a table of chunks sorted by address.
+    /// @param[in]  chunks - the sorted chunk table.
+    /// @param[in]  cnt - the number of chunk table entries.
+    /// @param[in]  pBlock - a block carved from one of the chunks.
+    /// @return     The chunk table index. 
+    static UINT FindChunk(const ChunkInfo* chunks, UINT cnt, const void* pBlock);
+
+    /// Update the bytes reserved and track the peak.
+    /// @param[in]  bytes - the bytes reserved (positive) or released (negative).
+    void Reserve(ptrdiff_t bytes);
+
     struct Block
     {
         Block* pNext;
     };
 
-	enum AllocatorMode { HEAP_BLOCKS, HEAP_POOL, STATIC_POOL };
+    /// Header stored at the start of each heap chunk
+    struct Chunk
+    {
+        Chunk* pNext;
+        UINT blocks;
+    };
+
+    /// Per-chunk usage gathered while trimming
+    struct ChunkInfo
+    {
+        Chunk* pChunk;
+        UINT carved;
+        UINT free;
+    };
+
+    /// Chunk header size rounded up to keep the first block aligned
+    enum { CHUNK_HEADER_SIZE = (sizeof(Chunk) + 15) & ~15 };
+
+    /// Chunks stop growing once they reach this size in bytes. A huge page 
+    /// PageMemoryProvider packs chunks into huge page arenas instead.
+    enum { MAX_CHUNK_SIZE = 64 * 1024 };
+
+    /// Blocks in the first chunk of a secondary overflow allocator
+    enum { OVERFLOW_CHUNK_BLOCKS = 8 };
+
+    /// Deallocations between high water mark checks (power of two minus one)
+    enum { TRIM_CHECK_MASK = 0xFF };
+
+	enum AllocatorMode { HEAP_BLOCKS, HEAP_POOL, STATIC_POOL, HEAP_CHUNKS };
 
     const size_t m_blockSize;
     const size_t m_objectSize;
+    const size_t m_alignment;
     const UINT m_maxObjects;
 	AllocatorMode m_allocatorMode;
     Block* m_pHead;
     CHAR* m_pPool;
     UINT m_poolIndex;
-    UINT m_blockCnt;
-    UINT m_blocksInUse;
-    UINT m_allocations;
-    UINT m_deallocations;
+    Chunk* m_pChunkHead;
+    CHAR* m_pChunkNext;
+    UINT m_chunkBlocksLeft;
+    UINT m_nextChunkBlocks;
+    StatCounter<UINT> m_chunkCnt;
+    StatCounter<UINT> m_blockCnt;
+    StatCounter<UINT> m_blocksInUse;
+    StatCounter<UINT> m_peakBlocksInUse;
+    StatCounter<UINT64> m_allocations;
+    StatCounter<UINT64> m_deallocations;
+    StatCounter<size_t> m_bytesReserved;
+    StatCounter<size_t> m_peakBytesReserved;
+    size_t m_highWaterMark;
+    UINT m_trimKeepBlocks;
+    MemoryProvider* m_pProvider;
+    OverflowPolicy m_overflowPolicy;
+    Allocator* m_pOverflow;
+    StatCounter<UINT64> m_overflows;
+    StatCounter<UINT64> m_failures;
     const CHAR* m_name;
 };
 
@@ -90,28 +308,79 @@ template <class T, UINT Objects>
 class AllocatorPool : public Allocator
 {
 public:
-	AllocatorPool() : Allocator(sizeof(T), Objects, m_memory)
+	AllocatorPool() : Allocator(sizeof(T), Objects, m_memory, NULL, 0, alignof(T))
 	{
 	}
 private:
-	CHAR m_memory[sizeof(T) * Objects];
+	// Every block holds at least the free-list pointer
+	alignas(T) CHAR m_memory[(sizeof(T) < sizeof(long*) ? sizeof(long*) : sizeof(T)) * Objects];
 };
 
-// macro to provide header file interface
+// Class-specific array new allocates a variable size that a fixed block allocator 
+// cannot serve, so DECLARE_ALLOCATOR routes arrays to the global heap. The aligned
+// scalar forms use the allocator since IMPLEMENT_ALLOCATOR aligns the blocks.
+#ifdef __cpp_aligned_new
+#define DECLARE_ALLOCATOR_ALIGNED \
+        void* operator new(size_t size, std::align_val_t) { \
+            void* pObject = _allocator.Allocate(size); \
+            if (pObject == NULL) \
+                throw std::bad_alloc(); \
+            return pObject; \
+        } \
+        void* operator new[](size_t size, std::align_val_t alignment) { \
+            return ::operator new[](size, alignment); \
+        } \
+        void operator delete(void* pObject, std::align_val_t) { \
+            _allocator.Deallocate(pObject); \
+        } \
+        void operator delete(void* pObject, size_t, std::align_val_t) { \
+            _allocator.Deallocate(pObject); \
+        } \
+        void operator delete[](void* pObject, std::align_val_t alignment) { \
+            ::operator delete[](pObject, alignment); \
+        } \
+        void operator delete[](void* pObject, size_t, std::align_val_t alignment) { \
+            ::operator delete[](pObject, alignment); \
+        }
+#else
+#define DECLARE_ALLOCATOR_ALIGNED
+#endif
+
+// macro to provide header file interface. Allocate() returns NULL when the pool 
+// is exhausted under OVERFLOW_FAIL, which operator new reports as std::bad_alloc.
 #define DECLARE_ALLOCATOR \
     public: \
+        static Allocator& GetAllocator() { \
+            return _allocator; \
+        } \
         void* operator new(size_t size) { \
-            return _allocator.Allocate(size); \
+            void* pObject = _allocator.Allocate(size); \
+            if (pObject == NULL) \
+                throw std::bad_alloc(); \
+            return pObject; \
+        } \
+        void* operator new[](size_t size) { \
+            return ::operator new[](size); \
         } \
         void operator delete(void* pObject) { \
             _allocator.Deallocate(pObject); \
         } \
+        void operator delete(void* pObject, size_t) { \
+            _allocator.Deallocate(pObject); \
+        } \
+        void operator delete[](void* pObject) { \
+            ::operator delete[](pObject); \
+        } \
+        void operator delete[](void* pObject, size_t) { \
+            ::operator delete[](pObject); \
+        } \
+        DECLARE_ALLOCATOR_ALIGNED \
     private: \
         static Allocator _allocator; 
 
 // macro to provide source file interface
 #define IMPLEMENT_ALLOCATOR(class, objects, memory) \
-	Allocator class::_allocator(sizeof(class), objects, memory, #class);
+	Allocator class::_allocator(sizeof(class), objects, memory, #class, 0, alignof(class));
 
 #endif
 
@@ -0,0 +1,106 @@
+#include "Appliance.h"
+#include <iostream>
+
+using namespace std;
+
+DoorRegion::DoorRegion() :
+	StateRegion(ST_MAX_STATES)
+{
+}
+
+void DoorRegion::DispatchEvent(INT event, const EventData*)
+{
+	switch (event)
+	{
+	case EV_OPEN_DOOR:		Open();		break;
+	case EV_CLOSE_DOOR:		Close();	break;
+	default:							break;
+	}
+}
+
+// open door external event
+void DoorRegion::Open()
+{
+	BEGIN_TRANSITION_MAP			              			// - Current State -
+		TRANSITION_MAP_ENTRY (ST_OPENED)						// ST_CLOSED
+		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_OPENED
+	END_TRANSITION_MAP(NULL)
+}
+
+// close door external event
+void DoorRegion::Close()
+{
+	BEGIN_TRANSITION_MAP			              			// - Current State -
+		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_CLOSED
+		TRANSITION_MAP_ENTRY (ST_CLOSED)					// ST_OPENED
+	END_TRANSITION_MAP(NULL)
+}
+
+STATE_DEFINE(DoorRegion, Closed, NoEventData)
+{
+	cout << "DoorRegion::ST_Closed" << endl;
+}
+
+STATE_DEFINE(DoorRegion, Opened, NoEventData)
+{
+	cout << "DoorRegion::ST_Opened" << endl;
+}
+
+HeaterRegion::HeaterRegion() :
+	StateRegion(ST_MAX_STATES),
+	m_temperature(0)
+{
+}
+
+void HeaterRegion::DispatchEvent(INT event, const EventData* pData)
+{
+	switch (event)
+	{
+	case EV_HEAT:			Heat(static_cast<const HeaterData*>(pData));	break;
+	case EV_OPEN_DOOR:		TurnOff();	break;		// Never heat with the door open
+	case EV_POWER_OFF:		TurnOff();	break;
+	default:							break;
+	}
+}
+
+// heat external event
+void HeaterRegion::Heat(const HeaterData* data)
+{
+	BEGIN_TRANSITION_MAP			              			// - Current State -
+		TRANSITION_MAP_ENTRY (ST_ON)						// ST_OFF
+		TRANSITION_MAP_ENTRY (ST_ON)						// ST_ON
+	END_TRANSITION_MAP(data)
+}
+
+// heater off external event
+void HeaterRegion::TurnOff()
+{
+	BEGIN_TRANSITION_MAP			              			// - Current State -
+		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_OFF
+		TRANSITION_MAP_ENTRY (ST_OFF)						// ST_ON
+	END_TRANSITION_MAP(NULL)
+}
+
+STATE_DEFINE(HeaterRegion, Off, NoEventData)
+{
+	cout << "HeaterRegion::ST_Off" << endl;
+}
+
+STATE_DEFINE(HeaterRegion, On, HeaterData)
+{
+	m_temperature = data->temperature;
+	cout << "HeaterRegion::ST_On : Temperature is " << m_temperature << endl;
+}
+
+EXIT_DEFINE(HeaterRegion, ExitOn)
+{
+	cout << "HeaterRegion::EX_ExitOn" << endl;
+	m_temperature = 0;
+}
+
+Appliance::Appliance(ThreadPool* pool) :
+	OrthogonalStateMachine(pool)
+{
+	AddRegion(m_door);
+	AddRegion(m_heater);
+}
@@ -0,0 +1,113 @@
+#ifndef _APPLIANCE_H
+#define _APPLIANCE_H
+
+#include "OrthogonalStateMachine.h"
+
+class HeaterData : public EventData
+{
+public:
+	INT temperature;
+};
+
+// Appliance events, dispatched to every Appliance region
+enum ApplianceEvents
+{
+	EV_OPEN_DOOR,
+	EV_CLOSE_DOOR,
+	EV_HEAT,
+	EV_POWER_OFF
+};
+
+/// @brief Door region of the Appliance.
+class DoorRegion : public StateRegion
+{
+public:
+	DoorRegion();
+
+	// External events taken by this region
+	void Open();
+	void Close();
+
+private:
+	virtual void DispatchEvent(INT event, const EventData* pData);
+
+	// State enumeration order must match the order of state method entries
+	// in the state map.
+	enum States
+	{
+		ST_CLOSED,
+		ST_OPENED,
+		ST_MAX_STATES
+	};
+
+	// Define the state machine state functions with event data type
+	STATE_DECLARE(DoorRegion, 	Closed,		NoEventData)
+	STATE_DECLARE(DoorRegion, 	Opened,		NoEventData)
+
+	// State map to define state object order. Each state map entry defines a
+	// state object.
+	BEGIN_STATE_MAP_EX
+		STATE_MAP_ENTRY_EX(&Closed)
+		STATE_MAP_ENTRY_EX(&Opened)
+	END_STATE_MAP_EX
+};
+
+/// @brief Heater region of the Appliance.
+class HeaterRegion : public StateRegion
+{
+public:
+	HeaterRegion();
+
+	// External events taken by this region
+	void Heat(const HeaterData* data);
+	void TurnOff();
+
+private:
+	INT m_temperature;
+
+	virtual void DispatchEvent(INT event, const EventData* pData);
+
+	// State enumeration order must match the order of state method entries
+	// in the state map.
+	enum States
+	{
+		ST_OFF,
+		ST_ON,
+		ST_MAX_STATES
+	};
+
+	// Define the state machine state functions with event data type
+	STATE_DECLARE(HeaterRegion, 	Off,		NoEventData)
+	STATE_DECLARE(HeaterRegion, 	On,			HeaterData)
+	EXIT_DECLARE(HeaterRegion, 		ExitOn)
+
+	// State map to define state object order. Each state map entry defines a
+	// state object.
+	BEGIN_STATE_MAP_EX
+		STATE_MAP_ENTRY_EX(&Off)
+		STATE_MAP_ENTRY_ALL_EX(&On, 0, 0, &ExitOn)
+	END_STATE_MAP_EX
+};
+
+/// @brief Appliance shows orthogonal regions. The door and heater are independent
+/// regions of one machine, and each Appliance event is dispatched to both. The 
+/// heater region also turns itself off when the door opens.
+class Appliance : public OrthogonalStateMachine
+{
+public:
+	/// Constructor.
+	/// @param[in] pool - the thread pool running the regions concurrently, or NULL.
+	Appliance(ThreadPool* pool = NULL);
+
+	// External events taken by this state machine
+	void OpenDoor()					{ Dispatch(EV_OPEN_DOOR); }
+	void CloseDoor()				{ Dispatch(EV_CLOSE_DOOR); }
+	void Heat(HeaterData* data)		{ Dispatch(EV_HEAT, data); }
+	void PowerOff()					{ Dispatch(EV_POWER_OFF); }
+
+private:
+	DoorRegion m_door;
+	HeaterRegion m_heater;
+};
+
+#endif
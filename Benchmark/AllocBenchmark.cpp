@@ -0,0 +1,167 @@
+#include "Motor.h"
+#include "Player.h"
+#include "CentrifugeTest.h"
+#include "xallocator.h"
+#include "MemoryProvider.h"
+#include <string.h>
+#ifdef ALLOC_SAMPLING
+#include "AllocProfiler.h"
+#include <stdio.h>
+#endif
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// Whole application allocation throughput benchmark. The same workload is built
+// twice: AllocBenchmark uses the system heap and AllocBenchmarkXalloc routes the
+// global operator new/delete through xallocator (XALLOCATOR_GLOBAL_NEW). Compare
+// the ns/op figures of the two executables. Pass --pages to AllocBenchmarkXalloc
+// to have the xallocator size classes created during the run obtain their memory
+// from huge page arenas; the heap build rejects it.
+
+using namespace std;
+using namespace std::chrono;
+
+static const INT ITERATIONS = 200000;
+
+/// Prevent the optimizer from discarding a benchmark result.
+static volatile size_t sink;
+
+/// State machine traffic: heap allocated event data plus the internal event
+/// data the state engine allocates and deletes on every transition.
+static void EventWorkload()
+{
+	Motor motor;
+	Player player;
+	for (INT i = 0; i < ITERATIONS; i++)
+	{
+		MotorData* data = new MotorData();
+		data->speed = i;
+		motor.SetSpeed(data);
+		motor.Halt();
+
+		player.OpenClose();
+		player.OpenClose();
+		player.Play();
+		player.Stop();
+	}
+}
+
+/// Self test start, waits on the timer driven speed and completion with guard, entry and exit actions.
+static void WaitWorkload()
+{
+	TimerWheel wheel;
+	CentrifugeTest test(wheel);
+	for (INT i = 0; i < ITERATIONS / 10; i++)
+	{
+		// Jump straight to each timer rather than waiting in real time
+		test.Start();
+		while (test.IsActive())
+			wheel.Advance(wheel.GetTicksToNextExpiry());
+	}
+}
+
+/// STL containers typical of state function bookkeeping.
+static void ContainerWorkload()
+{
+	for (INT i = 0; i < ITERATIONS / 10; i++)
+	{
+		vector<INT> samples;
+		for (INT j = 0; j < 32; j++)
+			samples.push_back(j);
+
+		map<INT, string> names;
+		for (INT j = 0; j < 16; j++)
+			names[j] = "state name string " + to_string(j);
+
+		list<INT> pending(samples.begin(), samples.end());
+		while (!pending.empty())
+			pending.pop_front();
+
+		sink = samples.size() + names.size();
+	}
+}
+
+/// Time a workload and print the result.
+/// @param[in] name - the workload name.
+/// @param[in] workload - the workload function.
+/// @param[in] ops - the operation count used to normalize the result.
+static void Run(const char* name, void (*workload)(), INT ops)
+{
+	steady_clock::time_point start = steady_clock::now();
+	workload();
+	steady_clock::time_point end = steady_clock::now();
+
+	double ns = (double)duration_cast<nanoseconds>(end - start).count();
+	clog << name << ": " << ns / ops << " ns/op, " << (ops * 1e9) / ns << " ops/s" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	// Remove the example state machine console output from the measurement
+	cout.setstate(ios::badbit);
+
+#ifdef XALLOCATOR_GLOBAL_NEW
+	clog << "Global operator new/delete: xallocator" << endl;
+#else
+	clog << "Global operator new/delete: system heap" << endl;
+#endif
+
+	// Size classes created from here on use the page provider. The provider is
+	// never destroyed, as the size classes return their memory to it when 
+	// xallocator is destroyed after the static objects of this file.
+	BOOL usePages = argc > 1 && strcmp(argv[1], "--pages") == 0;
+#ifndef XALLOCATOR_GLOBAL_NEW
+	if (usePages)
+	{
+		cerr << argv[0] << ": --pages needs the xallocator build, AllocBenchmarkXalloc" << endl;
+		return 2;
+	}
+#endif
+	static PageMemoryProvider& pages = *new PageMemoryProvider;
+	if (usePages)
+		xalloc_set_memory_provider(&pages);
+
+#ifdef ALLOC_SAMPLING
+	// Sample the event data allocations on average once per 64KB
+	AllocProfiler::SetSampleInterval(64 * 1024);
+#endif
+
+	steady_clock::time_point start = steady_clock::now();
+	Run("Events", EventWorkload, ITERATIONS);
+	Run("Wait", WaitWorkload, ITERATIONS / 10);
+	Run("Containers", ContainerWorkload, ITERATIONS / 10);
+	steady_clock::time_point end = steady_clock::now();
+	clog << "Total: " << duration_cast<milliseconds>(end - start).count() << " ms" << endl;
+
+	if (usePages)
+	{
+		clog << "Page Arenas: " << pages.GetArenas();
+		clog << " Huge Page Regions: " << pages.GetHugePageRegions();
+		clog << " Fallbacks: " << pages.GetHugePageFallbacks();
+		clog << " Transparent Huge Page Regions: " << pages.GetTransparentHugePageRegions() << endl;
+	}
+
+#ifdef ALLOC_SAMPLING
+	// Folded stacks for flamegraph.pl or speedscope
+	FILE* fp = fopen("alloc_profile.folded", "w");
+	if (fp)
+	{
+		AllocProfiler::DumpFolded(fp);
+		fclose(fp);
+		clog << "Allocation profile: alloc_profile.folded" << endl;
+	}
+#endif
+
+#ifdef XALLOC_PROFILE
+	// Size classes tuned to the state machine allocation mix
+	cout.clear();
+	xalloc_size_class_report(0);
+#endif
+
+	return 0;
+}
+
@@ -0,0 +1,401 @@
+#include "Motor.h"
+#include "Player.h"
+#include "Appliance.h"
+#include "CentrifugeTest.h"
+#include "xallocator.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// State engine benchmark suite. The example state machines run with their
+// console output disabled, so each stream insertion is a failed sentry check and
+// the figures are the engine cost. The same suite is built three ways to compare
+// the event data modes:
+//
+//     EngineBenchmark        - heap allocated event data (the default)
+//     EngineBenchmarkNoHeap  - EXTERNAL_EVENT_NO_HEAP_DATA, external event data
+//                              on the stack
+//     EngineBenchmarkXalloc  - EVENT_DATA_XALLOCATOR, event data from xallocator
+//
+//     EngineBenchmark [--repeat N] [--json file] [--baseline file] [--threshold pct]
+//
+// Each benchmark runs N times (5 by default) and reports the median and minimum
+// ns/op. --json writes the results as JSON, "-" for stdout. --baseline compares
+// the median of each benchmark against a JSON file written earlier, by this or
+// another mode, and exits with 1 if any is slower by more than the threshold
+// (10% by default).
+
+using namespace std;
+using namespace std::chrono;
+
+#if defined(EVENT_DATA_XALLOCATOR)
+static const CHAR MODE[] = "xallocator";
+#elif EXTERNAL_EVENT_NO_HEAP_DATA
+static const CHAR MODE[] = "no_heap_data";
+#else
+static const CHAR MODE[] = "heap";
+#endif
+
+static const INT EVENTS = 100000;
+static const INT RUNS = 1000;
+static const INT ALLOCS = 1000000;
+static const INT BURST = 32;
+
+/// Player::ST_STOPPED
+static const BYTE PLAYER_STOPPED = 2;
+
+/// Prevent the optimizer from discarding an allocation.
+static void* volatile sink;
+
+/// @brief A benchmark and its results.
+struct Benchmark
+{
+	const CHAR* name;
+	const CHAR* op;
+	void (*run)();
+	INT ops;
+	DOUBLE median;
+	DOUBLE min;
+};
+
+/// Send a MotorData event as the mode requires.
+/// @param[in] motor - the motor.
+/// @param[in] speed - the new speed.
+static void SetSpeed(Motor& motor, INT speed)
+{
+#if EXTERNAL_EVENT_NO_HEAP_DATA
+	MotorData data;
+	data.speed = speed;
+	motor.SetSpeed(&data);
+#else
+	MotorData* data = new MotorData();
+	data->speed = speed;
+	motor.SetSpeed(data);
+#endif
+}
+
+/// Simple state map, external event with event data. The motor stays in ChangeSpeed.
+static void SimpleEvent()
+{
+	Motor motor;
+	SetSpeed(motor, 1);
+	for (INT i = 0; i < EVENTS; i++)
+		SetSpeed(motor, i);
+}
+
+/// Simple state map, external event without event data. The state engine allocates
+/// the NoEventData.
+static void SimpleNoData()
+{
+	Player player;
+	while (player.GetCurrentState() != PLAYER_STOPPED)
+		player.OpenClose();
+	for (INT i = 0; i < EVENTS / 2; i++)
+	{
+		player.Play();
+		player.Stop();
+	}
+}
+
+/// Simple state map, external event ignored in the current state.
+static void SimpleIgnored()
+{
+	// An ignored event has no effect, so call through a pointer the optimizer
+	// can't see through or the loop is discarded
+	Motor motor;
+	Motor* volatile pMotor = &motor;
+	for (INT i = 0; i < EVENTS; i++)
+		pMotor->Halt();
+}
+
+/// Simple state map, an external event cascading through an internal event:
+/// Idle to Start, then Start to Stop to Idle.
+static void SimpleCascade()
+{
+	Motor motor;
+	for (INT i = 0; i < EVENTS / 2; i++)
+	{
+		SetSpeed(motor, i);
+		motor.Halt();
+	}
+}
+
+/// Extended state map, external event without event data.
+static void ExtendedEvent()
+{
+	DoorRegion door;
+	for (INT i = 0; i < EVENTS / 2; i++)
+	{
+		door.Open();
+		door.Close();
+	}
+}
+
+/// Hierarchical state map with guard, entry and exit actions: one complete
+/// centrifuge test, an external event, internal events and timer driven wakeups.
+static void HierarchicalRun()
+{
+	TimerWheel wheel;
+	CentrifugeTest test(wheel);
+	for (INT i = 0; i < RUNS; i++)
+	{
+		// Jump straight to each timer rather than waiting in real time
+		test.Start();
+		while (test.IsActive())
+			wheel.Advance(wheel.GetTicksToNextExpiry());
+	}
+}
+
+/// Allocate and free one block at a time.
+template <size_t SIZE, void* (*Alloc)(size_t), void (*Free)(void*)>
+static void AllocFree()
+{
+	for (INT i = 0; i < ALLOCS; i++)
+	{
+		void* p = Alloc(SIZE);
+		sink = p;
+		Free(p);
+	}
+}
+
+/// Allocate a burst of blocks, then free them in allocation order.
+template <size_t SIZE, void* (*Alloc)(size_t), void (*Free)(void*)>
+static void AllocBurst()
+{
+	void* blocks[BURST];
+	for (INT i = 0; i < ALLOCS / BURST; i++)
+	{
+		for (INT j = 0; j < BURST; j++)
+			blocks[j] = Alloc(SIZE);
+		sink = blocks[BURST - 1];
+		for (INT j = 0; j < BURST; j++)
+			Free(blocks[j]);
+	}
+}
+
+static Benchmark _benchmarks[] =
+{
+	{ "simple.event",          "event",      SimpleEvent,     EVENTS, 0, 0 },
+	{ "simple.no_data",        "event",      SimpleNoData,    EVENTS, 0, 0 },
+	{ "simple.ignored",        "event",      SimpleIgnored,   EVENTS, 0, 0 },
+	{ "simple.cascade",        "event",      SimpleCascade,   EVENTS, 0, 0 },
+	{ "extended.event",        "event",      ExtendedEvent,   EVENTS, 0, 0 },
+	{ "hierarchical.run",      "test",       HierarchicalRun, RUNS,   0, 0 },
+	{ "alloc.malloc.16",       "alloc+free", AllocFree<16, malloc, free>,    ALLOCS, 0, 0 },
+	{ "alloc.xmalloc.16",      "alloc+free", AllocFree<16, xmalloc, xfree>,  ALLOCS, 0, 0 },
+	{ "alloc.malloc.64",       "alloc+free", AllocFree<64, malloc, free>,    ALLOCS, 0, 0 },
+	{ "alloc.xmalloc.64",      "alloc+free", AllocFree<64, xmalloc, xfree>,  ALLOCS, 0, 0 },
+	{ "alloc.malloc.256",      "alloc+free", AllocFree<256, malloc, free>,   ALLOCS, 0, 0 },
+	{ "alloc.xmalloc.256",     "alloc+free", AllocFree<256, xmalloc, xfree>, ALLOCS, 0, 0 },
+	{ "alloc.malloc.burst64",  "alloc+free", AllocBurst<64, malloc, free>,   ALLOCS, 0, 0 },
+	{ "alloc.xmalloc.burst64", "alloc+free", AllocBurst<64, xmalloc, xfree>, ALLOCS, 0, 0 },
+};
+static const INT BENCHMARKS = sizeof(_benchmarks) / sizeof(_benchmarks[0]);
+
+/// Run a benchmark repeatedly and record the median and minimum ns/op.
+/// @param[in] benchmark - the benchmark.
+/// @param[in] repeat - the number of runs.
+static void Measure(Benchmark& benchmark, INT repeat)
+{
+	vector<DOUBLE> samples;
+	for (INT i = 0; i < repeat; i++)
+	{
+		steady_clock::time_point start = steady_clock::now();
+		benchmark.run();
+		steady_clock::time_point end = steady_clock::now();
+		samples.push_back((DOUBLE)duration_cast<nanoseconds>(end - start).count() / benchmark.ops);
+	}
+	sort(samples.begin(), samples.end());
+	benchmark.median = samples[samples.size() / 2];
+	benchmark.min = samples[0];
+}
+
+/// Write the results as JSON.
+/// @param[in] fp - the output file.
+/// @param[in] repeat - the number of runs of each benchmark.
+static void WriteJson(FILE* fp, INT repeat)
+{
+#ifdef __OPTIMIZE__
+	const CHAR* optimized = "true";
+#else
+	const CHAR* optimized = "false";
+#endif
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"suite\": \"StateMachine\",\n");
+	fprintf(fp, "  \"mode\": \"%s\",\n", MODE);
+	fprintf(fp, "  \"optimized\": %s,\n", optimized);
+	fprintf(fp, "  \"repeat\": %d,\n", repeat);
+	fprintf(fp, "  \"benchmarks\": [\n");
+	for (INT i = 0; i < BENCHMARKS; i++)
+	{
+		const Benchmark& b = _benchmarks[i];
+		fprintf(fp, "    { \"name\": \"%s\", \"op\": \"%s\", \"ops\": %d, "
+			"\"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f }%s\n",
+			b.name, b.op, b.ops, b.median, b.min, i + 1 < BENCHMARKS ? "," : "");
+	}
+	fprintf(fp, "  ]\n");
+	fprintf(fp, "}\n");
+}
+
+/// Gets a string value following a JSON key.
+/// @param[in] json - the JSON text.
+/// @param[in] pos - where to start looking for the key.
+/// @param[in] key - the quoted key, such as "\"name\"".
+/// @param[out] value - receives the value.
+/// @return The position after the value, or string::npos if not found.
+static size_t FindString(const string& json, size_t pos, const CHAR* key, string& value)
+{
+	pos = json.find(key, pos);
+	if (pos == string::npos)
+		return pos;
+	size_t first = json.find('"', json.find(':', pos));
+	size_t last = first == string::npos ? first : json.find('"', first + 1);
+	if (last == string::npos)
+		return last;
+	value = json.substr(first + 1, last - first - 1);
+	return last + 1;
+}
+
+/// Read the median ns/op of each benchmark of a JSON file written by WriteJson().
+/// @param[in] path - the JSON file.
+/// @param[out] results - receives the ns/op by benchmark name.
+/// @param[out] mode - receives the mode of the baseline.
+/// @return TRUE if read, FALSE otherwise.
+static BOOL ReadBaseline(const CHAR* path, map<string, DOUBLE>& results, string& mode)
+{
+	FILE* fp = fopen(path, "r");
+	if (fp == NULL)
+		return FALSE;
+	string json;
+	CHAR buffer[4096];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		json.append(buffer, read);
+	fclose(fp);
+
+	if (FindString(json, 0, "\"mode\"", mode) == string::npos)
+		return FALSE;
+
+	string name;
+	size_t pos = 0;
+	while ((pos = FindString(json, pos, "\"name\"", name)) != string::npos)
+	{
+		pos = json.find("\"ns_per_op\"", pos);
+		if (pos == string::npos)
+			return FALSE;
+		pos = json.find(':', pos);
+		results[name] = strtod(json.c_str() + pos + 1, NULL);
+	}
+	return !results.empty();
+}
+
+/// Print the change of each benchmark from a baseline.
+/// @param[in] out - the output file.
+/// @param[in] path - the baseline JSON file.
+/// @param[in] threshold - the slowdown in percent counted as a regression.
+/// @return The number of regressions, or -1 if the baseline can't be read.
+static INT CompareBaseline(FILE* out, const CHAR* path, DOUBLE threshold)
+{
+	map<string, DOUBLE> baseline;
+	string mode;
+	if (!ReadBaseline(path, baseline, mode))
+		return -1;
+
+	fprintf(out, "\nBaseline %s (%s) -> %s\n", path, mode.c_str(), MODE);
+	fprintf(out, "%-24s %12s %12s %9s\n", "Benchmark", "Baseline", "Current", "Change");
+	INT regressions = 0;
+	for (INT i = 0; i < BENCHMARKS; i++)
+	{
+		const Benchmark& b = _benchmarks[i];
+		map<string, DOUBLE>::const_iterator it = baseline.find(b.name);
+		if (it == baseline.end() || it->second <= 0.0)
+		{
+			fprintf(out, "%-24s %12s %12.2f %9s\n", b.name, "-", b.median, "new");
+			continue;
+		}
+		DOUBLE change = (b.median - it->second) * 100.0 / it->second;
+		BOOL regression = change > threshold;
+		if (regression)
+			regressions++;
+		fprintf(out, "%-24s %12.2f %12.2f %+8.1f%%%s\n", b.name, it->second, b.median, change,
+			regression ? "  REGRESSION" : "");
+	}
+	return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+	INT repeat = 5;
+	const CHAR* jsonPath = NULL;
+	const CHAR* baselinePath = NULL;
+	DOUBLE threshold = 10.0;
+	for (INT i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			jsonPath = argv[++i];
+		else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+			baselinePath = argv[++i];
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+			threshold = atof(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: %s [--repeat N] [--json file] [--baseline file] "
+				"[--threshold pct]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (repeat < 1)
+		repeat = 1;
+
+	// Remove the example state machine console output from the measurement
+	cout.setstate(ios::badbit);
+
+	// JSON on stdout replaces the table
+	BOOL table = jsonPath == NULL || strcmp(jsonPath, "-") != 0;
+	if (table)
+	{
+		printf("Event data: %s, %d runs each\n", MODE, repeat);
+		printf("%-24s %-11s %12s %12s\n", "Benchmark", "Op", "ns/op", "min ns/op");
+	}
+	for (INT i = 0; i < BENCHMARKS; i++)
+	{
+		Benchmark& b = _benchmarks[i];
+		Measure(b, repeat);
+		if (table)
+			printf("%-24s %-11s %12.2f %12.2f\n", b.name, b.op, b.median, b.min);
+	}
+
+	if (jsonPath != NULL)
+	{
+		FILE* fp = table ? fopen(jsonPath, "w") : stdout;
+		if (fp == NULL)
+		{
+			perror(jsonPath);
+			return 1;
+		}
+		WriteJson(fp, repeat);
+		if (fp != stdout)
+			fclose(fp);
+	}
+
+	if (baselinePath != NULL)
+	{
+		INT regressions = CompareBaseline(table ? stdout : stderr, baselinePath, threshold);
+		if (regressions < 0)
+		{
+			fprintf(stderr, "%s: not a benchmark JSON file\n", baselinePath);
+			return 1;
+		}
+		if (regressions > 0)
+			return 1;
+	}
+	return 0;
+}
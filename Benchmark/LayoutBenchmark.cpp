@@ -0,0 +1,287 @@
+#include "StateMachine.h"
+#include "StateMapLayout.h"
+#include <chrono>
+#include <map>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Profile guided state map layout benchmark. State numbers are a BYTE, so a
+// single state machine has at most 253 states. To give the hot state map rows and
+// state objects a working set beyond a 2MB L2 cache, each variant runs CLASSES state
+// machine classes of STATES states each, with extended state maps of 32 byte rows.
+// Events cycle through HOT states of each class, visiting the classes in a fixed
+// random order so that the hardware prefetcher can't hide the misses. The variants
+// are:
+//
+//     declaration - hot states spread through the state enumeration
+//     renumbered  - states renumbered in the hot order StateMapLayout computes 
+//                   from a profile recorded running the declaration variant, as
+//                   the StateLayout tool prints it
+//
+// Reports the best ns per event of REPEATS runs, the modelled cache lines and
+// footprint of the hot state map rows and, where the kernel allows it, the L1 
+// data cache read misses.
+
+using namespace std;
+using namespace std::chrono;
+
+static const INT CLASSES = 512;
+static const INT STATES = 250;
+static const INT HOT = 64;
+static const INT SEQUENCE = 1024;
+static const INT ROUNDS = 2;
+static const INT REPEATS = 5;
+
+/// Variants, one set of classes each
+enum Variant { DECLARATION, RENUMBERED, VARIANTS };
+static const CHAR* VARIANT_NAMES[VARIANTS] = { "declaration", "renumbered" };
+
+/// The declared number of a hot state, spread through the enumeration.
+static BYTE HotState(INT hot)
+{
+	return (BYTE)((hot * 157 + 11) % STATES);
+}
+
+/// @brief A synthetic state machine, driven to any state by Go().
+class SyntheticBase : public StateMachine
+{
+public:
+	SyntheticBase() : StateMachine(STATES), m_data(new NoEventData()) { SetSharedEventData(m_data); }
+	~SyntheticBase() { delete m_data; }
+
+	/// Send an external event to a state, reusing one event data object.
+	void Go(BYTE state) { ExternalEvent(state, m_data); }
+
+private:
+	NoEventData* m_data;
+};
+
+/// @brief One synthetic class per ID and variant, each with its own state map.
+template <INT ID, INT VARIANT>
+class Synthetic : public SyntheticBase
+{
+private:
+	void ST_Work(const NoEventData*) {}
+	StateAction<Synthetic, NoEventData, &Synthetic::ST_Work> m_states[STATES];
+
+	virtual const StateMapRow* GetStateMap() { return NULL; }
+	virtual const StateMapRowEx* GetStateMapEx()
+	{
+		// Rows have const members so are copy constructed in place
+		static StateMapRowEx* map = NULL;
+		if (map == NULL)
+		{
+			map = static_cast<StateMapRowEx*>(operator new(sizeof(StateMapRowEx) * STATES,
+				std::align_val_t(StateMapLayout::CACHE_LINE)));
+			for (INT state = 0; state < STATES; state++)
+				new (&map[state]) StateMapRowEx{ &m_states[state], NULL, NULL, NULL };
+		}
+		return map;
+	}
+};
+
+/// Create one machine of each class of a variant.
+template <INT VARIANT, INT... IDS>
+static void Create(vector<SyntheticBase*>& machines, integer_sequence<INT, IDS...>)
+{
+	SyntheticBase* created[] = { new Synthetic<IDS, VARIANT>()... };
+	machines.assign(created, created + sizeof...(IDS));
+}
+
+/// Gets the demangled class name of a machine, as a profile names it.
+static string GetName(StateMachine* machine)
+{
+	const CHAR* name = typeid(*machine).name();
+#if defined(__GNUG__)
+	INT status = 0;
+	CHAR* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+	if (status == 0 && demangled != NULL)
+	{
+		string result(demangled);
+		free(demangled);
+		return result;
+	}
+#endif
+	return string(name);
+}
+
+#if defined(__linux__)
+/// Open an L1 data cache read miss counter for this thread, or -1 if not permitted.
+static INT OpenMissCounter()
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (INT)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/// Send every event of the sequence to every class of a variant.
+/// @param[in] set - the machines of the variant.
+/// @param[in] states - the state sent by each event of the sequence.
+/// @param[in] classOrder - the order the classes are visited in.
+static void Run(vector<SyntheticBase*>& set, const vector<BYTE>& states,
+	const vector<INT>& classOrder)
+{
+	for (INT i = 0; i < SEQUENCE; i++)
+		for (INT m = 0; m < CLASSES; m++)
+			set[classOrder[m]]->Go(states[i]);
+}
+
+/// Record the transition profile of one machine running the sequence, one cell
+/// per source and target state pair as TransitionCoverage::WriteProfile() writes
+/// the edges taken.
+/// @param[in] machine - the machine to run.
+/// @param[in] name - the machine class name.
+/// @param[in] states - the state sent by each event of the sequence.
+/// @return The profile cells.
+static vector<TransitionCoverageCell> Record(SyntheticBase* machine, const string& name,
+	const vector<BYTE>& states)
+{
+	map<pair<BYTE, BYTE>, UINT64> hits;
+	for (INT i = 0; i < SEQUENCE; i++)
+	{
+		BYTE source = machine->GetCurrentState();
+		machine->Go(states[i]);
+		hits[make_pair(source, machine->GetCurrentState())]++;
+	}
+
+	vector<TransitionCoverageCell> cells;
+	for (map<pair<BYTE, BYTE>, UINT64>::const_iterator it = hits.begin(); it != hits.end(); ++it)
+	{
+		TransitionCoverageCell cell = {};
+		cell.machineName = name.c_str();
+		cell.state = it->first.first;
+		cell.target = cell.resolved = it->first.second;
+		cell.hits = it->second;
+		cells.push_back(cell);
+	}
+	return cells;
+}
+
+int main(void)
+{
+	// A fixed pseudo random walk through the hot states
+	vector<INT> sequence(SEQUENCE);
+	UINT32 seed = 12345;
+	for (INT i = 0; i < SEQUENCE; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		sequence[i] = (seed >> 16) % HOT;
+	}
+
+	// A fixed pseudo random class order so that consecutive events never touch
+	// neighbouring state maps
+	vector<INT> classOrder(CLASSES);
+	for (INT i = 0; i < CLASSES; i++)
+		classOrder[i] = i;
+	for (INT i = CLASSES - 1; i > 0; i--)
+	{
+		seed = seed * 1103515245 + 12345;
+		swap(classOrder[i], classOrder[(seed >> 16) % (i + 1)]);
+	}
+
+	vector<SyntheticBase*> machines[VARIANTS];
+	auto ids = make_integer_sequence<INT, CLASSES>();
+	Create<DECLARATION>(machines[DECLARATION], ids);
+	Create<RENUMBERED>(machines[RENUMBERED], ids);
+
+	// Profile the declaration variant and renumber its states in hot order. Each
+	// class runs the same sequence, so one profile serves them all.
+	vector<BYTE> states[VARIANTS];
+	for (INT i = 0; i < SEQUENCE; i++)
+		states[DECLARATION].push_back(HotState(sequence[i]));
+	string name = GetName(machines[DECLARATION][0]);
+	vector<TransitionCoverageCell> cells = Record(machines[DECLARATION][0], name, states[DECLARATION]);
+
+	UINT64 heat[256];
+	BYTE order[256], slots[256];
+	StateMapLayout::GetHeat(&cells[0], (INT)cells.size(), name.c_str(), heat);
+	INT hot = StateMapLayout::GetHotOrder(heat, order);
+	StateMapLayout::MakeSlots(order, hot, slots);
+	for (INT i = 0; i < SEQUENCE; i++)
+		states[RENUMBERED].push_back(slots[states[DECLARATION][i]]);
+
+	// Modelled cache lines per class of the hot extended state map rows
+	INT lines[VARIANTS];
+	lines[DECLARATION] = StateMapLayout::CountLines(heat, NULL, sizeof(StateMapRowEx), 1.0);
+	lines[RENUMBERED] = StateMapLayout::CountLines(heat, slots, sizeof(StateMapRowEx), 1.0);
+
+#if defined(__linux__)
+	INT counter = OpenMissCounter();
+#else
+	INT counter = -1;
+#endif
+
+	// Warm up each variant
+	for (INT variant = 0; variant < VARIANTS; variant++)
+		Run(machines[variant], states[variant], classOrder);
+
+	// Alternate the variants and keep the best run of each
+	DOUBLE best[VARIANTS];
+	UINT64 misses[VARIANTS] = { 0 };
+	for (INT repeat = 0; repeat < REPEATS; repeat++)
+	{
+		for (INT variant = 0; variant < VARIANTS; variant++)
+		{
+#if defined(__linux__)
+			if (counter >= 0)
+			{
+				ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+				ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif
+			auto start = high_resolution_clock::now();
+			for (INT round = 0; round < ROUNDS; round++)
+				Run(machines[variant], states[variant], classOrder);
+			DOUBLE elapsed = (DOUBLE)duration_cast<nanoseconds>(high_resolution_clock::now() - start).count();
+#if defined(__linux__)
+			if (counter >= 0)
+			{
+				UINT64 count = 0;
+				ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+				if (read(counter, &count, sizeof(count)) == sizeof(count) &&
+					(repeat == 0 || count < misses[variant]))
+					misses[variant] = count;
+			}
+#endif
+			if (repeat == 0 || elapsed < best[variant])
+				best[variant] = elapsed;
+		}
+	}
+
+	DOUBLE events = (DOUBLE)ROUNDS * SEQUENCE * CLASSES;
+	printf("%d classes x %d states, %d hot, %d rounds of %d events, best of %d\n",
+		CLASSES, STATES, HOT, ROUNDS, SEQUENCE, REPEATS);
+	printf("%-12s %10s %12s %12s %16s\n", "Layout", "ns/event", "Row lines", "Hot row KB", "L1D misses/event");
+	for (INT variant = 0; variant < VARIANTS; variant++)
+	{
+		CHAR missText[32] = "n/a";
+		if (counter >= 0)
+			snprintf(missText, sizeof(missText), "%.2f", (DOUBLE)misses[variant] / events);
+		printf("%-12s %10.1f %12d %12d %16s\n", VARIANT_NAMES[variant], best[variant] / events,
+			lines[variant], lines[variant] * StateMapLayout::CACHE_LINE * CLASSES / 1024, missText);
+	}
+	printf("Renumbered change: %+.1f%%\n", (best[RENUMBERED] - best[DECLARATION]) * 100.0 / best[DECLARATION]);
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include "CentrifugeCoroutine.h"
+
+#ifdef STATE_MACHINE_COROUTINES
+#include <iostream>
+
+using namespace std;
+
+CentrifugeCoroutine::CentrifugeCoroutine(TimerWheel& wheel) :
+	StateMachine(ST_MAX_STATES),
+	m_wheel(wheel),
+	m_speed(0)
+{
+}
+
+// start test external event
+void CentrifugeCoroutine::Start()
+{
+	BEGIN_TRANSITION_MAP			              			// - Current State -
+		TRANSITION_MAP_ENTRY (ST_TEST)						// ST_IDLE
+		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_TEST
+	END_TRANSITION_MAP(NULL)
+}
+
+// cancel test external event. Leaving ST_TEST destroys the suspended coroutine.
+void CentrifugeCoroutine::Cancel()
+{
+	BEGIN_TRANSITION_MAP			              			// - Current State -
+		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_IDLE
+		TRANSITION_MAP_ENTRY (ST_IDLE)						// ST_TEST
+	END_TRANSITION_MAP(NULL)
+}
+
+STATE_DEFINE(CentrifugeCoroutine, Idle, NoEventData)
+{
+	cout << "CentrifugeCoroutine::ST_Idle" << endl;
+	m_speed = 0;
+}
+
+// The whole test sequence. Each co_await suspends the state until the timer 
+// re-enters it. 
+STATE_DEFINE_CO(CentrifugeCoroutine, Test, NoEventData)
+{
+	cout << "CentrifugeCoroutine::ST_Test" << endl;
+
+	// Accelerate
+	while (m_speed < 5)
+	{
+		cout << "CentrifugeCoroutine::ST_Test : Accelerating, speed is " << m_speed << endl;
+		co_await Delay(m_wheel, RAMP_TICKS);
+		m_speed++;
+	}
+
+	// Decelerate
+	while (m_speed > 0)
+	{
+		cout << "CentrifugeCoroutine::ST_Test : Decelerating, speed is " << m_speed << endl;
+		co_await Delay(m_wheel, RAMP_TICKS);
+		m_speed--;
+	}
+
+	InternalEvent(ST_IDLE);
+}
+
+#endif // STATE_MACHINE_COROUTINES
@@ -0,0 +1,56 @@
+#ifndef _CENTRIFUGE_COROUTINE_H
+#define _CENTRIFUGE_COROUTINE_H
+
+#include "CoroutineState.h"
+
+#ifdef STATE_MACHINE_COROUTINES
+
+// @brief CentrifugeCoroutine runs the CentrifugeTest accelerate, wait and decelerate
+// sequence as a single coroutine state. The coroutine suspends on the timer wheel
+// between speed changes instead of needing a state per step. The Idle state is
+// a regular state function within the same state map.
+class CentrifugeCoroutine : public StateMachine
+{
+public:
+	/// Constructor
+	/// @param[in] wheel - the timer wheel driving the test. One tick is one 
+	///		millisecond.
+	CentrifugeCoroutine(TimerWheel& wheel);
+
+	// External events taken by this state machine
+	void Start();
+	void Cancel();
+
+	BOOL IsActive() { return GetCurrentState() == ST_TEST; }
+
+private:
+	// Wheel ticks between speed changes
+	static const UINT64 RAMP_TICKS = 10;
+
+	TimerWheel& m_wheel;
+	INT m_speed;
+
+	// State enumeration order must match the order of state method entries
+	// in the state map.
+	enum States
+	{
+		ST_IDLE,
+		ST_TEST,
+		ST_MAX_STATES
+	};
+
+	// Define the state machine state functions with event data type
+	STATE_DECLARE(CentrifugeCoroutine, 		Idle,		NoEventData)
+	STATE_DECLARE_CO(CentrifugeCoroutine, 	Test,		NoEventData)
+
+	// State map to define state object order. Each state map entry defines a
+	// state object.
+	BEGIN_STATE_MAP
+		STATE_MAP_ENTRY(&Idle)
+		STATE_MAP_ENTRY(&Test)
+	END_STATE_MAP	
+};
+
+#endif // STATE_MACHINE_COROUTINES
+
+#endif
@@ -3,11 +3,19 @@
 
 using namespace std;
 
-CentrifugeTest::CentrifugeTest() :
+CentrifugeTest::CentrifugeTest(TimerWheel& wheel) :
 	SelfTest(ST_MAX_STATES),
-	m_pollActive(FALSE),
-	m_speed(0)
+	m_wheel(wheel),
+	m_active(FALSE),
+	m_speed(0),
+	m_ramp(0)
 {
+	m_rampTimer.SetCallback(&CentrifugeTest::RampTimerExpired, this);
+}
+
+CentrifugeTest::~CentrifugeTest()
+{
+	StopRamp();
 }
 	
 void CentrifugeTest::Start()
@@ -17,25 +25,31 @@ void CentrifugeTest::Start()
 		TRANSITION_MAP_ENTRY (CANNOT_HAPPEN)				// ST_COMPLETED
 		TRANSITION_MAP_ENTRY (CANNOT_HAPPEN)				// ST_FAILED
 		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_START_TEST
-		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_ACCELERATION
-		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_WAIT_FOR_ACCELERATION
-		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_DECELERATION
-		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_WAIT_FOR_DECELERATION
+		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_SPINNING
+		TRANSITION_MAP_ENTRY (EVENT_PARENT)					// ST_ACCELERATION
+		TRANSITION_MAP_ENTRY (EVENT_PARENT)					// ST_WAIT_FOR_ACCELERATION
+		TRANSITION_MAP_ENTRY (EVENT_PARENT)					// ST_DECELERATION
+		TRANSITION_MAP_ENTRY (EVENT_PARENT)					// ST_WAIT_FOR_DECELERATION
 	END_TRANSITION_MAP(NULL)
 }
 
-void CentrifugeTest::Poll()
+void CentrifugeTest::StartRamp(INT ramp)
 {
-	BEGIN_TRANSITION_MAP			              			// - Current State -
-		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_IDLE
-		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_COMPLETED
-		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_FAILED
-		TRANSITION_MAP_ENTRY (EVENT_IGNORED)				// ST_START_TEST
-		TRANSITION_MAP_ENTRY (ST_WAIT_FOR_ACCELERATION)		// ST_ACCELERATION
-		TRANSITION_MAP_ENTRY (ST_WAIT_FOR_ACCELERATION)		// ST_WAIT_FOR_ACCELERATION
-		TRANSITION_MAP_ENTRY (ST_WAIT_FOR_DECELERATION)		// ST_DECELERATION
-		TRANSITION_MAP_ENTRY (ST_WAIT_FOR_DECELERATION)		// ST_WAIT_FOR_DECELERATION
-	END_TRANSITION_MAP(NULL)
+	m_ramp = ramp;
+	m_wheel.Arm(m_rampTimer, RAMP_TICKS);
+}
+
+void CentrifugeTest::StopRamp()
+{
+	m_wheel.Cancel(m_rampTimer);
+}
+
+// Simulated centrifuge drive. Each speed change wakes any state waiting on it.
+void CentrifugeTest::RampTimerExpired(WheelTimer*, void* context)
+{
+	CentrifugeTest* test = static_cast<CentrifugeTest*>(context);
+	test->m_wheel.Arm(test->m_rampTimer, RAMP_TICKS);
+	test->m_speed.Set(test->m_speed.Get() + test->m_ramp);
 }
 
 // Idle state here overrides the SelfTest Idle state. 
@@ -45,13 +59,14 @@ STATE_DEFINE(CentrifugeTest, Idle, NoEventData)
 
 	// Call base class Idle state
 	SelfTest::ST_Idle(data);	
-	StopPoll();
+	m_active = FALSE;
 }
 
 // Start the centrifuge test state.
 STATE_DEFINE(CentrifugeTest, StartTest, NoEventData)
 {
 	cout << "CentrifugeTest::ST_StartTest" << endl;
+	m_active = TRUE;
 	InternalEvent(ST_ACCELERATION);
 }
 
@@ -59,7 +74,7 @@ STATE_DEFINE(CentrifugeTest, StartTest, NoEventData)
 GUARD_DEFINE(CentrifugeTest, GuardStartTest, NoEventData)
 {
 	cout << "CentrifugeTest::GD_GuardStartTest" << endl;
-	if (m_speed == 0)
+	if (m_speed.Get() == 0)
 		return TRUE;	// Centrifuge stopped. OK to start test.
 	else
 		return FALSE;	// Centrifuge spinning. Can't start test.
@@ -69,50 +84,39 @@ GUARD_DEFINE(CentrifugeTest, GuardStartTest, NoEventData)
 STATE_DEFINE(CentrifugeTest, Acceleration, NoEventData)
 {
 	cout << "CentrifugeTest::ST_Acceleration" << endl;	
-
-	// Start polling while waiting for centrifuge to ramp up to speed
-	StartPoll();
+	StartRamp(1);
+	InternalEvent(ST_WAIT_FOR_ACCELERATION);
 }
 
-// Wait in this state until target centrifuge speed is reached.
+// Wait in this state until target centrifuge speed is reached. The state machine
+// is parked on the speed and only runs again once the speed reaches 5.
 STATE_DEFINE(CentrifugeTest, WaitForAcceleration, NoEventData)
 {
-	cout << "CentrifugeTest::ST_WaitForAcceleration : Speed is " << m_speed << endl;
-	if (++m_speed >= 5)
-		InternalEvent(ST_DECELERATION);
-}
-
-// Exit action when WaitForAcceleration state exits.
-EXIT_DEFINE(CentrifugeTest, ExitWaitForAcceleration)
-{
-	cout << "CentrifugeTest::EX_ExitWaitForAcceleration" << endl;
-
-	// Acceleration over, stop polling
-	StopPoll();
+	cout << "CentrifugeTest::ST_WaitForAcceleration : Speed is " << m_speed.Get() << endl;
+	WaitFor(m_speed, WaitValue::WAIT_GREATER_EQUAL, 5, ST_DECELERATION);
 }
 
 // Start decelerating the centrifuge.
 STATE_DEFINE(CentrifugeTest, Deceleration, NoEventData)
 {
 	cout << "CentrifugeTest::ST_Deceleration" << endl;
-
-	// Start polling while waiting for centrifuge to ramp down to 0
-	StartPoll();
+	StartRamp(-1);
+	InternalEvent(ST_WAIT_FOR_DECELERATION);
 }
 
 // Wait in this state until centrifuge speed is 0.
 STATE_DEFINE(CentrifugeTest, WaitForDeceleration, NoEventData)
 {
-	cout << "CentrifugeTest::ST_WaitForDeceleration : Speed is " << m_speed << endl;
-	if (m_speed-- == 0)
-		InternalEvent(ST_COMPLETED);
+	cout << "CentrifugeTest::ST_WaitForDeceleration : Speed is " << m_speed.Get() << endl;
+	WaitFor(m_speed, WaitValue::WAIT_LESS_EQUAL, 0, ST_COMPLETED);
 }
 
-// Exit action when WaitForDeceleration state exits.
-EXIT_DEFINE(CentrifugeTest, ExitWaitForDeceleration)
+// Exit action when leaving the Spinning superstate, whether the test completed
+// or was cancelled.
+EXIT_DEFINE(CentrifugeTest, ExitSpinning)
 {
-	cout << "CentrifugeTest::EX_ExitWaitForDeceleration" << endl;
+	cout << "CentrifugeTest::EX_ExitSpinning" << endl;
 
-	// Deceleration over, stop polling
-	StopPoll();
+	// Spinning over, stop the drive
+	StopRamp();
 }
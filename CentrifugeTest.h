@@ -2,26 +2,45 @@
 #define _CENTRIFUGE_TEST_H
 
 #include "SelfTest.h"
+#include "TimerWheel.h"
+#include "WaitCondition.h"
 
 // @brief CentrifugeTest shows StateMachine features including state machine
-// inheritance, state function override, and guard/entry/exit actions. SelfTest
-// provides common states shared with CentrifugeTest. 
+// inheritance, state function override, guard/entry/exit actions, parking on a
+// wait condition and a hierarchical state map. SelfTest provides common states 
+// shared with CentrifugeTest. The acceleration and deceleration states are 
+// substates of Spinning, whose exit action stops the centrifuge drive however 
+// the test ends.
 class CentrifugeTest : public SelfTest
 {
 public:
-	CentrifugeTest();
+	/// Constructor
+	/// @param[in] wheel - the timer wheel driving the simulated centrifuge drive. 
+	///		One tick is one millisecond. 
+	CentrifugeTest(TimerWheel& wheel);
+
+	~CentrifugeTest();
 
 	virtual void Start();
-	void Poll();
 
-	BOOL IsPollActive() { return m_pollActive; }
+	BOOL IsActive() { return m_active; }
 
 private:
-	BOOL m_pollActive;
-	INT m_speed; 
+	// Wheel ticks between simulated speed changes
+	static const UINT64 RAMP_TICKS = 10;
+
+	TimerWheel& m_wheel;
+	BOOL m_active;
+
+	// Centrifuge speed. The wait states park on this rather than polling it.
+	WaitValue m_speed;
 
-	void StartPoll() { m_pollActive = TRUE; }
-	void StopPoll() { m_pollActive = FALSE; }
+	// Simulated centrifuge drive changing the speed by m_ramp every RAMP_TICKS
+	WheelTimer m_rampTimer;
+	INT m_ramp;
+	void StartRamp(INT ramp);
+	void StopRamp();
+	static void RampTimerExpired(WheelTimer* timer, void* context);
 
 	// State enumeration order must match the order of state method entries
 	// in the state map.
@@ -29,6 +48,7 @@ private:
 	{
 		// Continue state numbering using the last SelfTest::States enum value
 		ST_START_TEST = SelfTest::ST_MAX_STATES,	
+		ST_SPINNING,
 		ST_ACCELERATION,
 		ST_WAIT_FOR_ACCELERATION,
 		ST_DECELERATION,
@@ -40,25 +60,25 @@ private:
 	STATE_DECLARE(CentrifugeTest, 	Idle,						NoEventData)
 	STATE_DECLARE(CentrifugeTest, 	StartTest,					NoEventData)
 	GUARD_DECLARE(CentrifugeTest, 	GuardStartTest,				NoEventData)
+	EXIT_DECLARE(CentrifugeTest, 	ExitSpinning)
 	STATE_DECLARE(CentrifugeTest, 	Acceleration,				NoEventData)
 	STATE_DECLARE(CentrifugeTest, 	WaitForAcceleration,		NoEventData)
-	EXIT_DECLARE(CentrifugeTest, 	ExitWaitForAcceleration)
 	STATE_DECLARE(CentrifugeTest, 	Deceleration,				NoEventData)
 	STATE_DECLARE(CentrifugeTest, 	WaitForDeceleration,		NoEventData)
-	EXIT_DECLARE(CentrifugeTest, 	ExitWaitForDeceleration)
 
-	// State map to define state object order. Each state map entry defines a
-	// state object.
-	BEGIN_STATE_MAP_EX
-		STATE_MAP_ENTRY_ALL_EX(&Idle, 0, &EntryIdle, 0)
-		STATE_MAP_ENTRY_EX(&Completed)
-		STATE_MAP_ENTRY_EX(&Failed)
-		STATE_MAP_ENTRY_ALL_EX(&StartTest, &GuardStartTest, 0, 0)
-		STATE_MAP_ENTRY_EX(&Acceleration)
-		STATE_MAP_ENTRY_ALL_EX(&WaitForAcceleration, 0, 0, &ExitWaitForAcceleration)
-		STATE_MAP_ENTRY_EX(&Deceleration)
-		STATE_MAP_ENTRY_ALL_EX(&WaitForDeceleration, 0, 0, &ExitWaitForDeceleration)
-	END_STATE_MAP_EX	
+	// State map to define state object order and the parent of each state. 
+	// Spinning is only a superstate and never a transition target.
+	BEGIN_STATE_MAP_HSM
+		STATE_MAP_ENTRY_ALL_HSM(&Idle, NO_PARENT, 0, &EntryIdle, 0)
+		STATE_MAP_ENTRY_HSM(&Completed, NO_PARENT)
+		STATE_MAP_ENTRY_HSM(&Failed, NO_PARENT)
+		STATE_MAP_ENTRY_ALL_HSM(&StartTest, NO_PARENT, &GuardStartTest, 0, 0)
+		SUPERSTATE_MAP_ENTRY_HSM(Spinning, NO_PARENT, 0, &ExitSpinning)
+		STATE_MAP_ENTRY_HSM(&Acceleration, ST_SPINNING)
+		STATE_MAP_ENTRY_HSM(&WaitForAcceleration, ST_SPINNING)
+		STATE_MAP_ENTRY_HSM(&Deceleration, ST_SPINNING)
+		STATE_MAP_ENTRY_HSM(&WaitForDeceleration, ST_SPINNING)
+	END_STATE_MAP_HSM	
 };
 
 #endif
@@ -0,0 +1,130 @@
+#ifndef _COROUTINE_STATE_H
+#define _COROUTINE_STATE_H
+
+#include "StateMachine.h"
+
+// Coroutine states require C++20. Define STATE_MACHINE_COROUTINES, normally with the
+// STATE_MACHINE_COROUTINES CMake option which also selects C++20, to enable them.
+//#define STATE_MACHINE_COROUTINES
+
+#ifdef STATE_MACHINE_COROUTINES
+#include "xallocator.h"
+#include <coroutine>
+
+/// @brief Return type of a coroutine state function. A coroutine state runs like
+/// any other state function until its first co_await, which suspends it without a
+/// thread. The coroutine resumes each time the state machine re-enters the same
+/// state, for instance from a transition map entry, a state timer or a wait
+/// condition, and is destroyed when the state machine transitions to a different
+/// state. Coroutine frames are allocated with xmalloc().
+///
+/// Event data is deleted once each state engine pass completes. The data argument
+/// of the state function and the data returned by co_await are only valid until
+/// the next co_await.
+class StateTask
+{
+public:
+	struct promise_type
+	{
+		/// Event data of the event resuming the coroutine
+		const EventData* m_pData = NULL;
+
+		StateTask get_return_object() { return StateTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { ASSERT(); }
+
+		static void* operator new(size_t size)
+		{
+			// xmalloc() returns NULL under XALLOC_OVERFLOW_FAIL; a throwing
+			// operator new must not
+			void* ptr = xmalloc(size);
+			if (ptr == NULL)
+				throw std::bad_alloc();
+			return ptr;
+		}
+		static void operator delete(void* ptr) { xfree(ptr); }
+	};
+
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	explicit StateTask(Handle handle) : m_handle(handle) {}
+
+	/// Gets the coroutine. Ownership passes to the state machine.
+	/// @return The coroutine handle.
+	Handle GetHandle() const { return m_handle; }
+
+private:
+	Handle m_handle;
+};
+
+/// @brief Awaitable returned by StateMachine::NextEvent(), Delay() and WaitUntil().
+/// co_await suspends the coroutine state until the state is re-entered and returns
+/// the event data of the resuming event.
+class StateAwait
+{
+public:
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(StateTask::Handle handle) noexcept { m_pPromise = &handle.promise(); }
+	const EventData* await_resume() const noexcept { return m_pPromise->m_pData; }
+
+private:
+	StateTask::promise_type* m_pPromise = NULL;
+};
+
+/// @brief Starts and resumes coroutine states. The non-template part of
+/// CoroutineAction.
+class CoroutineStateBase : public StateBase
+{
+public:
+	CoroutineStateBase(const CHAR* name) : StateBase(name) {}
+
+protected:
+	/// Resume the suspended coroutine of the current state, if any.
+	/// @param[in] sm - A state machine instance.
+	/// @param[in] data - The event data.
+	/// @return TRUE if a coroutine was resumed.
+	static BOOL Resume(StateMachine* sm, const EventData* data);
+
+	/// Take ownership of a coroutine just started. Completed coroutines are destroyed.
+	/// @param[in] sm - A state machine instance.
+	/// @param[in] handle - The coroutine.
+	static void Started(StateMachine* sm, StateTask::Handle handle);
+};
+
+/// @brief CoroutineAction takes three template arguments: A state machine class,
+/// a state function event data type (derived from EventData) and a state machine
+/// coroutine member function pointer. A coroutine state is placed in the state map
+/// like any other state.
+template <class SM, class Data, StateTask (SM::*Func)(const Data*)>
+class CoroutineAction : public CoroutineStateBase
+{
+public:
+	CoroutineAction(const CHAR* name = NULL) : CoroutineStateBase(name) {}
+
+	/// @see StateBase::InvokeStateAction
+	virtual void InvokeStateAction(StateMachine* sm, const EventData* data) const
+	{
+		if (Resume(sm, data))
+			return;
+
+		SM* derivedSM = static_cast<SM*>(sm);
+		const Data* derivedData = dynamic_cast<const Data*>(data);
+		ASSERT_TRUE(derivedData != NULL);
+
+		// Start the coroutine, which runs until it first suspends
+		Started(sm, (derivedSM->*Func)(derivedData).GetHandle());
+	}
+};
+
+#define STATE_DECLARE_CO(stateMachine, stateName, eventData) \
+	StateTask ST_##stateName(const eventData*); \
+	CoroutineAction<stateMachine, eventData, &stateMachine::ST_##stateName> stateName{#stateName};
+
+#define STATE_DEFINE_CO(stateMachine, stateName, eventData) \
+	StateTask stateMachine::ST_##stateName(const eventData* data)
+
+#endif // STATE_MACHINE_COROUTINES
+
+#endif // _COROUTINE_STATE_H
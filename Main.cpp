@@ -1,15 +1,50 @@
 #include "MotorNM.h"
 #include "Motor.h"
 #include "Player.h"
+#include "Appliance.h"
 #include "CentrifugeTest.h"
+#include "CentrifugeCoroutine.h"
+#include "ObjectPool.h"
+#include <chrono>
+#include <thread>
+#if defined(STATE_MACHINE_TRACE) || defined(STATE_MACHINE_LATENCY) || defined(STATE_MACHINE_TIMELINE) || \
+	defined(STATE_MACHINE_WATCHDOG) || defined(STATE_MACHINE_COVERAGE)
+#include <stdio.h>
+#endif
 
 // @see https://github.com/endurodave/StateMachine
 // David Lafreniere
 
 using namespace std;
 
+/// Motor event data created by an ObjectPool. Release() returns it to the pool
+/// instead of deleting it.
+class PooledMotorData : public MotorData
+{
+public:
+	virtual void Release() const;
+};
+
+static ObjectPool<PooledMotorData> _motorDataPool(0, "PooledMotorData");
+
+void PooledMotorData::Release() const
+{
+	_motorDataPool.Destroy(const_cast<PooledMotorData*>(this));
+}
+
 int main(void)
 {
+#ifdef STATE_MACHINE_TIMELINE
+	// Record a state residency timeline. Open it in ui.perfetto.dev or chrome://tracing.
+	StateTimeline::Start("statemachine_timeline.json");
+#endif
+
+#ifdef STATE_MACHINE_WATCHDOG
+	// Report any action taking over 10ms, including actions still running
+	StateWatchdog::SetDefaultBudget(10000000);
+	StateWatchdog::StartMonitor();
+#endif
+
 	// Create MotorNM (No Macro) test object
 	MotorNM motorNM;
 
@@ -66,6 +101,32 @@ int main(void)
 	motor.Halt();
 #endif
 
+	// Create pooled motor data. The state engine releases it back to the pool.
+	PooledMotorData* pooledData = _motorDataPool.Create();
+	pooledData->speed = 300;
+	motor.SetSpeed(pooledData);
+#if EXTERNAL_EVENT_NO_HEAP_DATA
+	_motorDataPool.Destroy(pooledData);
+#endif
+	motor.Halt();
+
+	// Create a batch of speed changes with one pass over the pool free-list. 
+	// Unsent event data is destroyed as a batch.
+	PooledMotorData* batch[4];
+	UINT batchCount = _motorDataPool.CreateN(batch, 4);
+	for (UINT i = 0; i < batchCount; i++)
+		batch[i]->speed = 400 + (INT)i * 100;
+	if (batchCount > 0)
+	{
+		motor.SetSpeed(batch[0]);
+#if EXTERNAL_EVENT_NO_HEAP_DATA
+		_motorDataPool.DestroyN(batch, batchCount);
+#else
+		_motorDataPool.DestroyN(batch + 1, batchCount - 1);
+#endif
+	}
+	motor.Halt();
+
 	// Create Player instance and call external event functions
 	Player player;
 	player.OpenClose();
@@ -78,12 +139,91 @@ int main(void)
 	player.Play();
 	player.OpenClose();
 
-	// Create CentrifugeTest and start test
-	CentrifugeTest test;
+	// Create Appliance and send events to both its door and heater regions
+	Appliance appliance;
+#if EXTERNAL_EVENT_NO_HEAP_DATA
+	HeaterData heaterData;
+	heaterData.temperature = 180;
+	appliance.Heat(&heaterData);
+#else
+	HeaterData* heaterData = new HeaterData();
+	heaterData->temperature = 180;
+	appliance.Heat(heaterData);
+#endif
+	appliance.OpenDoor();
+	appliance.CloseDoor();
+	appliance.PowerOff();
+
+	// Create CentrifugeTest and start test. The test waits on the centrifuge speed
+	// so this thread sleeps until the next timer expires, one tick per millisecond.
+	TimerWheel wheel;
+	CentrifugeTest test(wheel);
 	test.Cancel();
 	test.Start();
-	while (test.IsPollActive())
-		test.Poll();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	while (test.IsActive())
+	{
+		this_thread::sleep_for(chrono::milliseconds(wheel.GetTicksToNextExpiry()));
+		wheel.AdvanceTo(chrono::duration_cast<chrono::milliseconds>(
+			chrono::steady_clock::now() - start).count());
+	}
+
+#ifdef STATE_MACHINE_COROUTINES
+	// The same test sequence as a coroutine state
+	CentrifugeCoroutine coTest(wheel);
+	coTest.Start();
+	while (coTest.IsActive())
+	{
+		this_thread::sleep_for(chrono::milliseconds(wheel.GetTicksToNextExpiry()));
+		wheel.AdvanceTo(chrono::duration_cast<chrono::milliseconds>(
+			chrono::steady_clock::now() - start).count());
+	}
+#endif
+
+#ifdef STATE_MACHINE_TRACE
+	// Write the transition history. Decode it with: TraceDecode statemachine.trace
+	FILE* fp = fopen("statemachine.trace", "wb");
+	if (fp != NULL)
+	{
+		printf("Transition trace: %d records\n", StateMachineTrace::Dump(fp));
+		fclose(fp);
+	}
+#endif
+
+#ifdef STATE_MACHINE_TIMELINE
+	StateTimeline::Stop();
+	printf("State timeline: %llu events dropped\n", StateTimeline::GetDropped());
+#endif
+
+#ifdef STATE_MACHINE_LATENCY
+	// Action latency per state of each state machine class
+	StateLatency::Dump(stdout);
+#endif
+
+#ifdef STATE_MACHINE_WATCHDOG
+	StateWatchdog::StopMonitor();
+	printf("State watchdog: %llu overruns\n", StateWatchdog::GetOverruns());
+#endif
+
+#ifdef STATE_MACHINE_COVERAGE
+	// Transition map hits per state and event. Render the diagram with: 
+	// dot -Tsvg statemachine_coverage.dot -o statemachine_coverage.svg
+	TransitionCoverage::Dump(stdout);
+	FILE* dot = fopen("statemachine_coverage.dot", "w");
+	if (dot != NULL)
+	{
+		TransitionCoverage::WriteGraphviz(dot);
+		fclose(dot);
+	}
+
+	// Profile for the StateLayout tool
+	FILE* profileOut = fopen("statemachine.profile", "w");
+	if (profileOut != NULL)
+	{
+		TransitionCoverage::WriteProfile(profileOut);
+		fclose(profileOut);
+	}
+#endif
 
 	return 0;
 }
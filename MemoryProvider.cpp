@@ -0,0 +1,320 @@
+#include "MemoryProvider.h"
+#include "Allocator.h"
+#if WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Huge page size assumed for rounding mapped regions. 2MB on x86-64 and on
+// AArch64 with 4KB base pages.
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Linux memory policy from <linux/mempolicy.h>
+static const INT MPOL_PREFERRED_MODE = 1;
+
+// Highest NUMA node the memory policy mask can express
+static const INT MAX_NUMA_NODES = 1024;
+
+static HeapMemoryProvider _heapMemoryProvider;
+
+//------------------------------------------------------------------------------
+// GetPageSize
+//------------------------------------------------------------------------------
+static size_t GetPageSize()
+{
+#if WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+//------------------------------------------------------------------------------
+// HeapMemoryProvider::GetInstance
+//------------------------------------------------------------------------------
+HeapMemoryProvider* HeapMemoryProvider::GetInstance()
+{
+	return &_heapMemoryProvider;
+}
+
+//------------------------------------------------------------------------------
+// HeapMemoryProvider::Allocate
+//------------------------------------------------------------------------------
+void* HeapMemoryProvider::Allocate(size_t size, size_t alignment)
+{
+	return Allocator::SystemAllocate(size, alignment);
+}
+
+//------------------------------------------------------------------------------
+// HeapMemoryProvider::Free
+//------------------------------------------------------------------------------
+void HeapMemoryProvider::Free(void* pMemory, size_t, size_t)
+{
+	Allocator::SystemFree(pMemory);
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::Arena
+//------------------------------------------------------------------------------
+/// Header at the start of each huge page aligned arena. Regions are carved with a
+/// bump pointer and the arena is reused or unmapped once none remain.
+struct PageMemoryProvider::Arena
+{
+	size_t used;	///< Bytes carved, including this header
+	UINT regions;	///< Regions carved and not yet freed
+};
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::Constructor
+//------------------------------------------------------------------------------
+PageMemoryProvider::PageMemoryProvider(UINT flags, INT numaNode, size_t minSize) :
+	m_flags(flags),
+	m_numaNode(numaNode),
+	m_minSize(minSize),
+	m_pArena(NULL),
+	m_hugePageRegions(0),
+	m_hugePageFallbacks(0),
+	m_transparentHugePageRegions(0),
+	m_arenas(0),
+	m_firstTouchRegions(0)
+{
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::Destructor
+//------------------------------------------------------------------------------
+PageMemoryProvider::~PageMemoryProvider()
+{
+	if (m_pArena && m_pArena->regions == 0)
+		Unmap(m_pArena, HUGE_PAGE_SIZE);
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::IsArena
+//------------------------------------------------------------------------------
+BOOL PageMemoryProvider::IsArena(size_t size, size_t alignment) const
+{
+#if WIN32
+	// Windows never uses huge pages so there is nothing to share
+	(void)size;
+	(void)alignment;
+	return FALSE;
+#else
+	// Chunks, at most MAX_CHUNK_SIZE, and smaller regions share huge pages
+	return (m_flags & (PAGE_HUGETLB | PAGE_THP)) && size <= HUGE_PAGE_SIZE / 2 &&
+		alignment <= GetPageSize();
+#endif
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::IsMapped
+//------------------------------------------------------------------------------
+BOOL PageMemoryProvider::IsMapped(size_t size, size_t alignment) const
+{
+	// Mappings are page aligned so larger alignments use the system heap
+	return size >= m_minSize && alignment <= GetPageSize();
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::MapLength
+//------------------------------------------------------------------------------
+size_t PageMemoryProvider::MapLength(size_t size, size_t) const
+{
+	// Regions able to use huge pages are rounded to whole huge pages so that
+	// an explicit huge page mapping and its fallback unmap the same length
+	size_t page = GetPageSize();
+	if ((m_flags & (PAGE_HUGETLB | PAGE_THP)) && size >= HUGE_PAGE_SIZE)
+		page = HUGE_PAGE_SIZE;
+	return (size + page - 1) & ~(page - 1);
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::Allocate
+//------------------------------------------------------------------------------
+void* PageMemoryProvider::Allocate(size_t size, size_t alignment)
+{
+	if (IsArena(size, alignment))
+		return ArenaAllocate(size, alignment);
+	if (!IsMapped(size, alignment))
+		return Allocator::SystemAllocate(size, alignment);
+	return Map(MapLength(size, alignment));
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::Free
+//------------------------------------------------------------------------------
+void PageMemoryProvider::Free(void* pMemory, size_t size, size_t alignment)
+{
+	if (IsArena(size, alignment))
+		ArenaFree(pMemory);
+	else if (!IsMapped(size, alignment))
+		Allocator::SystemFree(pMemory);
+	else
+		Unmap(pMemory, MapLength(size, alignment));
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::ArenaAllocate
+//------------------------------------------------------------------------------
+void* PageMemoryProvider::ArenaAllocate(size_t size, size_t alignment)
+{
+	// Keep every region at least 16 byte aligned like the system heap
+	if (alignment < 16)
+		alignment = 16;
+
+	size_t offset = 0;
+	if (m_pArena)
+		offset = (m_pArena->used + alignment - 1) & ~(alignment - 1);
+
+	if (m_pArena == NULL || offset + size > HUGE_PAGE_SIZE)
+	{
+		Arena* pArena = (Arena*)Map(HUGE_PAGE_SIZE);
+		if (pArena == NULL)
+			return NULL;
+		m_arenas++;
+
+		// A full arena is unmapped by ArenaFree() once its last region is freed
+		pArena->used = sizeof(Arena);
+		pArena->regions = 0;
+		m_pArena = pArena;
+		offset = (m_pArena->used + alignment - 1) & ~(alignment - 1);
+	}
+
+	m_pArena->used = offset + size;
+	m_pArena->regions++;
+	return (CHAR*)m_pArena + offset;
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::ArenaFree
+//------------------------------------------------------------------------------
+void PageMemoryProvider::ArenaFree(void* pMemory)
+{
+	// Arenas are huge page aligned so the header is found from any region
+	Arena* pArena = (Arena*)((size_t)pMemory & ~(HUGE_PAGE_SIZE - 1));
+	if (--pArena->regions != 0)
+		return;
+
+	// Reuse an empty current arena and unmap any other
+	if (pArena == m_pArena)
+		pArena->used = sizeof(Arena);
+	else
+		Unmap(pArena, HUGE_PAGE_SIZE);
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::Map
+//------------------------------------------------------------------------------
+void* PageMemoryProvider::Map(size_t length)
+{
+#if WIN32
+	// Large pages need the SeLockMemoryPrivilege so Windows always uses normal pages
+	void* pMemory;
+	if (m_numaNode >= 0)
+		pMemory = VirtualAllocExNuma(GetCurrentProcess(), NULL, length,
+			MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, m_numaNode);
+	else
+		pMemory = VirtualAlloc(NULL, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	return pMemory;
+#else
+	void* pMemory = MAP_FAILED;
+	BOOL huge = (m_flags & (PAGE_HUGETLB | PAGE_THP)) && length >= HUGE_PAGE_SIZE;
+
+#ifdef MAP_HUGETLB
+	// Explicit huge pages fail if the huge page pool is empty or not configured
+	if ((m_flags & PAGE_HUGETLB) && huge)
+	{
+		pMemory = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (pMemory != MAP_FAILED)
+			m_hugePageRegions++;
+		else
+			m_hugePageFallbacks++;
+	}
+#endif
+
+	if (pMemory == MAP_FAILED)
+	{
+		// Over-map by one huge page and trim so that the region is huge page 
+		// aligned and transparent huge pages can back all of it
+		size_t extra = huge ? HUGE_PAGE_SIZE : 0;
+		CHAR* pMap = (CHAR*)mmap(NULL, length + extra, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if ((void*)pMap == MAP_FAILED)
+			return NULL;
+
+		pMemory = pMap;
+		if (extra)
+		{
+			CHAR* pAligned = (CHAR*)(((size_t)pMap + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+			if (pAligned != pMap)
+				munmap(pMap, pAligned - pMap);
+			if (pAligned + length != pMap + length + extra)
+				munmap(pAligned + length, (pMap + length + extra) - (pAligned + length));
+			pMemory = pAligned;
+#ifdef MADV_HUGEPAGE
+			if ((m_flags & PAGE_THP) && madvise(pMemory, length, MADV_HUGEPAGE) == 0)
+				m_transparentHugePageRegions++;
+#endif
+		}
+	}
+
+	Place(pMemory, length);
+	return pMemory;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::Unmap
+//------------------------------------------------------------------------------
+void PageMemoryProvider::Unmap(void* pMemory, size_t length)
+{
+#if WIN32
+	(void)length;
+	VirtualFree(pMemory, 0, MEM_RELEASE);
+#else
+	munmap(pMemory, length);
+#endif
+}
+
+//------------------------------------------------------------------------------
+// PageMemoryProvider::Place
+//------------------------------------------------------------------------------
+void PageMemoryProvider::Place(void* pMemory, size_t length)
+{
+	if (m_numaNode < 0)
+		return;
+
+#if defined(__linux__) && defined(SYS_mbind)
+	// Prefer the node for pages faulted in later. Called directly through the
+	// system call so that libnuma isn't required.
+	if (m_numaNode < MAX_NUMA_NODES)
+	{
+		const size_t BITS = sizeof(unsigned long) * 8;
+		unsigned long nodeMask[MAX_NUMA_NODES / (sizeof(unsigned long) * 8)] = { 0 };
+		nodeMask[m_numaNode / BITS] = 1UL << (m_numaNode % BITS);
+		if (syscall(SYS_mbind, pMemory, length, MPOL_PREFERRED_MODE, nodeMask,
+			(unsigned long)MAX_NUMA_NODES, 0) == 0)
+			return;
+	}
+#endif
+
+#if !WIN32
+	// No memory policy so fall back to first touch. Fault every page in now from
+	// the allocating thread, which the caller runs on the intended node.
+	size_t page = GetPageSize();
+	for (size_t offset = 0; offset < length; offset += page)
+		((volatile CHAR*)pMemory)[offset] = 0;
+	m_firstTouchRegions++;
+#else
+	(void)pMemory;
+	(void)length;
+#endif
+}
@@ -0,0 +1,157 @@
+#ifndef _MEMORY_PROVIDER_H
+#define _MEMORY_PROVIDER_H
+
+#include "DataTypes.h"
+#include <stddef.h>
+
+/// @brief Supplies the backing memory for Allocator pools, chunks and blocks.
+/// Providers are never destroyed through this interface; an instance must outlive
+/// every Allocator using it.
+class MemoryProvider
+{
+public:
+    /// Get a memory region.
+    /// @param[in]  size - the number of bytes to obtain.
+    /// @param[in]  alignment - the memory alignment, a power of two, or 0 for default.
+    /// @return     A pointer to the memory, or NULL if unavailable.
+    virtual void* Allocate(size_t size, size_t alignment) = 0;
+
+    /// Return a memory region obtained with Allocate().
+    /// @param[in]  pMemory - the memory to release.
+    /// @param[in]  size - the size passed to Allocate().
+    /// @param[in]  alignment - the alignment passed to Allocate().
+    virtual void Free(void* pMemory, size_t size, size_t alignment) = 0;
+
+protected:
+    ~MemoryProvider() = default;
+};
+
+/// @brief The default provider. Memory comes from the system heap.
+class HeapMemoryProvider : public MemoryProvider
+{
+public:
+    virtual void* Allocate(size_t size, size_t alignment);
+    virtual void Free(void* pMemory, size_t size, size_t alignment);
+
+    /// Get the shared default provider instance.
+    /// @return The heap memory provider.
+    static HeapMemoryProvider* GetInstance();
+};
+
+/// @brief Maps regions directly from the operating system in whole pages,
+/// optionally backed by huge pages and placed on a NUMA node. With huge pages, 
+/// regions up to half a huge page, such as allocator chunks, are carved from 
+/// huge page aligned arenas so that they share huge pages. An arena is unmapped
+/// once every region carved from it is freed. Without huge pages, regions smaller
+/// than the minimum size come from the system heap. Huge pages fall back to normal
+/// pages when none are available. Not thread safe; xallocator calls it with its
+/// lock held.
+class PageMemoryProvider : public MemoryProvider
+{
+public:
+    /// Page options
+    enum
+    {
+        PAGE_DEFAULT = 0x00,    ///< Normal pages
+        PAGE_HUGETLB = 0x01,    ///< Explicit huge pages (MAP_HUGETLB) from the reserved huge page pool
+        PAGE_THP = 0x02         ///< Transparent huge pages (madvise MADV_HUGEPAGE)
+    };
+
+    /// Constructor
+    /// @param[in]  flags - PAGE_HUGETLB and/or PAGE_THP. With both, explicit huge
+    ///     pages are tried first and transparent huge pages are the fallback.
+    /// @param[in]  numaNode - the NUMA node to place the memory on, or -1 for the
+    ///     operating system default. If the memory policy cannot be set, the pages
+    ///     are placed by first touch from the allocating thread.
+    /// @param[in]  minSize - without huge pages, regions smaller than this come 
+    ///     from the system heap.
+    PageMemoryProvider(UINT flags = PAGE_HUGETLB | PAGE_THP, INT numaNode = -1, size_t minSize = 64 * 1024);
+
+    /// Destructor. Unmaps the current arena if no region is carved from it.
+    ~PageMemoryProvider();
+
+    virtual void* Allocate(size_t size, size_t alignment);
+    virtual void Free(void* pMemory, size_t size, size_t alignment);
+
+    /// Gets the number of regions, including arenas, mapped with explicit huge pages.
+    /// @return     The number of huge page regions.
+    UINT GetHugePageRegions() { return m_hugePageRegions; }
+
+    /// Gets the number of regions that wanted explicit huge pages but fell back
+    /// to normal or transparent huge pages.
+    /// @return     The number of huge page fallbacks.
+    UINT GetHugePageFallbacks() { return m_hugePageFallbacks; }
+
+    /// Gets the number of regions, including arenas, advised to use transparent 
+    /// huge pages.
+    /// @return     The number of transparent huge page regions.
+    UINT GetTransparentHugePageRegions() { return m_transparentHugePageRegions; }
+
+    /// Gets the number of arenas mapped for regions up to half a huge page.
+    /// @return     The number of arenas.
+    UINT GetArenas() { return m_arenas; }
+
+    /// Gets the number of regions placed with first touch because the NUMA memory
+    /// policy could not be set.
+    /// @return     The number of first touch placements.
+    UINT GetFirstTouchRegions() { return m_firstTouchRegions; }
+
+private:
+    struct Arena;
+
+    /// Round a region size up to the mapping size.
+    /// @param[in]  size - the region size in bytes.
+    /// @param[in]  alignment - the region alignment.
+    /// @return     The mapped length in bytes.
+    size_t MapLength(size_t size, size_t alignment) const;
+
+    /// Check whether a region is carved from an arena.
+    /// @param[in]  size - the region size in bytes.
+    /// @param[in]  alignment - the region alignment.
+    /// @return     TRUE if the region comes from an arena.
+    BOOL IsArena(size_t size, size_t alignment) const;
+
+    /// Check whether a region is mapped or comes from the system heap.
+    /// @param[in]  size - the region size in bytes.
+    /// @param[in]  alignment - the region alignment.
+    /// @return     TRUE if the region is mapped.
+    BOOL IsMapped(size_t size, size_t alignment) const;
+
+    /// Map a region, using huge pages where possible, and place it on the NUMA node.
+    /// @param[in]  length - the mapped length, a multiple of the page size.
+    /// @return     The mapped region, huge page aligned if length is at least a 
+    ///     huge page and huge pages are enabled, or NULL if unavailable.
+    void* Map(size_t length);
+
+    /// Unmap a region obtained with Map().
+    /// @param[in]  pMemory - the mapped region.
+    /// @param[in]  length - the mapped length.
+    void Unmap(void* pMemory, size_t length);
+
+    /// Carve a region from the current arena, mapping a new arena when full.
+    /// @param[in]  size - the region size in bytes.
+    /// @param[in]  alignment - the region alignment.
+    /// @return     The region, or NULL if unavailable.
+    void* ArenaAllocate(size_t size, size_t alignment);
+
+    /// Return a region carved from an arena.
+    /// @param[in]  pMemory - the region.
+    void ArenaFree(void* pMemory);
+
+    /// Place a mapped region on the NUMA node.
+    /// @param[in]  pMemory - the mapped region.
+    /// @param[in]  length - the mapped length.
+    void Place(void* pMemory, size_t length);
+
+    const UINT m_flags;
+    const INT m_numaNode;
+    const size_t m_minSize;
+    Arena* m_pArena;
+    UINT m_hugePageRegions;
+    UINT m_hugePageFallbacks;
+    UINT m_transparentHugePageRegions;
+    UINT m_arenas;
+    UINT m_firstTouchRegions;
+};
+
+#endif
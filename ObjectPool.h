@@ -0,0 +1,145 @@
+#ifndef _OBJECT_POOL_H
+#define _OBJECT_POOL_H
+
+#include "Allocator.h"
+#include "Fault.h"
+#include <new>
+#include <utility>
+
+/// @brief A typed object pool built on Allocator. Create() and Destroy() construct
+/// and destroy objects within fixed blocks; CreateN() and DestroyN() do the same
+/// for a batch while touching the allocator free-list once.
+///
+/// The pool either owns an Allocator or shares an existing one, such as the
+/// allocator of a class using DECLARE_ALLOCATOR. Objects from a pool owning its
+/// allocator must never reach operator delete. An event data class created by an
+/// owning pool overrides EventData::Release() so the state engine returns it to
+/// the pool instead of deleting it:
+///
+///     static ObjectPool<PooledData> pool;
+///     void PooledData::Release() const { pool.Destroy(const_cast<PooledData*>(this)); }
+///
+/// The pool is not thread-safe.
+template <class T>
+class ObjectPool
+{
+public:
+	/// @brief Deleter for std::unique_ptr returning the object to its pool.
+	struct Deleter
+	{
+		Deleter(ObjectPool* pool = NULL) : m_pool(pool) {}
+		void operator()(T* pObject) const { m_pool->Destroy(pObject); }
+		ObjectPool* m_pool;
+	};
+
+	/// Constructor creating a pool with its own allocator.
+	/// @param[in]	objects - maximum number of objects, or 0 to grow on the heap.
+	/// @param[in]	name - optional pool name string.
+	/// @param[in]	chunkBlocks - if objects is 0, the number of objects in the first
+	///		heap chunk. See Allocator.
+	ObjectPool(UINT objects = 0, const CHAR* name = NULL, UINT chunkBlocks = 16) :
+		m_pAllocator(new (m_allocatorMemory) Allocator(sizeof(T), objects, NULL, name, chunkBlocks, alignof(T))),
+		m_owner(TRUE)
+	{
+	}
+
+	/// Constructor sharing an existing allocator, such as DECLARE_ALLOCATOR's.
+	/// @param[in]	allocator - an allocator handling blocks of at least sizeof(T).
+	ObjectPool(Allocator& allocator) :
+		m_pAllocator(&allocator),
+		m_owner(FALSE)
+	{
+		ASSERT_TRUE(allocator.GetBlockSize() >= sizeof(T));
+	}
+
+	/// Destructor. Objects still in use must be destroyed first.
+	~ObjectPool()
+	{
+		if (m_owner)
+			m_pAllocator->~Allocator();
+	}
+
+	/// Construct an object within a pool block.
+	/// @param[in]	args - the T constructor arguments.
+	/// @return		The new object, or NULL if the pool overflow policy fails.
+	template <class... Args>
+	T* Create(Args&&... args)
+	{
+		void* pBlock = m_pAllocator->Allocate(sizeof(T));
+		if (pBlock == NULL)
+			return NULL;
+		try
+		{
+			return ::new (pBlock) T(std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			m_pAllocator->Deallocate(pBlock);
+			throw;
+		}
+	}
+
+	/// Destroy an object created by this pool.
+	/// @param[in]	pObject - the object to destroy, or NULL.
+	void Destroy(T* pObject)
+	{
+		if (pObject == NULL)
+			return;
+		pObject->~T();
+		m_pAllocator->Deallocate(pObject);
+	}
+
+	/// Construct a batch of objects, each with the same constructor arguments.
+	/// @param[out]	pObjects - array receiving count objects.
+	/// @param[in]	count - the number of objects to create.
+	/// @param[in]	args - the T constructor arguments.
+	/// @return		The number of objects created.
+	template <class... Args>
+	UINT CreateN(T** pObjects, UINT count, const Args&... args)
+	{
+		UINT allocated = m_pAllocator->AllocateN((void**)pObjects, count, sizeof(T));
+		UINT constructed = 0;
+		try
+		{
+			for (; constructed < allocated; constructed++)
+				pObjects[constructed] = ::new ((void*)pObjects[constructed]) T(args...);
+		}
+		catch (...)
+		{
+			// Undo the constructed objects and release every block of the batch
+			for (UINT i = 0; i < constructed; i++)
+				pObjects[i]->~T();
+			m_pAllocator->DeallocateN((void**)pObjects, allocated);
+			throw;
+		}
+		return allocated;
+	}
+
+	/// Destroy a batch of objects created by this pool.
+	/// @param[in]	pObjects - array of count objects to destroy.
+	/// @param[in]	count - the number of objects.
+	void DestroyN(T** pObjects, UINT count)
+	{
+		for (UINT i = 0; i < count; i++)
+			pObjects[i]->~T();
+		m_pAllocator->DeallocateN((void**)pObjects, count);
+	}
+
+	/// Gets a deleter returning objects to this pool.
+	/// @return		The deleter for std::unique_ptr<T, ObjectPool<T>::Deleter>.
+	Deleter GetDeleter() { return Deleter(this); }
+
+	/// Gets the underlying allocator.
+	/// @return		The allocator providing the object blocks.
+	Allocator& GetAllocator() { return *m_pAllocator; }
+
+private:
+	ObjectPool(const ObjectPool&);
+	ObjectPool& operator=(const ObjectPool&);
+
+	alignas(Allocator) CHAR m_allocatorMemory[sizeof(Allocator)];
+	Allocator* const m_pAllocator;
+	const BOOL m_owner;
+};
+
+#endif
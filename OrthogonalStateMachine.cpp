@@ -0,0 +1,80 @@
+#include "OrthogonalStateMachine.h"
+
+//----------------------------------------------------------------------------
+// StateRegion::Dispatch
+//----------------------------------------------------------------------------
+void StateRegion::Dispatch(INT event, const EventData* pData)
+{
+	// The owning machine deletes the shared event data
+	SetSharedEventData(pData);
+	DispatchEvent(event, pData);
+	SetSharedEventData(NULL);
+}
+
+//----------------------------------------------------------------------------
+// OrthogonalStateMachine
+//----------------------------------------------------------------------------
+OrthogonalStateMachine::OrthogonalStateMachine(ThreadPool* pool) :
+	m_pPool(pool),
+	m_event(0),
+	m_pData(NULL),
+	m_pending(0)
+{
+}
+
+//----------------------------------------------------------------------------
+// AddRegion
+//----------------------------------------------------------------------------
+void OrthogonalStateMachine::AddRegion(StateRegion& region)
+{
+	RegionTask task = { &region, this };
+	m_regions.push_back(task);
+}
+
+//----------------------------------------------------------------------------
+// Dispatch
+//----------------------------------------------------------------------------
+void OrthogonalStateMachine::Dispatch(INT event, const EventData* pData)
+{
+	m_event = event;
+	m_pData = pData;
+
+	if (m_pPool == NULL || m_regions.size() < 2)
+	{
+		for (size_t i = 0; i < m_regions.size(); i++)
+			m_regions[i].region->Dispatch(event, pData);
+	}
+	else
+	{
+		// Post all but the first region, which runs on this thread meanwhile
+		m_pending = (INT)m_regions.size() - 1;
+		for (size_t i = 1; i < m_regions.size(); i++)
+			m_pPool->Post(&OrthogonalStateMachine::RunRegion, &m_regions[i]);
+
+		m_regions[0].region->Dispatch(event, pData);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (m_pending > 0)
+			m_done.wait(lock);
+	}
+
+	m_pData = NULL;
+#ifndef EXTERNAL_EVENT_NO_HEAP_DATA
+	if (pData != NULL)
+		pData->Release();
+#endif
+}
+
+//----------------------------------------------------------------------------
+// RunRegion
+//----------------------------------------------------------------------------
+void OrthogonalStateMachine::RunRegion(void* context)
+{
+	RegionTask* task = static_cast<RegionTask*>(context);
+	OrthogonalStateMachine* owner = task->owner;
+	task->region->Dispatch(owner->m_event, owner->m_pData);
+
+	std::lock_guard<std::mutex> lock(owner->m_mutex);
+	if (--owner->m_pending == 0)
+		owner->m_done.notify_one();
+}
@@ -0,0 +1,96 @@
+#ifndef _ORTHOGONAL_STATE_MACHINE_H
+#define _ORTHOGONAL_STATE_MACHINE_H
+
+#include "StateMachine.h"
+#include "ThreadPool.h"
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/// @brief A region of an OrthogonalStateMachine. Each region is a state machine 
+/// with its own current state and state map, sharing the external events of the
+/// machine that owns it.
+class StateRegion : public StateMachine
+{
+public:
+	/// Constructor.
+	/// @param[in] maxStates - the maximum number of region states.
+	/// @param[in] initialState - the initial region state.
+	StateRegion(BYTE maxStates, BYTE initialState = 0) : StateMachine(maxStates, initialState) {}
+
+protected:
+	/// Handle an event dispatched to every region. Typically a switch calling the
+	/// region external event function for the event. Events the region doesn't
+	/// take are ignored.
+	/// @param[in] event - the event identifier defined by the owning machine.
+	/// @param[in] pData - the event data. Shared by all regions and deleted by the
+	///		owning machine, not the region.
+	virtual void DispatchEvent(INT event, const EventData* pData) = 0;
+
+private:
+	friend class OrthogonalStateMachine;
+	void Dispatch(INT event, const EventData* pData);
+};
+
+/// @brief A state machine made of orthogonal regions. One external event is 
+/// dispatched to every region, and each region runs it to completion within its
+/// own state map. Regions run one after another on the calling thread or, given
+/// a thread pool, concurrently. Either way Dispatch() returns only once every 
+/// region has finished, so the machine as a whole also runs to completion.
+///
+/// With a thread pool, state functions in different regions run at the same time.
+/// They must not share unsynchronized data, including a TimerWheel driven by the
+/// calling thread.
+class OrthogonalStateMachine
+{
+public:
+	/// Constructor.
+	/// @param[in] pool - the thread pool running the regions concurrently, or NULL
+	///		to run the regions in turn on the calling thread.
+	OrthogonalStateMachine(ThreadPool* pool = NULL);
+
+	virtual ~OrthogonalStateMachine() {}
+
+	/// Gets the number of regions.
+	/// @return The region count.
+	INT GetRegionCount() const { return (INT)m_regions.size(); }
+
+protected:
+	/// Add a region. Call from the derived class constructor.
+	/// @param[in] region - the region. Must outlive this object.
+	void AddRegion(StateRegion& region);
+
+	/// Dispatch an external event to every region.
+	/// @param[in] event - the event identifier passed to StateRegion::DispatchEvent().
+	/// @param[in] pData - the event data. Unless EXTERNAL_EVENT_NO_HEAP_DATA is 
+	///		defined, it must be created on the heap and is deleted once every region
+	///		has finished.
+	void Dispatch(INT event, const EventData* pData = NULL);
+
+private:
+	OrthogonalStateMachine(const OrthogonalStateMachine&);
+	OrthogonalStateMachine& operator=(const OrthogonalStateMachine&);
+
+	/// ThreadPoolTask running one region
+	static void RunRegion(void* context);
+
+	struct RegionTask
+	{
+		StateRegion* region;
+		OrthogonalStateMachine* owner;
+	};
+
+	std::vector<RegionTask> m_regions;
+	ThreadPool* const m_pPool;
+
+	/// The event being dispatched
+	INT m_event;
+	const EventData* m_pData;
+
+	/// Regions still running on the thread pool
+	std::mutex m_mutex;
+	std::condition_variable m_done;
+	INT m_pending;
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include "StateLatency.h"
+#include "StateMachine.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+static std::mutex _classesLock;
+static std::atomic<StateLatency*> _classes(NULL);
+
+//------------------------------------------------------------------------------
+// Percentile
+//------------------------------------------------------------------------------
+static UINT64 Percentile(const LatencyHistogram& histogram, UINT64 count, DOUBLE percentile)
+{
+	UINT64 rank = (UINT64)(percentile / 100.0 * (DOUBLE)count);
+	if (rank >= count)
+		rank = count - 1;
+	UINT64 seen = 0;
+	for (INT bucket = 0; bucket < LatencyHistogram::BUCKETS; bucket++)
+	{
+		seen += histogram.GetCount(bucket);
+		if (seen > rank)
+			return std::min(LatencyHistogram::GetBucketMax(bucket), histogram.GetMax());
+	}
+	return histogram.GetMax();
+}
+
+//------------------------------------------------------------------------------
+// LatencyHistogram::GetBucketMax
+//------------------------------------------------------------------------------
+UINT64 LatencyHistogram::GetBucketMax(INT bucket)
+{
+	INT group = bucket / SUB_BUCKETS;
+	INT sub = bucket % SUB_BUCKETS;
+	if (group == 0)
+		return (UINT64)sub;
+	if (bucket == BUCKETS - 1)
+		return ~0ULL;
+	return ((UINT64)(SUB_BUCKETS + sub + 1) << (group - 1)) - 1;
+}
+
+//------------------------------------------------------------------------------
+// LatencyHistogram::Reset
+//------------------------------------------------------------------------------
+void LatencyHistogram::Reset()
+{
+	for (INT bucket = 0; bucket < BUCKETS; bucket++)
+		m_buckets[bucket].store(0, std::memory_order_relaxed);
+	m_sum.store(0, std::memory_order_relaxed);
+	m_max.store(0, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// StateLatency
+//------------------------------------------------------------------------------
+StateLatency::StateLatency(const void* stateMap, StateMachine* machine) :
+	m_stateMap(stateMap),
+	m_states(machine->GetMaxStates()),
+	m_next(NULL)
+{
+	const CHAR* name = typeid(*machine).name();
+#if defined(__GNUG__)
+	INT status = 0;
+	CHAR* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+	if (status == 0 && demangled != NULL)
+		m_machineName = demangled;
+	else
+		m_machineName = strdup(name);
+#else
+	m_machineName = _strdup(name);
+#endif
+
+	m_stateNames = new const CHAR*[m_states];
+	for (INT state = 0; state < m_states; state++)
+		m_stateNames[state] = machine->GetStateName((BYTE)state);
+
+	m_histograms = new std::atomic<LatencyHistogram*>[m_states * ACTION_COUNT];
+	for (INT i = 0; i < m_states * ACTION_COUNT; i++)
+		m_histograms[i].store(NULL, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// ~StateLatency
+//------------------------------------------------------------------------------
+StateLatency::~StateLatency()
+{
+	for (INT i = 0; i < m_states * ACTION_COUNT; i++)
+		delete m_histograms[i].load(std::memory_order_relaxed);
+	delete[] m_histograms;
+	delete[] m_stateNames;
+	free(m_machineName);
+}
+
+//------------------------------------------------------------------------------
+// Find
+//------------------------------------------------------------------------------
+StateLatency* StateLatency::Find(const void* stateMap, StateMachine* machine)
+{
+	std::lock_guard<std::mutex> lock(_classesLock);
+	StateLatency* latency = _classes.load(std::memory_order_relaxed);
+	for (; latency != NULL; latency = latency->m_next)
+	{
+		if (latency->m_stateMap == stateMap)
+			return latency;
+	}
+
+	latency = new StateLatency(stateMap, machine);
+	latency->m_next = _classes.load(std::memory_order_relaxed);
+	_classes.store(latency, std::memory_order_release);
+	return latency;
+}
+
+//------------------------------------------------------------------------------
+// CreateHistogram
+//------------------------------------------------------------------------------
+LatencyHistogram* StateLatency::CreateHistogram(INT index)
+{
+	// Another thread timing the same action may race to create the histogram
+	LatencyHistogram* histogram = new LatencyHistogram();
+	LatencyHistogram* expected = NULL;
+	if (!m_histograms[index].compare_exchange_strong(expected, histogram, std::memory_order_acq_rel))
+	{
+		delete histogram;
+		histogram = expected;
+	}
+	return histogram;
+}
+
+//------------------------------------------------------------------------------
+// GetStats
+//------------------------------------------------------------------------------
+INT StateLatency::GetStats(StateLatencyStats* stats, INT maxStats)
+{
+	UINT64 ticksPerSecond = TraceClock::GetTicksPerSecond();
+	auto toNs = [ticksPerSecond](UINT64 ticks) -> UINT64
+	{
+		return (UINT64)((DOUBLE)ticks * 1e9 / (DOUBLE)ticksPerSecond);
+	};
+
+	INT count = 0;
+	for (StateLatency* latency = _classes.load(std::memory_order_acquire); latency != NULL; latency = latency->m_next)
+	{
+		for (INT i = 0; i < latency->m_states * ACTION_COUNT && count < maxStats; i++)
+		{
+			const LatencyHistogram* histogram = latency->m_histograms[i].load(std::memory_order_acquire);
+			if (histogram == NULL)
+				continue;
+
+			UINT64 total = 0;
+			INT minBucket = -1;
+			for (INT bucket = 0; bucket < LatencyHistogram::BUCKETS; bucket++)
+			{
+				UINT64 buckets = histogram->GetCount(bucket);
+				if (buckets != 0 && minBucket < 0)
+					minBucket = bucket;
+				total += buckets;
+			}
+			if (total == 0)
+				continue;
+
+			StateLatencyStats& entry = stats[count++];
+			entry.machineName = latency->m_machineName;
+			entry.state = (BYTE)(i / ACTION_COUNT);
+			entry.stateName = latency->m_stateNames[entry.state];
+			entry.action = i % ACTION_COUNT;
+			entry.count = total;
+			entry.minNs = toNs(std::min(LatencyHistogram::GetBucketMax(minBucket), histogram->GetMax()));
+			entry.meanNs = toNs(histogram->GetSum() / total);
+			entry.p50Ns = toNs(Percentile(*histogram, total, 50.0));
+			entry.p90Ns = toNs(Percentile(*histogram, total, 90.0));
+			entry.p99Ns = toNs(Percentile(*histogram, total, 99.0));
+			entry.p999Ns = toNs(Percentile(*histogram, total, 99.9));
+			entry.maxNs = toNs(histogram->GetMax());
+		}
+	}
+	return count;
+}
+
+//------------------------------------------------------------------------------
+// Dump
+//------------------------------------------------------------------------------
+void StateLatency::Dump(FILE* fp)
+{
+	INT maxStats = 0;
+	for (StateLatency* latency = _classes.load(std::memory_order_acquire); latency != NULL; latency = latency->m_next)
+		maxStats += latency->m_states * ACTION_COUNT;
+
+	std::vector<StateLatencyStats> stats(maxStats > 0 ? maxStats : 1);
+	INT count = GetStats(&stats[0], maxStats);
+
+	fprintf(fp, "%-24s %-24s %-6s %10s %10s %10s %10s %10s %10s %10s\n", "Machine", "State", "Action",
+		"Count", "Mean ns", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "Max ns");
+	for (INT i = 0; i < count; i++)
+	{
+		const StateLatencyStats& entry = stats[i];
+		CHAR state[32];
+		if (entry.stateName != NULL)
+			snprintf(state, sizeof(state), "%s", entry.stateName);
+		else
+			snprintf(state, sizeof(state), "%u", entry.state);
+		fprintf(fp, "%-24s %-24s %-6s %10llu %10llu %10llu %10llu %10llu %10llu %10llu\n",
+			entry.machineName, state, GetActionName(entry.action), entry.count, entry.meanNs,
+			entry.p50Ns, entry.p90Ns, entry.p99Ns, entry.p999Ns, entry.maxNs);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Reset
+//------------------------------------------------------------------------------
+void StateLatency::Reset()
+{
+	for (StateLatency* latency = _classes.load(std::memory_order_acquire); latency != NULL; latency = latency->m_next)
+	{
+		for (INT i = 0; i < latency->m_states * ACTION_COUNT; i++)
+		{
+			LatencyHistogram* histogram = latency->m_histograms[i].load(std::memory_order_acquire);
+			if (histogram != NULL)
+				histogram->Reset();
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+// GetActionName
+//------------------------------------------------------------------------------
+const CHAR* StateLatency::GetActionName(INT action)
+{
+	switch (action)
+	{
+	case ACTION_STATE:	return "state";
+	case ACTION_GUARD:	return "guard";
+	case ACTION_ENTRY:	return "entry";
+	case ACTION_EXIT:	return "exit";
+	default:			return "?";
+	}
+}
@@ -0,0 +1,184 @@
+#ifndef _STATE_LATENCY_H
+#define _STATE_LATENCY_H
+
+#include "TraceClock.h"
+#include <atomic>
+#include <stdio.h>
+
+// Define STATE_MACHINE_LATENCY to time every state, guard, entry and exit action
+// run by the state engine. Normally defined by the build (see the
+// STATE_MACHINE_LATENCY CMake option). When undefined the state engine has no
+// timing code at all.
+//#define STATE_MACHINE_LATENCY
+
+class StateMachine;
+
+/// @brief A log-linear latency histogram in the style of HdrHistogram. Values
+/// below 8 ticks have a bucket each; above that each power of two is split into
+/// 8 buckets, so a bucket spans at most 12.5% of its value. Values from 2^40
+/// ticks up share the last bucket. Recording is lock-free and safe from any thread.
+class LatencyHistogram
+{
+public:
+	enum
+	{
+		SUB_BUCKET_BITS = 3,
+		SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+		MAX_MAGNITUDE = 40,
+		BUCKETS = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 2) * SUB_BUCKETS
+	};
+
+	LatencyHistogram() { Reset(); }
+
+	/// Record a duration.
+	/// @param[in] ticks - the duration in TraceClock ticks.
+	void Record(UINT64 ticks)
+	{
+		m_buckets[GetBucket(ticks)].fetch_add(1, std::memory_order_relaxed);
+		m_sum.fetch_add(ticks, std::memory_order_relaxed);
+		UINT64 max = m_max.load(std::memory_order_relaxed);
+		while (ticks > max && !m_max.compare_exchange_weak(max, ticks, std::memory_order_relaxed))
+			;
+	}
+
+	/// Gets the bucket a value is counted in.
+	/// @param[in] ticks - the value.
+	/// @return The bucket index.
+	static INT GetBucket(UINT64 ticks)
+	{
+		if (ticks < SUB_BUCKETS)
+			return (INT)ticks;
+		INT magnitude = Log2(ticks);
+		if (magnitude > MAX_MAGNITUDE)
+			return BUCKETS - 1;
+		return (magnitude - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+			(INT)((ticks >> (magnitude - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+	}
+
+	/// Gets the highest value counted in a bucket.
+	/// @param[in] bucket - the bucket index.
+	/// @return The highest value.
+	static UINT64 GetBucketMax(INT bucket);
+
+	/// Gets the number of values counted in a bucket.
+	/// @param[in] bucket - the bucket index.
+	/// @return The count.
+	UINT64 GetCount(INT bucket) const { return m_buckets[bucket].load(std::memory_order_relaxed); }
+
+	/// Gets the sum of the values recorded.
+	/// @return The sum in ticks.
+	UINT64 GetSum() const { return m_sum.load(std::memory_order_relaxed); }
+
+	/// Gets the largest value recorded.
+	/// @return The largest value in ticks.
+	UINT64 GetMax() const { return m_max.load(std::memory_order_relaxed); }
+
+	/// Discard the recorded values.
+	void Reset();
+
+private:
+	static INT Log2(UINT64 value)
+	{
+#if defined(__GNUC__)
+		return 63 - __builtin_clzll(value);
+#else
+		INT log2 = 0;
+		while (value >>= 1)
+			log2++;
+		return log2;
+#endif
+	}
+
+	std::atomic<UINT64> m_buckets[BUCKETS];
+	std::atomic<UINT64> m_sum;
+	std::atomic<UINT64> m_max;
+};
+
+/// Latency summary of one action of one state
+typedef struct
+{
+	const CHAR* machineName;	///< State machine type name
+	const CHAR* stateName;		///< State name or NULL if unnamed
+	BYTE state;					///< State number
+	INT action;					///< StateLatency::Action
+	UINT64 count;				///< Durations recorded
+	UINT64 minNs;				///< Shortest, to the histogram precision
+	UINT64 meanNs;				///< Mean
+	UINT64 p50Ns;				///< Median
+	UINT64 p90Ns;				///< 90th percentile
+	UINT64 p99Ns;				///< 99th percentile
+	UINT64 p999Ns;				///< 99.9th percentile
+	UINT64 maxNs;				///< Longest
+} StateLatencyStats;
+
+/// @brief Per state action latency of one state machine class. Every instance of
+/// a class shares the same histograms, found by the address of the class state
+/// map, so the figures aggregate all instances on all threads. Histograms are
+/// allocated the first time an action of a state is timed.
+class StateLatency
+{
+public:
+	/// Action kinds timed by the state engine
+	enum Action
+	{
+		ACTION_STATE,	///< ST_ state function
+		ACTION_GUARD,	///< GD_ guard condition
+		ACTION_ENTRY,	///< EN_ entry action
+		ACTION_EXIT,	///< EX_ exit action
+		ACTION_COUNT
+	};
+
+	/// Gets the latency record of a state machine class, creating it on first use.
+	/// @param[in] stateMap - the class state map, identifying the class.
+	/// @param[in] machine - a state machine of the class, providing the names.
+	/// @return The latency record, which lives until the program exits.
+	static StateLatency* Find(const void* stateMap, StateMachine* machine);
+
+	/// Record an action duration.
+	/// @param[in] state - the state the action belongs to.
+	/// @param[in] action - the action kind.
+	/// @param[in] ticks - the duration in TraceClock ticks.
+	void Record(BYTE state, Action action, UINT64 ticks)
+	{
+		LatencyHistogram* histogram = m_histograms[state * ACTION_COUNT + action].load(std::memory_order_acquire);
+		if (histogram == NULL)
+			histogram = CreateHistogram(state * ACTION_COUNT + action);
+		histogram->Record(ticks);
+	}
+
+	/// Take a latency snapshot of every timed action of every class, without
+	/// stopping the state machines.
+	/// @param[out] stats - array receiving one entry per timed state action.
+	/// @param[in] maxStats - the number of entries in stats.
+	/// @return The number of entries stored.
+	static INT GetStats(StateLatencyStats* stats, INT maxStats);
+
+	/// Write a latency table of every timed action of every class.
+	/// @param[in] fp - the output file.
+	static void Dump(FILE* fp);
+
+	/// Discard the durations recorded by every class.
+	static void Reset();
+
+	/// Gets an action kind name.
+	/// @param[in] action - the action kind.
+	/// @return The name, such as "state".
+	static const CHAR* GetActionName(INT action);
+
+private:
+	StateLatency(const void* stateMap, StateMachine* machine);
+	~StateLatency();
+	StateLatency(const StateLatency&);
+	StateLatency& operator=(const StateLatency&);
+
+	LatencyHistogram* CreateHistogram(INT index);
+
+	const void* const m_stateMap;
+	CHAR* m_machineName;
+	const BYTE m_states;
+	const CHAR** m_stateNames;
+	std::atomic<LatencyHistogram*>* m_histograms;
+	StateLatency* m_next;
+};
+
+#endif
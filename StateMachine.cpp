@@ -1,4 +1,43 @@
 #include "StateMachine.h"
+#include "TimerWheel.h"
+#include "WaitCondition.h"
+#ifdef STATE_MACHINE_COROUTINES
+#include "CoroutineState.h"
+#endif
+#ifdef ALLOC_SAMPLING
+#include "AllocProfiler.h"
+#include <typeinfo>
+#endif
+
+// Run a state engine call as a state action, timed by the enabled action
+// instrumentation. Expands to the call alone when none is enabled.
+#ifdef STATE_MACHINE_ACTION_HOOKS
+#define STATE_ACTION(state, action, data, call) \
+	do { \
+		UINT64 _actionStart = BeginAction(state, StateLatency::action, data); \
+		call; \
+		EndAction(state, StateLatency::action, data, _actionStart); \
+	} while (0)
+#else
+#define STATE_ACTION(state, action, data, call) call
+#endif
+
+/// @brief The state timer and wait condition link of a state machine. See 
+/// StateMachine::GetWaits().
+struct StateWaits
+{
+	/// The state timer and the wheel it is armed on, if any.
+	WheelTimer stateTimer;
+	TimerWheel* pTimerWheel;
+
+	/// The state the state timer transitions to, or EVENT_IGNORED to call 
+	/// StateTimeout() instead.
+	BYTE timerWakeState;
+
+	/// The link parking the machine on a wait condition and the state to wake to.
+	WaitLink waitLink;
+	BYTE wakeState;
+};
 
 //----------------------------------------------------------------------------
 // StateMachine
@@ -8,23 +47,233 @@ StateMachine::StateMachine(BYTE maxStates, BYTE initialState) :
 	m_currentState(initialState),
 	m_newState(FALSE),
 	m_eventGenerated(FALSE),
-	m_pEventData(NULL)
+	m_pEventData(NULL),
+	m_pSharedData(NULL),
+	m_pWaits(NULL)
+#ifdef STATE_MACHINE_COROUTINES
+	, m_pCoroutine(NULL)
+#endif
+#ifdef STATE_MACHINE_COVERAGE
+	, m_pCoverage(NULL)
+	, m_pCoverageCell(NULL)
+#endif
+#ifdef STATE_MACHINE_LATENCY
+	, m_pLatency(NULL)
+#endif
+#ifdef STATE_MACHINE_WATCHDOG
+	, m_pWatchdog(NULL)
+#endif
 {
 	ASSERT_TRUE(MAX_STATES < EVENT_IGNORED);
 }  
 
+//----------------------------------------------------------------------------
+// ~StateMachine
+//----------------------------------------------------------------------------
+StateMachine::~StateMachine()
+{
+	LeaveState();
+	delete m_pWaits;
+}
+
+//----------------------------------------------------------------------------
+// GetWaits
+//----------------------------------------------------------------------------
+StateWaits& StateMachine::GetWaits()
+{
+	if (m_pWaits == NULL)
+	{
+		m_pWaits = new StateWaits();
+		m_pWaits->stateTimer.SetCallback(&StateMachine::StateTimerExpired, this);
+		m_pWaits->pTimerWheel = NULL;
+		m_pWaits->timerWakeState = EVENT_IGNORED;
+		m_pWaits->waitLink.m_pMachine = this;
+		m_pWaits->wakeState = EVENT_IGNORED;
+	}
+	return *m_pWaits;
+}
+
+//----------------------------------------------------------------------------
+// StartStateTimer
+//----------------------------------------------------------------------------
+void StateMachine::StartStateTimer(TimerWheel& wheel, UINT64 ticks)
+{
+	// Moving to another wheel cancels the timer on the old one
+	StateWaits& waits = GetWaits();
+	if (waits.pTimerWheel != &wheel)
+		StopStateTimer();
+	waits.pTimerWheel = &wheel;
+	waits.timerWakeState = EVENT_IGNORED;
+	wheel.Arm(waits.stateTimer, ticks);
+}
+
+//----------------------------------------------------------------------------
+// StopStateTimer
+//----------------------------------------------------------------------------
+void StateMachine::StopStateTimer()
+{
+	if (m_pWaits != NULL && m_pWaits->pTimerWheel != NULL)
+		m_pWaits->pTimerWheel->Cancel(m_pWaits->stateTimer);
+}
+
+//----------------------------------------------------------------------------
+// StateTimerExpired
+//----------------------------------------------------------------------------
+void StateMachine::StateTimerExpired(WheelTimer*, void* context)
+{
+	StateMachine* sm = static_cast<StateMachine*>(context);
+	if (sm->m_pWaits->timerWakeState != EVENT_IGNORED)
+		sm->ExternalEvent(sm->m_pWaits->timerWakeState);
+	else
+		sm->StateTimeout();
+}
+
+//----------------------------------------------------------------------------
+// WaitFor
+//----------------------------------------------------------------------------
+void StateMachine::WaitFor(WaitCondition& condition, BYTE wakeState)
+{
+	ASSERT_TRUE(wakeState < MAX_STATES);
+	StateWaits& waits = GetWaits();
+	CancelWait();
+	waits.wakeState = wakeState;
+	condition.Add(waits.waitLink);
+
+	// Already satisfied so transition when the current state function returns
+	if (condition.IsSatisfied(waits.waitLink))
+	{
+		CancelWait();
+		InternalEvent(wakeState);
+	}
+}
+
+//----------------------------------------------------------------------------
+// WaitFor
+//----------------------------------------------------------------------------
+void StateMachine::WaitFor(WaitValue& value, INT compare, INT64 threshold, BYTE wakeState)
+{
+	StateWaits& waits = GetWaits();
+	waits.waitLink.m_compare = compare;
+	waits.waitLink.m_threshold = threshold;
+	WaitFor(static_cast<WaitCondition&>(value), wakeState);
+}
+
+//----------------------------------------------------------------------------
+// CancelWait
+//----------------------------------------------------------------------------
+void StateMachine::CancelWait()
+{
+	if (m_pWaits != NULL)
+		WaitCondition::Remove(m_pWaits->waitLink);
+}
+
+//----------------------------------------------------------------------------
+// Wake
+//----------------------------------------------------------------------------
+void StateMachine::Wake()
+{
+	ExternalEvent(m_pWaits->wakeState);
+}
+
+//----------------------------------------------------------------------------
+// WaitFor
+//----------------------------------------------------------------------------
+void StateMachine::WaitFor(TimerWheel& wheel, UINT64 ticks, BYTE wakeState)
+{
+	ASSERT_TRUE(wakeState < MAX_STATES);
+	StartStateTimer(wheel, ticks);
+	m_pWaits->timerWakeState = wakeState;
+}
+
+#ifdef STATE_MACHINE_COROUTINES
+//----------------------------------------------------------------------------
+// NextEvent
+//----------------------------------------------------------------------------
+StateAwait StateMachine::NextEvent()
+{
+	return StateAwait();
+}
+
+//----------------------------------------------------------------------------
+// Delay
+//----------------------------------------------------------------------------
+StateAwait StateMachine::Delay(TimerWheel& wheel, UINT64 ticks)
+{
+	WaitFor(wheel, ticks, GetCurrentState());
+	return StateAwait();
+}
+
+//----------------------------------------------------------------------------
+// WaitUntil
+//----------------------------------------------------------------------------
+StateAwait StateMachine::WaitUntil(WaitValue& value, INT compare, INT64 threshold)
+{
+	// If already satisfied, the internal event resumes the coroutine at once
+	WaitFor(value, compare, threshold, GetCurrentState());
+	return StateAwait();
+}
+
+//----------------------------------------------------------------------------
+// DestroyCoroutine
+//----------------------------------------------------------------------------
+void StateMachine::DestroyCoroutine()
+{
+	if (m_pCoroutine != NULL)
+	{
+		std::coroutine_handle<>::from_address(m_pCoroutine).destroy();
+		m_pCoroutine = NULL;
+	}
+}
+
+//----------------------------------------------------------------------------
+// CoroutineStateBase::Resume
+//----------------------------------------------------------------------------
+BOOL CoroutineStateBase::Resume(StateMachine* sm, const EventData* data)
+{
+	if (sm->m_pCoroutine == NULL)
+		return FALSE;
+
+	StateTask::Handle handle = StateTask::Handle::from_address(sm->m_pCoroutine);
+	handle.promise().m_pData = data;
+	handle.resume();
+	if (handle.done())
+		sm->DestroyCoroutine();
+	return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// CoroutineStateBase::Started
+//----------------------------------------------------------------------------
+void CoroutineStateBase::Started(StateMachine* sm, StateTask::Handle handle)
+{
+	if (handle.done())
+		handle.destroy();
+	else
+		sm->m_pCoroutine = handle.address();
+}
+#endif
+
 //----------------------------------------------------------------------------
 // ExternalEvent
 //----------------------------------------------------------------------------
 void StateMachine::ExternalEvent(BYTE newState, const EventData* pData)
 {
+#ifdef ALLOC_SAMPLING
+	// Attribute a sampled allocation of the event data to its type
+	if (pData != NULL)
+		AllocProfiler::Attribute(pData, typeid(*pData).name());
+#endif
+
 	// If we are supposed to ignore this event
 	if (newState == EVENT_IGNORED)
 	{
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+		OnIgnored();
+#endif
 #ifndef EXTERNAL_EVENT_NO_HEAP_DATA
-		// Just delete the event data, if any
-		if (pData != NULL)
-			delete pData;
+		// Just release the event data, if any
+		if (pData != NULL && pData != m_pSharedData)
+			pData->Release();
 #endif
 	}
 	else
@@ -39,10 +288,18 @@ void StateMachine::ExternalEvent(BYTE newState, const EventData* pData)
 		// Generate the event
 		InternalEvent(newState, pData);
 
+#ifdef STATE_MACHINE_TIMELINE
+		StateTimeline::Record(StateTimeline::EVENT_BEGIN, this, typeid(*this).name(), newState, NULL);
+#endif
+
 		// Execute the state engine. This function call will only return
 		// when all state machine events are processed.
 		StateEngine();
 
+#ifdef STATE_MACHINE_TIMELINE
+		StateTimeline::Record(StateTimeline::EVENT_END, this, typeid(*this).name(), m_currentState, NULL);
+#endif
+
 		// TODO - release software lock here 
 	}
 }
@@ -55,6 +312,10 @@ void StateMachine::InternalEvent(BYTE newState, const EventData* pData)
 	if (pData == NULL)
 		pData = new NoEventData();
 
+#ifdef ALLOC_SAMPLING
+	AllocProfiler::Attribute(pData, typeid(*pData).name());
+#endif
+
 	m_pEventData = pData;
 	m_eventGenerated = TRUE;
 	m_newState = newState;
@@ -74,7 +335,13 @@ void StateMachine::StateEngine(void)
 		if (pStateMapEx != NULL)
 			StateEngine(pStateMapEx);
 		else
-			ASSERT();
+		{
+			const HsmStateMap* pStateMapHsm = GetStateMapHsm();
+			if (pStateMapHsm != NULL)
+				StateEngine(pStateMapHsm);
+			else
+				ASSERT();
+		}
 	}
 }
 
@@ -86,7 +353,13 @@ void StateMachine::StateEngine(const StateMapRow* const pStateMap)
 #if EXTERNAL_EVENT_NO_HEAP_DATA
 	BOOL externalEvent = TRUE;
 #endif
-	const EventData* pDataTemp = NULL;	
+	const EventData* pDataTemp = NULL;
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+	BYTE traceFlags = StateMachineTrace::TRACE_EXTERNAL;
+#endif
+#ifdef STATE_MACHINE_ACTION_HOOKS
+	InitActionHooks(pStateMap);
+#endif
 
 	// While events are being generated keep executing states
 	while (m_eventGenerated)
@@ -106,26 +379,36 @@ void StateMachine::StateEngine(const StateMapRow* const pStateMap)
 		// Event used up, reset the flag
 		m_eventGenerated = FALSE;
 
+		// Leaving the current state cancels its timer and wait
+		if (m_newState != m_currentState)
+			LeaveState();
+
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+		OnTransition(pStateMap[m_currentState].State, state, traceFlags);
+		traceFlags = 0;
+#endif
+
 		// Switch to the new current state
 		SetCurrentState(m_newState);
 
 		// Execute the state action passing in event data
 		ASSERT_TRUE(state != NULL);
-		state->InvokeStateAction(this, pDataTemp);
+		STATE_ACTION(m_currentState, ACTION_STATE, pDataTemp, state->InvokeStateAction(this, pDataTemp));
 
-		// If event data was used, then delete it
+		// If event data was used, then release it
 #if EXTERNAL_EVENT_NO_HEAP_DATA
 		if (pDataTemp)
 		{
 			if (!externalEvent)
-				delete pDataTemp;
+				pDataTemp->Release();
 			pDataTemp = NULL;
 		}
 		externalEvent = FALSE;
 #else
 		if (pDataTemp)
 		{
-			delete pDataTemp;
+			if (pDataTemp != m_pSharedData)
+				pDataTemp->Release();
 			pDataTemp = NULL;
 		}
 #endif
@@ -141,6 +424,12 @@ void StateMachine::StateEngine(const StateMapRowEx* const pStateMapEx)
 	BOOL externalEvent = TRUE;
 #endif
 	const EventData* pDataTemp = NULL;
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+	BYTE traceFlags = StateMachineTrace::TRACE_EXTERNAL;
+#endif
+#ifdef STATE_MACHINE_ACTION_HOOKS
+	InitActionHooks(pStateMapEx);
+#endif
 
 	// While events are being generated keep executing states
 	while (m_eventGenerated)
@@ -166,7 +455,12 @@ void StateMachine::StateEngine(const StateMapRowEx* const pStateMapEx)
 		// Execute the guard condition
 		BOOL guardResult = TRUE;
 		if (guard != NULL)
-			guardResult = guard->InvokeGuardCondition(this, pDataTemp);
+		{
+			STATE_ACTION(m_newState, ACTION_GUARD, pDataTemp, guardResult = guard->InvokeGuardCondition(this, pDataTemp));
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+			traceFlags |= StateMachineTrace::TRACE_GUARD;
+#endif
+		}
 
 		// If the guard condition succeeds
 		if (guardResult == TRUE)
@@ -176,42 +470,319 @@ void StateMachine::StateEngine(const StateMapRowEx* const pStateMapEx)
 			{
 				// Execute the state exit action on current state before switching to new state
 				if (exit != NULL)
-					exit->InvokeExitAction(this);
+				{
+					STATE_ACTION(m_currentState, ACTION_EXIT, NULL, exit->InvokeExitAction(this));
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+					traceFlags |= StateMachineTrace::TRACE_EXIT;
+#endif
+				}
+
+				// Leaving the current state cancels its timer and wait
+				LeaveState();
 
 				// Execute the state entry action on the new state
 				if (entry != NULL)
-					entry->InvokeEntryAction(this, pDataTemp);
+				{
+					STATE_ACTION(m_newState, ACTION_ENTRY, pDataTemp, entry->InvokeEntryAction(this, pDataTemp));
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+					traceFlags |= StateMachineTrace::TRACE_ENTRY;
+#endif
+				}
+
+				// Ensure exit/entry actions didn't call InternalEvent by accident 
+				ASSERT_TRUE(m_eventGenerated == FALSE);
+			}
+
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+			OnTransition(pStateMapEx[m_currentState].State, state, traceFlags);
+#endif
+
+			// Switch to the new current state
+			SetCurrentState(m_newState);
+
+			// Execute the state action passing in event data
+			ASSERT_TRUE(state != NULL);
+			STATE_ACTION(m_currentState, ACTION_STATE, pDataTemp, state->InvokeStateAction(this, pDataTemp));
+		}
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+		else
+			OnTransition(pStateMapEx[m_currentState].State, state, traceFlags | StateMachineTrace::TRACE_GUARD_REJECTED);
+		traceFlags = 0;
+#endif
+
+		// If event data was used, then release it
+#if EXTERNAL_EVENT_NO_HEAP_DATA
+		if (pDataTemp)
+		{
+			if (!externalEvent)
+				pDataTemp->Release();
+			pDataTemp = NULL;
+		}
+		externalEvent = FALSE;
+#else
+		if (pDataTemp)
+		{
+			if (pDataTemp != m_pSharedData)
+				pDataTemp->Release();
+			pDataTemp = NULL;
+		}
+#endif
+	}
+}
+
+//----------------------------------------------------------------------------
+// StateEngine
+//----------------------------------------------------------------------------
+void StateMachine::StateEngine(const HsmStateMap* const pStateMapHsm)
+{
+#if EXTERNAL_EVENT_NO_HEAP_DATA
+	BOOL externalEvent = TRUE;
+#endif
+	const EventData* pDataTemp = NULL;
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+	BYTE traceFlags = StateMachineTrace::TRACE_EXTERNAL;
+#endif
+	const StateMapRowHsm* pStateMap = pStateMapHsm->GetRows();
+#ifdef STATE_MACHINE_ACTION_HOOKS
+	InitActionHooks(pStateMapHsm);
+#endif
+
+	// While events are being generated keep executing states
+	while (m_eventGenerated)
+	{
+		// Error check that the new state is valid before proceeding
+		ASSERT_TRUE(m_newState < MAX_STATES);
+
+		// Get the pointers from the state map
+		const StateBase* state = pStateMap[m_newState].State;
+		const GuardBase* guard = pStateMap[m_newState].Guard;
+
+		// Copy of event data pointer
+		pDataTemp = m_pEventData;
+
+		// Event data used up, reset the pointer
+		m_pEventData = NULL;
+
+		// Event used up, reset the flag
+		m_eventGenerated = FALSE;
+
+		// Execute the guard condition
+		BOOL guardResult = TRUE;
+		if (guard != NULL)
+		{
+			STATE_ACTION(m_newState, ACTION_GUARD, pDataTemp, guardResult = guard->InvokeGuardCondition(this, pDataTemp));
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+			traceFlags |= StateMachineTrace::TRACE_GUARD;
+#endif
+		}
+
+		// If the guard condition succeeds
+		if (guardResult == TRUE)
+		{
+			// Transitioning to a new state?
+			if (m_newState != m_currentState)
+			{
+				INT shared = pStateMapHsm->GetSharedLength(m_currentState, m_newState);
+
+				// Execute the exit actions from the current state up to, but not 
+				// including, the least common ancestor
+				const BYTE* path = pStateMapHsm->GetPath(m_currentState);
+				for (INT depth = pStateMapHsm->GetDepth(m_currentState); depth >= shared; depth--)
+				{
+					const ExitBase* exit = pStateMap[path[depth]].Exit;
+					if (exit != NULL)
+					{
+						STATE_ACTION(path[depth], ACTION_EXIT, NULL, exit->InvokeExitAction(this));
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+						traceFlags |= StateMachineTrace::TRACE_EXIT;
+#endif
+					}
+				}
+
+				// Leaving the current state cancels its timer and wait
+				LeaveState();
+
+				// Execute the entry actions from below the least common ancestor 
+				// down to the new state
+				path = pStateMapHsm->GetPath(m_newState);
+				for (INT depth = shared; depth <= pStateMapHsm->GetDepth(m_newState); depth++)
+				{
+					const EntryBase* entry = pStateMap[path[depth]].Entry;
+					if (entry != NULL)
+					{
+						STATE_ACTION(path[depth], ACTION_ENTRY, pDataTemp, entry->InvokeEntryAction(this, pDataTemp));
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+						traceFlags |= StateMachineTrace::TRACE_ENTRY;
+#endif
+					}
+				}
 
 				// Ensure exit/entry actions didn't call InternalEvent by accident 
 				ASSERT_TRUE(m_eventGenerated == FALSE);
 			}
 
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+			OnTransition(pStateMap[m_currentState].State, state, traceFlags);
+#endif
+
 			// Switch to the new current state
 			SetCurrentState(m_newState);
 
 			// Execute the state action passing in event data
 			ASSERT_TRUE(state != NULL);
-			state->InvokeStateAction(this, pDataTemp);
+			STATE_ACTION(m_currentState, ACTION_STATE, pDataTemp, state->InvokeStateAction(this, pDataTemp));
 		}
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+		else
+			OnTransition(pStateMap[m_currentState].State, state, traceFlags | StateMachineTrace::TRACE_GUARD_REJECTED);
+		traceFlags = 0;
+#endif
 
-		// If event data was used, then delete it
+		// If event data was used, then release it
 #if EXTERNAL_EVENT_NO_HEAP_DATA
 		if (pDataTemp)
 		{
 			if (!externalEvent)
-				delete pDataTemp;
+				pDataTemp->Release();
 			pDataTemp = NULL;
 		}
 		externalEvent = FALSE;
 #else
 		if (pDataTemp)
 		{
-			delete pDataTemp;
+			if (pDataTemp != m_pSharedData)
+				pDataTemp->Release();
 			pDataTemp = NULL;
 		}
 #endif
 	}
 }
 
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+//----------------------------------------------------------------------------
+// OnIgnored
+//----------------------------------------------------------------------------
+void StateMachine::OnIgnored()
+{
+	// Transition map coverage counts ignored events by cell
+#if defined(STATE_MACHINE_TRACE) || defined(STATE_MACHINE_TIMELINE)
+	const CHAR* name = GetStateName(m_currentState);
+#endif
+#ifdef STATE_MACHINE_TRACE
+	StateMachineTrace::Record(this, typeid(*this).name(), m_currentState, name, 
+		EVENT_IGNORED, NULL, StateMachineTrace::TRACE_EXTERNAL | StateMachineTrace::TRACE_IGNORED);
+#endif
+#ifdef STATE_MACHINE_TIMELINE
+	StateTimeline::Record(StateTimeline::EVENT_IGNORED, this, typeid(*this).name(), m_currentState, name);
+#endif
+}
+#endif
+
+//----------------------------------------------------------------------------
+// GetStateName
+//----------------------------------------------------------------------------
+const CHAR* StateMachine::GetStateName(BYTE state)
+{
+	if (state >= MAX_STATES)
+		return NULL;
+
+	const StateBase* stateBase = NULL;
+	const StateMapRow* pStateMap = GetStateMap();
+	const StateMapRowEx* pStateMapEx = NULL;
+	const HsmStateMap* pStateMapHsm = NULL;
+	if (pStateMap != NULL)
+		stateBase = pStateMap[state].State;
+	else if ((pStateMapEx = GetStateMapEx()) != NULL)
+		stateBase = pStateMapEx[state].State;
+	else if ((pStateMapHsm = GetStateMapHsm()) != NULL)
+	{
+		// A superstate row is named without a state object
+		const StateMapRowHsm& row = pStateMapHsm->GetRows()[state];
+		if (row.State == NULL)
+			return row.Name;
+		stateBase = row.State;
+	}
+	return stateBase != NULL ? stateBase->GetName() : NULL;
+}
+
+//----------------------------------------------------------------------------
+// GetParentTransition
+//----------------------------------------------------------------------------
+BYTE StateMachine::GetParentTransition(const BYTE* transitions)
+{
+	// Only a hierarchical state map has parent states
+	const HsmStateMap* pStateMapHsm = GetStateMapHsm();
+	ASSERT_TRUE(pStateMapHsm != NULL);
+
+	BYTE state = m_currentState;
+	while (transitions[state] == EVENT_PARENT)
+	{
+		state = pStateMapHsm->GetRows()[state].Parent;
+		ASSERT_TRUE(state != NO_PARENT);
+	}
+	return transitions[state];
+}
+
+//----------------------------------------------------------------------------
+// HsmStateMap
+//----------------------------------------------------------------------------
+HsmStateMap::HsmStateMap(const StateMapRowHsm* rows, BYTE states) :
+	m_rows(rows),
+	m_states(states),
+	m_pathLength(0)
+{
+	m_depth = new BYTE[states];
+
+	// Depth of each state. A parent chain longer than the number of states is a cycle.
+	for (INT state = 0; state < states; state++)
+	{
+		INT depth = 0;
+		for (BYTE parent = rows[state].Parent; parent != StateMachine::NO_PARENT; parent = rows[parent].Parent)
+		{
+			ASSERT_TRUE(parent < states);
+			ASSERT_TRUE(++depth < states);
+		}
+		m_depth[state] = (BYTE)depth;
+		if (depth + 1 > m_pathLength)
+			m_pathLength = depth + 1;
+	}
+
+	// Path from the top level ancestor down to each state
+	m_paths = new BYTE[states * m_pathLength];
+	for (INT state = 0; state < states; state++)
+	{
+		BYTE* path = &m_paths[state * m_pathLength];
+		BYTE ancestor = (BYTE)state;
+		for (INT depth = m_depth[state]; depth >= 0; depth--)
+		{
+			path[depth] = ancestor;
+			ancestor = rows[ancestor].Parent;
+		}
+	}
 
+	// Shared path length of every state pair
+	m_shared = new BYTE[states * states];
+	for (INT source = 0; source < states; source++)
+	{
+		const BYTE* sourcePath = &m_paths[source * m_pathLength];
+		for (INT target = 0; target < states; target++)
+		{
+			const BYTE* targetPath = &m_paths[target * m_pathLength];
+			INT shared = 0;
+			while (shared <= m_depth[source] && shared <= m_depth[target] && 
+				sourcePath[shared] == targetPath[shared])
+				shared++;
+			m_shared[source * states + target] = (BYTE)shared;
+		}
+	}
+}
 
+//----------------------------------------------------------------------------
+// ~HsmStateMap
+//----------------------------------------------------------------------------
+HsmStateMap::~HsmStateMap()
+{
+	delete[] m_depth;
+	delete[] m_paths;
+	delete[] m_shared;
+}
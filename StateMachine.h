@@ -5,10 +5,30 @@
 #include <stdio.h>
 #include <typeinfo>
 #include "Fault.h"
+// Transition hooks are compiled when any transition instrumentation is enabled
+#if defined(STATE_MACHINE_TRACE) || defined(STATE_MACHINE_TIMELINE) || defined(STATE_MACHINE_COVERAGE)
+#define STATE_MACHINE_TRANSITION_HOOKS
+#include "StateMachineTrace.h"
+#endif
+#ifdef STATE_MACHINE_COVERAGE
+#include "TransitionCoverage.h"
+#endif
+#ifdef STATE_MACHINE_TIMELINE
+#include "StateTimeline.h"
+#endif
+// Action hooks are compiled when any action instrumentation is enabled
+#if defined(STATE_MACHINE_LATENCY) || defined(STATE_MACHINE_WATCHDOG)
+#define STATE_MACHINE_ACTION_HOOKS
+#include "StateLatency.h"
+#endif
+#ifdef STATE_MACHINE_WATCHDOG
+#include "StateWatchdog.h"
+#endif
 
 // If EXTERNAL_EVENT_NO_HEAP_DATA is defined it changes how a client sends data to the
 // state machine. When undefined, the ExternalEvent() pData argument must be created on the heap. 
-// The state machine will automatically delete the EventData pointer during state execution. 
+// The state machine will automatically release the EventData pointer with EventData::Release()
+// during state execution. 
 // When defined, clients must not heap allocate EventData with operator new. InternalEvent() 
 // used inside the state machine always heap allocates event data. 
 //#define EXTERNAL_EVENT_NO_HEAP_DATA 1
@@ -19,29 +39,63 @@
 // Uncomment the include below the XALLOCATOR line to use the xallocator instead 
 // of the global heap. Any EventData, or derived class thereof, created with 
 // new/delete will be routed to the xallocator. See xallocator.h for more info. 
+// Alternatively define EVENT_DATA_XALLOCATOR, normally from the build (see the
+// EVENT_DATA_XALLOCATOR CMake option).
 //#include "xallocator.h"
+#ifdef EVENT_DATA_XALLOCATOR
+#include "xallocator.h"
+#endif
 
 /// @beief Unique state machine event data must inherit from this class.
 class EventData
 {
 public:
 	virtual ~EventData() {}
+
+	/// Called by the state engine when it is done with heap event data. The 
+	/// default deletes the event data. Override to return event data obtained 
+	/// elsewhere, such as from an ObjectPool owning its allocator, to its source.
+	virtual void Release() const { delete this; }
+#ifdef EVENT_DATA_XALLOCATOR
+	XALLOCATOR
+#else
 	//XALLOCATOR
+#endif
 };
 
 typedef EventData NoEventData;
 
 class StateMachine;
+class TimerWheel;
+class WheelTimer;
+class WaitCondition;
+class WaitValue;
+struct StateWaits;
+
+#ifdef STATE_MACHINE_COROUTINES
+class StateAwait;
+#endif
 
 /// @brief Abstract state base class that all states inherit from.
 class StateBase
 {
 public:
+	/// Constructor.
+	/// @param[in] name - the state name, a static string set by STATE_DECLARE, or NULL.
+	StateBase(const CHAR* name = NULL) : m_name(name) {}
+
 	/// Called by the state machine engine to execute a state action. If a guard condition
 	/// exists and it evaluates to false, the state action will not execute. 
 	/// @param[in] sm - A state machine instance. 
 	/// @param[in] data - The event data. 
 	virtual void InvokeStateAction(StateMachine* sm, const EventData* data) const = 0;
+
+	/// Gets the state name used by the state machine instrumentation.
+	/// @return The name or NULL if unnamed.
+	const CHAR* GetName() const { return m_name; }
+
+private:
+	const CHAR* const m_name;
 };
 
 /// @brief StateAction takes three template arguments: A state machine class,
@@ -51,6 +105,8 @@ template <class SM, class Data, void (SM::*Func)(const Data*)>
 class StateAction : public StateBase
 {
 public:
+	StateAction(const CHAR* name = NULL) : StateBase(name) {}
+
 	/// @see StateBase::InvokeStateAction
 	virtual void InvokeStateAction(StateMachine* sm, const EventData* data) const 
 	{
@@ -173,17 +229,80 @@ struct StateMapRowEx
 	const ExitBase* const Exit;
 };
 
+/// @brief A structure to hold a single row within the hierarchical state map. 
+/// A superstate row has no state object, only a name.
+struct StateMapRowHsm
+{
+	const StateBase* const State;
+	const GuardBase* const Guard;
+	const EntryBase* const Entry;
+	const ExitBase* const Exit;
+	const BYTE Parent;
+	const CHAR* const Name;
+};
+
+/// @brief A hierarchical state map with every transition path computed up front. 
+/// The path from the root to each state is stored in a flat array, along with the
+/// length of the path shared by each (source, target) pair, which is the least 
+/// common ancestor depth plus one. A transition exits the source path back to the
+/// shared part then enters the target path, two fixed loops with no search.
+class HsmStateMap
+{
+public:
+	/// Constructor. Computes the tables from the state map rows.
+	/// @param[in] rows - the state map rows.
+	/// @param[in] states - the number of rows.
+	HsmStateMap(const StateMapRowHsm* rows, BYTE states);
+
+	~HsmStateMap();
+
+	/// Gets the state map rows.
+	/// @return The array of rows.
+	const StateMapRowHsm* GetRows() const { return m_rows; }
+
+	/// Gets the depth of a state within the hierarchy. Top level states are 0. 
+	/// @param[in] state - the state.
+	/// @return The depth.
+	INT GetDepth(BYTE state) const { return m_depth[state]; }
+
+	/// Gets the path from the top level ancestor to a state, inclusive. 
+	/// @param[in] state - the state.
+	/// @return GetDepth(state) + 1 states.
+	const BYTE* GetPath(BYTE state) const { return &m_paths[state * m_pathLength]; }
+
+	/// Gets the number of leading states the source and target paths share. 
+	/// @param[in] source - the state being left.
+	/// @param[in] target - the state being entered.
+	/// @return The shared path length. States at this depth and deeper are exited
+	/// or entered. 
+	INT GetSharedLength(BYTE source, BYTE target) const { return m_shared[source * m_states + target]; }
+
+private:
+	HsmStateMap(const HsmStateMap&);
+	HsmStateMap& operator=(const HsmStateMap&);
+
+	const StateMapRowHsm* const m_rows;
+	const BYTE m_states;
+	INT m_pathLength;
+	BYTE* m_depth;
+	BYTE* m_paths;
+	BYTE* m_shared;
+};
+
 /// @brief StateMachine implements a software-based state machine. 
 class StateMachine 
 {
 public:
-	enum { EVENT_IGNORED = 0xFE, CANNOT_HAPPEN };
+	enum { EVENT_PARENT = 0xFD, EVENT_IGNORED, CANNOT_HAPPEN };
+
+	/// The parent of a top level state in a hierarchical state map.
+	enum { NO_PARENT = 0xFF };
 
 	///	Constructor.
 	///	@param[in] maxStates - the maximum number of state machine states.
 	StateMachine(BYTE maxStates, BYTE initialState = 0);
 
-	virtual ~StateMachine() {}
+	virtual ~StateMachine();
 
 	/// Gets the current state machine state.
 	/// @return Current state machine state.
@@ -192,6 +311,11 @@ public:
 	/// Gets the maximum number of state machine states.
 	/// @return The maximum state machine states. 
 	BYTE GetMaxStates() { return MAX_STATES; }
+
+	/// Gets a state name from the state map. 
+	/// @param[in] state - the state.
+	/// @return The name given by STATE_DECLARE or NULL if unnamed.
+	const CHAR* GetStateName(BYTE state);
 	
 protected:
 	/// External state machine event.
@@ -199,11 +323,101 @@ protected:
 	/// @param[in] pData - the event data sent to the state.
 	void ExternalEvent(BYTE newState, const EventData* pData = NULL);
 
+	/// Gets the transition for the current state from a transition map. With a 
+	/// hierarchical state map, an EVENT_PARENT entry defers to the entry of the 
+	/// nearest ancestor state that has one. 
+	/// @param[in] transitions - the transition map, indexed by state.
+	/// @return The state to transition to, EVENT_IGNORED or CANNOT_HAPPEN.
+	BYTE GetTransition(const BYTE* transitions)
+	{
+		BYTE transition = transitions[m_currentState];
+		return transition != EVENT_PARENT ? transition : GetParentTransition(transitions);
+	}
+
 	/// Internal state machine event. These events are generated while executing
 	///	within a state machine state.
 	/// @param[in] newState - the state machine state to transition to.
 	/// @param[in] pData - the event data sent to the state.
 	void InternalEvent(BYTE newState, const EventData* pData = NULL);
+
+	/// Mark external event data as owned by the caller, such as an 
+	/// OrthogonalStateMachine sharing one event across its regions. The state 
+	/// engine then doesn't delete it. 
+	/// @param[in] pData - the shared event data, or NULL once the event completes.
+	void SetSharedEventData(const EventData* pData) { m_pSharedData = pData; }
+
+#ifdef STATE_MACHINE_COVERAGE
+	/// Gets the transition counters of this state machine class.
+	/// @return The class counters.
+	TransitionCoverage* GetCoverage()
+	{
+		if (m_pCoverage == NULL)
+			m_pCoverage = TransitionCoverage::Find(this);
+		return m_pCoverage;
+	}
+
+	/// External event sent by a transition map, counted in a coverage cell. 
+	/// Called by END_TRANSITION_MAP.
+	/// @param[in] cell - the transition map cell of the current state.
+	/// @param[in] newState - the state machine state to transition to.
+	/// @param[in] pData - the event data sent to the state.
+	void CoveredExternalEvent(TransitionCoverage::Cell* cell, BYTE newState, const EventData* pData)
+	{
+		m_pCoverageCell = cell;
+		ExternalEvent(newState, pData);
+		m_pCoverageCell = NULL;
+	}
+#endif
+
+	/// Arm the state timer, typically from an entry action or state function. The
+	/// timer is cancelled automatically when the state machine transitions to a 
+	/// different state, so only the state that armed it sees the timeout. 
+	/// @param[in] wheel - the timer wheel driving this state machine.
+	/// @param[in] ticks - the wheel ticks until StateTimeout() is called.
+	void StartStateTimer(TimerWheel& wheel, UINT64 ticks);
+
+	/// Cancel the state timer, if armed.
+	void StopStateTimer();
+
+	/// External event generated when the state timer expires. Override with a 
+	/// transition map to handle timeouts. Called from TimerWheel::Advance().
+	virtual void StateTimeout() {}
+
+	/// Park the state machine on a condition until it fires, then transition to 
+	/// wakeState with an external event. Call from a state function. Leaving the 
+	/// current state by any other route unparks the machine. Parking again replaces 
+	/// the previous condition. 
+	/// @param[in] condition - the condition to wait on.
+	/// @param[in] wakeState - the state machine state to transition to.
+	void WaitFor(WaitCondition& condition, BYTE wakeState);
+
+	/// Park the state machine until a value compares true against a threshold. If
+	/// it already does, the machine transitions at once with an internal event.
+	/// @param[in] value - the value to wait on.
+	/// @param[in] compare - the WaitValue::Compare of the value with the threshold. 
+	/// @param[in] threshold - the threshold.
+	/// @param[in] wakeState - the state machine state to transition to.
+	void WaitFor(WaitValue& value, INT compare, INT64 threshold, BYTE wakeState);
+
+	/// Park the state machine for a number of timer wheel ticks using the state 
+	/// timer. May be combined with a condition wait to bound it with a timeout.
+	/// @param[in] wheel - the timer wheel driving this state machine.
+	/// @param[in] ticks - the wheel ticks to wait.
+	/// @param[in] wakeState - the state machine state to transition to.
+	void WaitFor(TimerWheel& wheel, UINT64 ticks, BYTE wakeState);
+
+	/// Unpark the state machine from its condition, if any.
+	void CancelWait();
+
+#ifdef STATE_MACHINE_COROUTINES
+	/// Awaitables for coroutine states. See CoroutineState.h. Each suspends the
+	/// coroutine until the current state is re-entered and returns the event data.
+	/// NextEvent() waits for the next event into this state, Delay() for the given
+	/// timer wheel ticks and WaitUntil() for a value to compare true.
+	StateAwait NextEvent();
+	StateAwait Delay(TimerWheel& wheel, UINT64 ticks);
+	StateAwait WaitUntil(WaitValue& value, INT compare, INT64 threshold);
+#endif
 	
 private:
 	/// The maximum number of state machine states.
@@ -221,6 +435,149 @@ private:
 	/// The state event data pointer.
 	const EventData* m_pEventData;
 
+	/// Event data the state engine must not delete. See SetSharedEventData().
+	const EventData* m_pSharedData;
+
+	/// The state timer and wait condition link, allocated by the first timer or
+	/// wait so state machines using neither carry one pointer for them. 
+	StateWaits* m_pWaits;
+
+	/// Gets the state timer and wait condition link, allocating them on first use.
+	/// @return The timer and wait state of this machine.
+	StateWaits& GetWaits();
+
+	/// WheelTimerCallback for the state timer.
+	static void StateTimerExpired(WheelTimer* timer, void* context);
+
+	/// Called by WaitCondition when the condition fires.
+	friend class WaitCondition;
+	void Wake();
+
+#ifdef STATE_MACHINE_COROUTINES
+	/// The suspended coroutine of the current state, if any.
+	void* m_pCoroutine;
+	friend class CoroutineStateBase;
+	void DestroyCoroutine();
+#endif
+
+#ifdef STATE_MACHINE_TRANSITION_HOOKS
+	/// Pass a transition from the current state to m_newState, or a guard 
+	/// rejecting it, to the enabled transition instrumentation.
+	/// @param[in] source - the current state object.
+	/// @param[in] target - the new state object.
+	/// @param[in] flags - StateMachineTrace::Flags describing the transition.
+	void OnTransition(const StateBase* source, const StateBase* target, BYTE flags)
+	{
+#if defined(STATE_MACHINE_TRACE) || defined(STATE_MACHINE_TIMELINE)
+		const CHAR* targetName = target != NULL ? target->GetName() : NULL;
+#else
+		(void)target;
+#endif
+#ifdef STATE_MACHINE_TRACE
+		StateMachineTrace::Record(this, typeid(*this).name(), m_currentState, 
+			source != NULL ? source->GetName() : NULL, m_newState, targetName, flags);
+#else
+		(void)source;
+#endif
+#ifdef STATE_MACHINE_TIMELINE
+		StateTimeline::Record((flags & StateMachineTrace::TRACE_GUARD_REJECTED) ? 
+			StateTimeline::EVENT_GUARD_REJECTED : StateTimeline::EVENT_STATE, 
+			this, typeid(*this).name(), m_newState, targetName);
+#endif
+#ifdef STATE_MACHINE_COVERAGE
+		GetCoverage()->Transition(m_pCoverageCell, m_currentState, m_newState, 
+			(flags & StateMachineTrace::TRACE_EXTERNAL) != 0, 
+			(flags & StateMachineTrace::TRACE_GUARD_REJECTED) != 0);
+#endif
+	}
+
+	/// Pass an external event ignored in the current state to the enabled 
+	/// transition instrumentation.
+	void OnIgnored();
+#endif
+
+#ifdef STATE_MACHINE_COVERAGE
+	/// The transition counters of this state machine class and the transition 
+	/// map cell of the external event being run, if any.
+	TransitionCoverage* m_pCoverage;
+	TransitionCoverage::Cell* m_pCoverageCell;
+#endif
+
+#ifdef STATE_MACHINE_ACTION_HOOKS
+#ifdef STATE_MACHINE_LATENCY
+	/// The action latency record of this state machine class.
+	StateLatency* m_pLatency;
+#endif
+#ifdef STATE_MACHINE_WATCHDOG
+	/// The action watchdog of this state machine class.
+	StateWatchdog* m_pWatchdog;
+#endif
+
+	/// Find the action instrumentation records of this class on first use.
+	/// @param[in] stateMap - the state map in use.
+	void InitActionHooks(const void* stateMap)
+	{
+#ifdef STATE_MACHINE_LATENCY
+		if (m_pLatency == NULL)
+			m_pLatency = StateLatency::Find(stateMap, this);
+#else
+		(void)stateMap;
+#endif
+#ifdef STATE_MACHINE_WATCHDOG
+		if (m_pWatchdog == NULL)
+			m_pWatchdog = StateWatchdog::Find(this);
+#endif
+	}
+
+	/// Called by the state engine before running an action.
+	/// @param[in] state - the state the action belongs to.
+	/// @param[in] action - the StateLatency::Action kind.
+	/// @param[in] data - the event data passed to the action.
+	/// @return The action start time in TraceClock ticks.
+	UINT64 BeginAction(BYTE state, StateLatency::Action action, const EventData* data)
+	{
+		UINT64 start = TraceClock::Now();
+#ifdef STATE_MACHINE_WATCHDOG
+		m_pWatchdog->Enter(this, state, action, data, start);
+#else
+		(void)state; (void)action; (void)data;
+#endif
+		return start;
+	}
+
+	/// Called by the state engine after an action returns.
+	/// @param[in] state - the state the action belongs to.
+	/// @param[in] action - the StateLatency::Action kind.
+	/// @param[in] data - the event data passed to the action.
+	/// @param[in] start - the start time returned by BeginAction().
+	void EndAction(BYTE state, StateLatency::Action action, const EventData* data, UINT64 start)
+	{
+		UINT64 ticks = TraceClock::Now() - start;
+#ifdef STATE_MACHINE_LATENCY
+		m_pLatency->Record(state, action, ticks);
+#endif
+#ifdef STATE_MACHINE_WATCHDOG
+		m_pWatchdog->Leave(this, state, action, data, ticks);
+#else
+		(void)data;
+#endif
+	}
+#endif
+
+	/// Cancel the state timer, any wait and any coroutine when leaving the current
+	/// state.
+	void LeaveState() 
+	{ 
+		if (m_pWaits != NULL)
+		{
+			StopStateTimer(); 
+			CancelWait(); 
+		}
+#ifdef STATE_MACHINE_COROUTINES
+		DestroyCoroutine();
+#endif
+	}
+
 	/// Gets the state map as defined in the derived class. The BEGIN_STATE_MAP,
 	/// STATE_MAP_ENTRY and END_STATE_MAP macros are used to assist in creating the
 	/// map. A state machine only needs to return a state map using either GetStateMap()  
@@ -237,6 +594,17 @@ private:
 	/// NULL if the state machine uses the GetStateMap().
 	virtual const StateMapRowEx* GetStateMapEx() = 0;
 
+	/// Gets the hierarchical state map as defined in the derived class. The 
+	/// BEGIN_STATE_MAP_HSM, STATE_MAP_ENTRY_HSM, STATE_MAP_ENTRY_ALL_HSM, 
+	/// SUPERSTATE_MAP_ENTRY_HSM and END_STATE_MAP_HSM macros are used to assist in
+	/// creating the map. 
+	/// @return The hierarchical state map or NULL if the state machine uses 
+	/// GetStateMap() or GetStateMapEx().
+	virtual const HsmStateMap* GetStateMapHsm() { return NULL; }
+
+	/// Resolves EVENT_PARENT transition map entries. 
+	BYTE GetParentTransition(const BYTE* transitions);
+
 	/// Set a new current state.
 	/// @param[in] newState - the new state.
 	void SetCurrentState(BYTE newState) { m_currentState = newState; }
@@ -246,11 +614,12 @@ private:
 	void StateEngine(void); 	
 	void StateEngine(const StateMapRow* const pStateMap);
 	void StateEngine(const StateMapRowEx* const pStateMapEx);
+	void StateEngine(const HsmStateMap* const pStateMapHsm);
 };
 
 #define STATE_DECLARE(stateMachine, stateName, eventData) \
 	void ST_##stateName(const eventData*); \
-	StateAction<stateMachine, eventData, &stateMachine::ST_##stateName> stateName;
+	StateAction<stateMachine, eventData, &stateMachine::ST_##stateName> stateName{#stateName};
 	
 #define STATE_DEFINE(stateMachine, stateName, eventData) \
 	void stateMachine::ST_##stateName(const eventData* data)
@@ -282,11 +651,24 @@ private:
 #define TRANSITION_MAP_ENTRY(entry)\
     entry,
 
+#ifdef STATE_MACHINE_COVERAGE
+#define END_TRANSITION_MAP(data) \
+    };\
+	ASSERT_TRUE(GetCurrentState() < ST_MAX_STATES); \
+	{ \
+		TransitionCoverage::EventRow* coverage = \
+			GetCoverage()->GetRow(__func__, TRANSITIONS, ST_MAX_STATES); \
+		BYTE transition = GetTransition(TRANSITIONS); \
+		CoveredExternalEvent(coverage->Hit(GetCurrentState(), transition), transition, data); \
+	} \
+	C_ASSERT((sizeof(TRANSITIONS)/sizeof(BYTE)) == ST_MAX_STATES); 
+#else
 #define END_TRANSITION_MAP(data) \
     };\
 	ASSERT_TRUE(GetCurrentState() < ST_MAX_STATES); \
-    ExternalEvent(TRANSITIONS[GetCurrentState()], data); \
+    ExternalEvent(GetTransition(TRANSITIONS), data); \
 	C_ASSERT((sizeof(TRANSITIONS)/sizeof(BYTE)) == ST_MAX_STATES); 
+#endif
 
 #define PARENT_TRANSITION(state) \
 	if (GetCurrentState() >= ST_MAX_STATES && \
@@ -325,4 +707,26 @@ private:
 	C_ASSERT((sizeof(STATE_MAP)/sizeof(StateMapRowEx)) == ST_MAX_STATES); \
    return &STATE_MAP[0]; }
 
+#define BEGIN_STATE_MAP_HSM \
+	private:\
+	virtual const StateMapRow* GetStateMap() { return NULL; }\
+	virtual const StateMapRowEx* GetStateMapEx() { return NULL; }\
+	virtual const HsmStateMap* GetStateMapHsm() {\
+		static const StateMapRowHsm STATE_MAP[] = { 
+
+#define STATE_MAP_ENTRY_HSM(stateName, parentState)\
+	{ stateName, 0, 0, 0, parentState, NULL },
+
+#define STATE_MAP_ENTRY_ALL_HSM(stateName, parentState, guardName, entryName, exitName)\
+	{ stateName, guardName, entryName, exitName, parentState, NULL },
+
+#define SUPERSTATE_MAP_ENTRY_HSM(superstateName, parentState, entryName, exitName)\
+	{ 0, 0, entryName, exitName, parentState, #superstateName },
+
+#define END_STATE_MAP_HSM \
+    }; \
+	C_ASSERT((sizeof(STATE_MAP)/sizeof(StateMapRowHsm)) == ST_MAX_STATES); \
+	static const HsmStateMap HSM_STATE_MAP(STATE_MAP, ST_MAX_STATES); \
+	return &HSM_STATE_MAP; }
+
 #endif // _STATE_MACHINE_H
@@ -0,0 +1,279 @@
+#include "StateMachineTrace.h"
+#include "Fault.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+// Dump file layout, in host byte order:
+//
+//     header   "SMTR", UINT32 version, UINT64 ticks per second,
+//              UINT32 string count, UINT32 record count
+//     strings  UINT16 length, characters (no terminator)
+//     records  UINT64 timestamp, UINT32 machine number, UINT16 thread number,
+//              UINT16 machine name, UINT16 source name, UINT16 target name,
+//              BYTE source, BYTE target, BYTE flags, BYTE reserved
+//
+// Names are string table indexes, NO_NAME if unknown. Machine numbers are given
+// to state machine instances in order of first appearance.
+static const CHAR MAGIC[4] = { 'S', 'M', 'T', 'R' };
+static const UINT32 VERSION = 1;
+static const UINT16 NO_NAME = 0xFFFF;
+
+static std::mutex _buffersLock;
+static UINT32 _threads = 0;
+
+//------------------------------------------------------------------------------
+// Write
+//------------------------------------------------------------------------------
+template <class T>
+static void Write(FILE* fp, T value)
+{
+	fwrite(&value, sizeof(value), 1, fp);
+}
+
+//------------------------------------------------------------------------------
+// Read
+//------------------------------------------------------------------------------
+template <class T>
+static BOOL Read(FILE* fp, T& value)
+{
+	return fread(&value, sizeof(value), 1, fp) == 1;
+}
+
+//------------------------------------------------------------------------------
+// Demangle
+//------------------------------------------------------------------------------
+static std::string Demangle(const CHAR* name)
+{
+#if defined(__GNUG__)
+	INT status = 0;
+	CHAR* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+	if (status == 0 && demangled != NULL)
+	{
+		std::string result(demangled);
+		free(demangled);
+		return result;
+	}
+#endif
+	return std::string(name);
+}
+
+//------------------------------------------------------------------------------
+// CreateBuffer
+//------------------------------------------------------------------------------
+StateMachineTrace::Buffer* StateMachineTrace::CreateBuffer()
+{
+	C_ASSERT((STATE_MACHINE_TRACE_RECORDS & (STATE_MACHINE_TRACE_RECORDS - 1)) == 0);
+
+	Buffer* buffer = new Buffer();
+	buffer->head.store(0, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(_buffersLock);
+	buffer->thread = _threads++;
+	buffer->next = m_pBuffers;
+	m_pBuffers = buffer;
+	m_pBuffer = buffer;
+	return buffer;
+}
+
+//------------------------------------------------------------------------------
+// Dump
+//------------------------------------------------------------------------------
+INT StateMachineTrace::Dump(FILE* fp)
+{
+	struct Copy
+	{
+		TraceRecord record;
+		UINT32 thread;
+	};
+	std::vector<Copy> copies;
+
+	{
+		std::lock_guard<std::mutex> lock(_buffersLock);
+		for (Buffer* buffer = m_pBuffers; buffer != NULL; buffer = buffer->next)
+		{
+			UINT64 head = buffer->head.load(std::memory_order_acquire);
+			UINT64 first = head > STATE_MACHINE_TRACE_RECORDS ? head - STATE_MACHINE_TRACE_RECORDS : 0;
+			size_t start = copies.size();
+			for (UINT64 i = first; i < head; i++)
+			{
+				Copy copy;
+				copy.record = buffer->records[i & (STATE_MACHINE_TRACE_RECORDS - 1)];
+				copy.thread = buffer->thread;
+				copies.push_back(copy);
+			}
+
+			// Drop the records the owning thread may have overwritten meanwhile,
+			// including the one it could be writing now
+			std::atomic_thread_fence(std::memory_order_acquire);
+			UINT64 newHead = buffer->head.load(std::memory_order_relaxed);
+			if (newHead + 1 > first + STATE_MACHINE_TRACE_RECORDS)
+			{
+				UINT64 overwritten = std::min(newHead + 1 - STATE_MACHINE_TRACE_RECORDS - first, head - first);
+				copies.erase(copies.begin() + start, copies.begin() + start + (size_t)overwritten);
+			}
+		}
+	}
+
+	std::stable_sort(copies.begin(), copies.end(),
+		[](const Copy& a, const Copy& b) { return a.record.timestamp < b.record.timestamp; });
+
+	// Build the string table, merging equal names held at different addresses
+	std::vector<std::string> strings;
+	std::map<std::string, UINT16> stringIndex;
+	std::map<const CHAR*, UINT16> nameIndex;
+	std::map<const void*, UINT32> machineIndex;
+	auto intern = [&](const CHAR* name, BOOL demangle) -> UINT16
+	{
+		if (name == NULL)
+			return NO_NAME;
+		auto found = nameIndex.find(name);
+		if (found != nameIndex.end())
+			return found->second;
+		std::string text = demangle ? Demangle(name) : std::string(name);
+		auto interned = stringIndex.find(text);
+		UINT16 index;
+		if (interned != stringIndex.end())
+			index = interned->second;
+		else if (strings.size() < NO_NAME)
+		{
+			index = (UINT16)strings.size();
+			strings.push_back(text);
+			stringIndex[text] = index;
+		}
+		else
+			index = NO_NAME;
+		nameIndex[name] = index;
+		return index;
+	};
+
+	struct Indexes
+	{
+		UINT32 machine;
+		UINT16 machineName;
+		UINT16 sourceName;
+		UINT16 targetName;
+	};
+	std::vector<Indexes> indexes(copies.size());
+	for (size_t i = 0; i < copies.size(); i++)
+	{
+		const TraceRecord& record = copies[i].record;
+		auto machine = machineIndex.find(record.machine);
+		if (machine == machineIndex.end())
+			machine = machineIndex.insert(std::make_pair(record.machine, (UINT32)machineIndex.size())).first;
+		indexes[i].machine = machine->second;
+		indexes[i].machineName = intern(record.machineName, TRUE);
+		indexes[i].sourceName = intern(record.sourceName, FALSE);
+		indexes[i].targetName = intern(record.targetName, FALSE);
+	}
+
+	fwrite(MAGIC, sizeof(MAGIC), 1, fp);
+	Write(fp, VERSION);
+	Write(fp, TraceClock::GetTicksPerSecond());
+	Write(fp, (UINT32)strings.size());
+	Write(fp, (UINT32)copies.size());
+	for (size_t i = 0; i < strings.size(); i++)
+	{
+		UINT16 length = (UINT16)std::min(strings[i].size(), (size_t)0xFFFF);
+		Write(fp, length);
+		fwrite(strings[i].data(), 1, length, fp);
+	}
+	for (size_t i = 0; i < copies.size(); i++)
+	{
+		const TraceRecord& record = copies[i].record;
+		Write(fp, record.timestamp);
+		Write(fp, indexes[i].machine);
+		Write(fp, (UINT16)copies[i].thread);
+		Write(fp, indexes[i].machineName);
+		Write(fp, indexes[i].sourceName);
+		Write(fp, indexes[i].targetName);
+		Write(fp, record.source);
+		Write(fp, record.target);
+		Write(fp, record.flags);
+		Write(fp, (BYTE)0);
+	}
+	return (INT)copies.size();
+}
+
+//------------------------------------------------------------------------------
+// Decode
+//------------------------------------------------------------------------------
+INT StateMachineTrace::Decode(FILE* in, FILE* out)
+{
+	CHAR magic[sizeof(MAGIC)];
+	UINT32 version, stringCount, recordCount;
+	UINT64 ticksPerSecond;
+	if (fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+		return -1;
+	if (!Read(in, version) || version != VERSION || !Read(in, ticksPerSecond) ||
+		!Read(in, stringCount) || !Read(in, recordCount) || ticksPerSecond == 0)
+		return -1;
+
+	std::vector<std::string> strings;
+	for (UINT32 i = 0; i < stringCount; i++)
+	{
+		UINT16 length;
+		if (!Read(in, length))
+			return -1;
+		std::string text(length, '\0');
+		if (length != 0 && fread(&text[0], 1, length, in) != length)
+			return -1;
+		strings.push_back(text);
+	}
+
+	auto name = [&](UINT16 index) -> const CHAR*
+	{
+		return index < strings.size() ? strings[index].c_str() : "?";
+	};
+
+	fprintf(out, "# %u records, %llu ticks per second\n", recordCount, ticksPerSecond);
+	UINT64 start = 0;
+	for (UINT32 i = 0; i < recordCount; i++)
+	{
+		UINT64 timestamp;
+		UINT32 machine;
+		UINT16 thread, machineName, sourceName, targetName;
+		BYTE source, target, flags, reserved;
+		if (!Read(in, timestamp) || !Read(in, machine) || !Read(in, thread) ||
+			!Read(in, machineName) || !Read(in, sourceName) || !Read(in, targetName) ||
+			!Read(in, source) || !Read(in, target) || !Read(in, flags) || !Read(in, reserved))
+			return -1;
+		if (i == 0)
+			start = timestamp;
+
+		DOUBLE us = (DOUBLE)(timestamp - start) * 1e6 / (DOUBLE)ticksPerSecond;
+		fprintf(out, "%14.3f us  T%-3u %s#%u  %s(%u) -> ", us, thread, name(machineName),
+			machine, sourceName == NO_NAME ? "" : name(sourceName), source);
+		if (flags & TRACE_IGNORED)
+			fprintf(out, "ignored");
+		else
+			fprintf(out, "%s(%u)", targetName == NO_NAME ? "" : name(targetName), target);
+		if (flags & TRACE_EXTERNAL)
+			fprintf(out, "  external");
+		if (flags & TRACE_GUARD)
+			fprintf(out, (flags & TRACE_GUARD_REJECTED) ? "  guard-rejected" : "  guard");
+		if (flags & TRACE_EXIT)
+			fprintf(out, "  exit");
+		if (flags & TRACE_ENTRY)
+			fprintf(out, "  entry");
+		fprintf(out, "\n");
+	}
+	return (INT)recordCount;
+}
+
+//------------------------------------------------------------------------------
+// Clear
+//------------------------------------------------------------------------------
+void StateMachineTrace::Clear()
+{
+	std::lock_guard<std::mutex> lock(_buffersLock);
+	for (Buffer* buffer = m_pBuffers; buffer != NULL; buffer = buffer->next)
+		buffer->head.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,116 @@
+#ifndef _STATE_MACHINE_TRACE_H
+#define _STATE_MACHINE_TRACE_H
+
+#include "TraceClock.h"
+#include <atomic>
+#include <stdio.h>
+
+// Define STATE_MACHINE_TRACE to record every state machine transition into a per
+// thread ring buffer. Normally defined by the build (see the STATE_MACHINE_TRACE
+// CMake option).
+//#define STATE_MACHINE_TRACE
+
+// Records kept per thread. Must be a power of two.
+#ifndef STATE_MACHINE_TRACE_RECORDS
+#define STATE_MACHINE_TRACE_RECORDS 4096
+#endif
+
+/// @brief Transition trace, a flight recorder for state machines. Each state
+/// engine pass records one entry per transition in a fixed size ring buffer
+/// owned by the calling thread, so recording takes no lock and never allocates
+/// after the thread's first transition. The oldest records are overwritten.
+///
+/// Dump() writes the records of every thread to a compact binary file, which
+/// Decode() or the TraceDecode tool turn into text. State names come from the
+/// STATE_DECLARE macros, so states declared without them show as numbers only.
+class StateMachineTrace
+{
+public:
+	/// Record flags
+	enum Flags
+	{
+		TRACE_EXTERNAL = 0x01,			///< First transition of an external event
+		TRACE_GUARD = 0x02,				///< A guard condition ran
+		TRACE_GUARD_REJECTED = 0x04,	///< The guard condition returned FALSE
+		TRACE_EXIT = 0x08,				///< An exit action ran
+		TRACE_ENTRY = 0x10,				///< An entry action ran
+		TRACE_IGNORED = 0x20			///< The event was ignored in the source state
+	};
+
+	/// Record a transition. Called by the state engine.
+	/// @param[in] machine - the state machine.
+	/// @param[in] machineName - the state machine type name, a static string.
+	/// @param[in] source - the current state.
+	/// @param[in] sourceName - the current state name, a static string or NULL.
+	/// @param[in] target - the new state.
+	/// @param[in] targetName - the new state name, a static string or NULL.
+	/// @param[in] flags - Flags describing the transition.
+	static void Record(const void* machine, const CHAR* machineName, BYTE source,
+		const CHAR* sourceName, BYTE target, const CHAR* targetName, BYTE flags)
+	{
+		Buffer* buffer = m_pBuffer;
+		if (buffer == NULL)
+			buffer = CreateBuffer();
+
+		UINT64 head = buffer->head.load(std::memory_order_relaxed);
+		TraceRecord& record = buffer->records[head & (STATE_MACHINE_TRACE_RECORDS - 1)];
+		record.timestamp = TraceClock::Now();
+		record.machine = machine;
+		record.machineName = machineName;
+		record.sourceName = sourceName;
+		record.targetName = targetName;
+		record.source = source;
+		record.target = target;
+		record.flags = flags;
+		buffer->head.store(head + 1, std::memory_order_release);
+	}
+
+	/// Write the records of every thread, oldest first. Safe to call while other
+	/// threads record; a record being overwritten during the dump is skipped.
+	/// @param[in] fp - the binary output file.
+	/// @return The number of records written.
+	static INT Dump(FILE* fp);
+
+	/// Convert a binary dump to text, one line per record.
+	/// @param[in] in - the binary dump.
+	/// @param[in] out - the text output file.
+	/// @return The number of records decoded or -1 if the dump is malformed.
+	static INT Decode(FILE* in, FILE* out);
+
+	/// Discard the records of every thread. Call only while no thread is recording.
+	static void Clear();
+
+private:
+	/// @brief A record as kept in memory. Names point to static strings and are
+	/// only resolved when dumped.
+	struct TraceRecord
+	{
+		UINT64 timestamp;
+		const void* machine;
+		const CHAR* machineName;
+		const CHAR* sourceName;
+		const CHAR* targetName;
+		BYTE source;
+		BYTE target;
+		BYTE flags;
+	};
+
+	/// @brief A thread's ring buffer. Buffers outlive their threads so a dump
+	/// still shows their history.
+	struct Buffer
+	{
+		std::atomic<UINT64> head;	///< Records written so far
+		UINT32 thread;				///< Thread number in creation order
+		Buffer* next;
+		TraceRecord records[STATE_MACHINE_TRACE_RECORDS];
+	};
+
+	/// Create and register the calling thread's buffer.
+	static Buffer* CreateBuffer();
+
+	/// The calling thread's buffer and the list of every thread's buffer
+	static inline thread_local Buffer* m_pBuffer = NULL;
+	static inline Buffer* m_pBuffers = NULL;
+};
+
+#endif
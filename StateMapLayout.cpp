@@ -0,0 +1,147 @@
+#include "StateMapLayout.h"
+#include "StateMachine.h"
+#include <algorithm>
+#include <set>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+// Intern
+//------------------------------------------------------------------------------
+static const CHAR* Intern(const std::string& name)
+{
+	// Profile names live as long as the cells referring to them
+	static std::set<std::string> names;
+	return names.insert(name).first->c_str();
+}
+
+//------------------------------------------------------------------------------
+// ReadProfile
+//------------------------------------------------------------------------------
+BOOL StateMapLayout::ReadProfile(FILE* fp, std::vector<TransitionCoverageCell>* cells)
+{
+	CHAR line[1024];
+	const CHAR* header = TransitionCoverage::PROFILE_HEADER;
+	if (fgets(line, sizeof(line), fp) == NULL || strncmp(line, header, strlen(header)) != 0)
+		return FALSE;
+
+	// Lines are tab separated: machine, event, state, target, hits, state name,
+	// target name. Empty fields are NULL names.
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0')
+			continue;
+
+		std::vector<std::string> fields;
+		const CHAR* field = line;
+		for (;;)
+		{
+			const CHAR* tab = strchr(field, '\t');
+			fields.push_back(tab != NULL ? std::string(field, tab - field) : std::string(field));
+			if (tab == NULL)
+				break;
+			field = tab + 1;
+		}
+		if (fields.size() != 7)
+			return FALSE;
+
+		TransitionCoverageCell cell;
+		cell.machineName = Intern(fields[0]);
+		cell.eventName = fields[1].empty() ? NULL : Intern(fields[1]);
+		cell.state = (BYTE)strtoul(fields[2].c_str(), NULL, 10);
+		cell.target = (BYTE)strtoul(fields[3].c_str(), NULL, 10);
+		cell.hits = strtoull(fields[4].c_str(), NULL, 10);
+		cell.stateName = fields[5].empty() ? NULL : Intern(fields[5]);
+		cell.targetName = fields[6].empty() ? NULL : Intern(fields[6]);
+		cell.resolved = cell.target;
+		cell.resolvedName = cell.targetName;
+		cell.ignored = cell.target == StateMachine::EVENT_IGNORED ? cell.hits : 0;
+		cell.rejected = 0;
+		cells->push_back(cell);
+	}
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+// GetHeat
+//------------------------------------------------------------------------------
+void StateMapLayout::GetHeat(const TransitionCoverageCell* cells, INT count,
+	const CHAR* machineName, UINT64* heat)
+{
+	for (INT state = 0; state < 256; state++)
+		heat[state] = 0;
+	for (INT i = 0; i < count; i++)
+	{
+		const TransitionCoverageCell& cell = cells[i];
+		if (strcmp(cell.machineName, machineName) != 0 || cell.hits == 0)
+			continue;
+
+		// An ignored event reads no state map row
+		if (cell.target >= StateMachine::EVENT_PARENT)
+			continue;
+		heat[cell.state] += cell.hits;
+		heat[cell.target] += cell.hits;
+	}
+}
+
+//------------------------------------------------------------------------------
+// GetHotOrder
+//------------------------------------------------------------------------------
+INT StateMapLayout::GetHotOrder(const UINT64* heat, BYTE* order)
+{
+	INT hot = 0;
+	for (INT state = 0; state < 256; state++)
+	{
+		if (heat[state] != 0)
+			order[hot++] = (BYTE)state;
+	}
+	std::stable_sort(order, order + hot, [heat](BYTE a, BYTE b) { return heat[a] > heat[b]; });
+	return hot;
+}
+
+//------------------------------------------------------------------------------
+// MakeSlots
+//------------------------------------------------------------------------------
+void StateMapLayout::MakeSlots(const BYTE* order, INT hot, BYTE* slots)
+{
+	BOOL placed[256] = { FALSE };
+	INT slot = 0;
+	for (INT i = 0; i < hot; i++)
+	{
+		slots[order[i]] = (BYTE)slot++;
+		placed[order[i]] = TRUE;
+	}
+	for (INT state = 0; state < 256; state++)
+	{
+		if (!placed[state])
+			slots[state] = (BYTE)slot++;
+	}
+}
+
+//------------------------------------------------------------------------------
+// CountLines
+//------------------------------------------------------------------------------
+INT StateMapLayout::CountLines(const UINT64* heat, const BYTE* slots, INT rowBytes, DOUBLE fraction)
+{
+	BYTE order[256];
+	INT hot = GetHotOrder(heat, order);
+	UINT64 total = 0;
+	for (INT i = 0; i < hot; i++)
+		total += heat[order[i]];
+
+	// Count the lines of the hottest rows until they cover the fraction
+	std::set<INT> lines;
+	UINT64 covered = 0;
+	for (INT i = 0; i < hot && (DOUBLE)covered < fraction * (DOUBLE)total; i++)
+	{
+		INT row = slots != NULL ? slots[order[i]] : order[i];
+		INT first = row * rowBytes / CACHE_LINE;
+		INT last = (row * rowBytes + rowBytes - 1) / CACHE_LINE;
+		for (INT line = first; line <= last; line++)
+			lines.insert(line);
+		covered += heat[order[i]];
+	}
+	return (INT)lines.size();
+}
@@ -0,0 +1,68 @@
+#ifndef _STATE_MAP_LAYOUT_H
+#define _STATE_MAP_LAYOUT_H
+
+#include "TransitionCoverage.h"
+#include <stdio.h>
+#include <vector>
+
+/// @brief Profile guided state map layout. State map rows are laid out in state
+/// enumeration order, so the states a machine actually spends its time in can be
+/// spread over many cache lines of a large map. Given the transition counts of a
+/// TransitionCoverage profile, a layout orders the states of a class by heat,
+/// the number of times the engine reads each state's row.
+///
+/// The StateLayout tool prints the hot order of each class. Reorder the state 
+/// enumeration, the state map and the transition maps to match, and the hot rows,
+/// transition map cells and state objects become contiguous with no runtime cost.
+/// Running from a packed copy of the rows instead was measured slower: the row 
+/// indirection costs more cache misses than it saves and the state objects stay 
+/// spread out.
+class StateMapLayout
+{
+public:
+	/// Read a profile written by TransitionCoverage::WriteProfile().
+	/// @param[in] fp - the profile.
+	/// @param[out] cells - receives the profile cells. The names are allocated
+	///		for the life of the program.
+	/// @return TRUE if the profile was read, FALSE if the format is invalid.
+	static BOOL ReadProfile(FILE* fp, std::vector<TransitionCoverageCell>* cells);
+
+	/// Sum the heat of each state of a class, the reads of its state map row. A
+	/// transition reads the rows of the source and the target state.
+	/// @param[in] cells - the profile cells.
+	/// @param[in] count - the number of cells.
+	/// @param[in] machineName - the state machine class.
+	/// @param[out] heat - receives the heat of each of 256 states.
+	static void GetHeat(const TransitionCoverageCell* cells, INT count,
+		const CHAR* machineName, UINT64* heat);
+
+	/// Order states hottest first. States never read are left out.
+	/// @param[in] heat - the heat of each of 256 states.
+	/// @param[out] order - receives the hot states, hottest first. Ties keep
+	///		state order.
+	/// @return The number of hot states.
+	static INT GetHotOrder(const UINT64* heat, BYTE* order);
+
+	/// Assign rows to states, hot states first and the rest in state order.
+	/// @param[in] order - the hot states, hottest first.
+	/// @param[in] hot - the number of hot states.
+	/// @param[out] slots - receives the row of each of 256 states.
+	static void MakeSlots(const BYTE* order, INT hot, BYTE* slots);
+
+	/// Count the cache lines holding the hottest rows of a layout, a model of the
+	/// cache footprint of the state map.
+	/// @param[in] heat - the heat of each of 256 states.
+	/// @param[in] slots - the row of each state, or NULL for state order.
+	/// @param[in] rowBytes - the size of a row, such as sizeof(StateMapRowEx).
+	/// @param[in] fraction - the share of the total heat the rows counted cover.
+	/// @return The number of cache lines.
+	static INT CountLines(const UINT64* heat, const BYTE* slots, INT rowBytes, DOUBLE fraction);
+
+	/// Size of the cache lines CountLines() models
+	enum { CACHE_LINE = 64 };
+
+private:
+	StateMapLayout();
+};
+
+#endif
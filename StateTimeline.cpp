@@ -0,0 +1,419 @@
+#include "StateTimeline.h"
+#include "Fault.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+// Track process ids: one track per state machine and one per thread
+static const INT MACHINES_PID = 1;
+static const INT THREADS_PID = 2;
+
+/// @brief A state machine track and the state slice still open on it
+struct MachineTrack
+{
+	UINT32 tid;
+	const CHAR* machineName;
+	BOOL open;
+	UINT64 since;
+	BYTE state;
+	const CHAR* stateName;
+};
+
+/// @brief An external event being processed on a thread
+struct ExternalPass
+{
+	UINT64 begin;
+	const void* machine;
+	const CHAR* machineName;
+	UINT32 transitions;
+};
+
+/// @brief A buffered event with the thread that recorded it
+struct FlushEvent
+{
+	UINT64 timestamp;
+	const void* machine;
+	const CHAR* machineName;
+	const CHAR* stateName;
+	BYTE state;
+	BYTE type;
+	UINT32 thread;
+};
+
+static std::mutex _buffersLock;
+static UINT32 _threads = 0;
+
+static std::mutex _flushLock;
+static std::condition_variable _flushWake;
+static BOOL _stopping = FALSE;
+static std::thread _flusher;
+
+// Owned by the flusher
+static FILE* _file = NULL;
+static BOOL _firstEvent = TRUE;
+static UINT64 _startTicks = 0;
+static DOUBLE _ticksPerUs = 1.0;
+static UINT32 _nextTid = 0;
+static std::map<const void*, MachineTrack> _machines;
+static std::map<UINT32, std::vector<ExternalPass> > _passes;
+static std::map<const CHAR*, std::string> _names;
+
+/// Stops a timeline still recording at exit, finishing the file. Otherwise the
+/// flusher thread object would end the program in std::terminate when destroyed.
+/// Declared after the state Stop() uses so it is destroyed first.
+static struct TimelineStopper
+{
+	~TimelineStopper() { StateTimeline::Stop(); }
+} _timelineStopper;
+
+//------------------------------------------------------------------------------
+// GetName
+//------------------------------------------------------------------------------
+static const CHAR* GetName(const CHAR* typeName)
+{
+	std::map<const CHAR*, std::string>::iterator it = _names.find(typeName);
+	if (it != _names.end())
+		return it->second.c_str();
+
+	std::string name(typeName);
+#if defined(__GNUG__)
+	INT status = 0;
+	CHAR* demangled = abi::__cxa_demangle(typeName, NULL, NULL, &status);
+	if (status == 0 && demangled != NULL)
+	{
+		name = demangled;
+		free(demangled);
+	}
+#endif
+	// JSON strings. Type names never contain control characters.
+	std::string escaped;
+	for (size_t i = 0; i < name.size(); i++)
+	{
+		if (name[i] == '"' || name[i] == '\\')
+			escaped += '\\';
+		escaped += name[i];
+	}
+	return _names.insert(std::make_pair(typeName, escaped)).first->second.c_str();
+}
+
+//------------------------------------------------------------------------------
+// ToUs
+//------------------------------------------------------------------------------
+static DOUBLE ToUs(UINT64 timestamp)
+{
+	if (timestamp < _startTicks)
+		return 0.0;
+	return (DOUBLE)(timestamp - _startTicks) / _ticksPerUs;
+}
+
+//------------------------------------------------------------------------------
+// WriteEvent
+//------------------------------------------------------------------------------
+static void WriteEvent(const CHAR* json)
+{
+	fprintf(_file, "%s\n%s", _firstEvent ? "" : ",", json);
+	_firstEvent = FALSE;
+}
+
+//------------------------------------------------------------------------------
+// WriteStateSlice
+//------------------------------------------------------------------------------
+static void WriteStateSlice(const MachineTrack& track, UINT64 end)
+{
+	CHAR json[512];
+	CHAR name[16];
+	if (track.stateName == NULL)
+		snprintf(name, sizeof(name), "%u", track.state);
+	snprintf(json, sizeof(json),
+		"{\"name\":\"%s\",\"cat\":\"state\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"state\":%u}}",
+		track.stateName != NULL ? track.stateName : name, ToUs(track.since),
+		ToUs(end) - ToUs(track.since), MACHINES_PID, track.tid, track.state);
+	WriteEvent(json);
+}
+
+//------------------------------------------------------------------------------
+// GetTrack
+//------------------------------------------------------------------------------
+static MachineTrack& GetTrack(const FlushEvent& event)
+{
+	std::map<const void*, MachineTrack>::iterator it = _machines.find(event.machine);
+
+	// A different type at a known address is a new state machine
+	if (it != _machines.end() && it->second.machineName == event.machineName)
+		return it->second;
+	if (it != _machines.end() && it->second.open)
+		WriteStateSlice(it->second, event.timestamp);
+
+	MachineTrack track;
+	track.tid = _nextTid++;
+	track.machineName = event.machineName;
+	track.open = FALSE;
+	track.since = 0;
+	track.state = 0;
+	track.stateName = NULL;
+	_machines[event.machine] = track;
+
+	CHAR json[512];
+	snprintf(json, sizeof(json),
+		"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s #%u\"}}",
+		MACHINES_PID, track.tid, GetName(event.machineName), track.tid);
+	WriteEvent(json);
+	return _machines[event.machine];
+}
+
+//------------------------------------------------------------------------------
+// WriteFlushEvent
+//------------------------------------------------------------------------------
+static void WriteFlushEvent(const FlushEvent& event)
+{
+	CHAR json[512];
+	std::map<UINT32, std::vector<ExternalPass> >::iterator it = _passes.find(event.thread);
+	if (it == _passes.end())
+	{
+		// First event from this thread names its track
+		snprintf(json, sizeof(json),
+			"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}",
+			THREADS_PID, event.thread, event.thread);
+		WriteEvent(json);
+		it = _passes.insert(std::make_pair(event.thread, std::vector<ExternalPass>())).first;
+	}
+	std::vector<ExternalPass>& passes = it->second;
+
+	switch (event.type)
+	{
+	case StateTimeline::EVENT_BEGIN:
+	{
+		ExternalPass pass;
+		pass.begin = event.timestamp;
+		pass.machine = event.machine;
+		pass.machineName = event.machineName;
+		pass.transitions = 0;
+		passes.push_back(pass);
+		break;
+	}
+	case StateTimeline::EVENT_END:
+	{
+		// Skip passes whose end was dropped. If the begin was dropped, ignore the end.
+		size_t depth = passes.size();
+		while (depth > 0 && passes[depth - 1].machine != event.machine)
+			depth--;
+		if (depth == 0)
+			break;
+		passes.resize(depth);
+		const ExternalPass& pass = passes.back();
+		snprintf(json, sizeof(json),
+			"{\"name\":\"%s\",\"cat\":\"event\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"transitions\":%u}}",
+			GetName(pass.machineName), ToUs(pass.begin), ToUs(event.timestamp) - ToUs(pass.begin),
+			THREADS_PID, event.thread, pass.transitions);
+		WriteEvent(json);
+		passes.pop_back();
+		break;
+	}
+	case StateTimeline::EVENT_STATE:
+	{
+		MachineTrack& track = GetTrack(event);
+		if (!passes.empty())
+			passes.back().transitions++;
+
+		// Re-entering the current state continues its slice
+		if (track.open && track.state == event.state)
+			break;
+		if (track.open)
+			WriteStateSlice(track, event.timestamp);
+		track.open = TRUE;
+		track.since = event.timestamp;
+		track.state = event.state;
+		track.stateName = event.stateName;
+		break;
+	}
+	case StateTimeline::EVENT_GUARD_REJECTED:
+	case StateTimeline::EVENT_IGNORED:
+	{
+		MachineTrack& track = GetTrack(event);
+		CHAR name[64];
+		if (event.type == StateTimeline::EVENT_IGNORED)
+			snprintf(name, sizeof(name), "Event ignored");
+		else if (event.stateName != NULL)
+			snprintf(name, sizeof(name), "Guard rejected %s", event.stateName);
+		else
+			snprintf(name, sizeof(name), "Guard rejected %u", event.state);
+		snprintf(json, sizeof(json),
+			"{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"state\":%u}}",
+			name, event.type == StateTimeline::EVENT_IGNORED ? "ignored" : "guard",
+			ToUs(event.timestamp), MACHINES_PID, track.tid, event.state);
+		WriteEvent(json);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+//------------------------------------------------------------------------------
+// CreateBuffer
+//------------------------------------------------------------------------------
+StateTimeline::Buffer* StateTimeline::CreateBuffer()
+{
+	C_ASSERT((STATE_MACHINE_TIMELINE_EVENTS & (STATE_MACHINE_TIMELINE_EVENTS - 1)) == 0);
+
+	Buffer* buffer = new Buffer();
+	buffer->head.store(0, std::memory_order_relaxed);
+	buffer->tail.store(0, std::memory_order_relaxed);
+	buffer->dropped.store(0, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(_buffersLock);
+	buffer->thread = _threads++;
+	buffer->next = m_pBuffers;
+	m_pBuffers = buffer;
+	m_pBuffer = buffer;
+	return buffer;
+}
+
+//------------------------------------------------------------------------------
+// Flush
+//------------------------------------------------------------------------------
+void StateTimeline::Flush()
+{
+	std::vector<FlushEvent> events;
+	{
+		std::lock_guard<std::mutex> lock(_buffersLock);
+		for (Buffer* buffer = m_pBuffers; buffer != NULL; buffer = buffer->next)
+		{
+			UINT64 head = buffer->head.load(std::memory_order_acquire);
+			UINT64 tail = buffer->tail.load(std::memory_order_relaxed);
+			for (; tail < head; tail++)
+			{
+				const TimelineEvent& event = buffer->events[tail & (STATE_MACHINE_TIMELINE_EVENTS - 1)];
+				FlushEvent flushEvent;
+				flushEvent.timestamp = event.timestamp;
+				flushEvent.machine = event.machine;
+				flushEvent.machineName = event.machineName;
+				flushEvent.stateName = event.stateName;
+				flushEvent.state = event.state;
+				flushEvent.type = event.type;
+				flushEvent.thread = buffer->thread;
+				events.push_back(flushEvent);
+			}
+			buffer->tail.store(head, std::memory_order_release);
+		}
+	}
+
+	// Merge the threads. A state machine used by several threads may otherwise
+	// appear out of order.
+	std::stable_sort(events.begin(), events.end(),
+		[](const FlushEvent& a, const FlushEvent& b) { return a.timestamp < b.timestamp; });
+
+	for (size_t i = 0; i < events.size(); i++)
+		WriteFlushEvent(events[i]);
+	fflush(_file);
+}
+
+//------------------------------------------------------------------------------
+// FlushThread
+//------------------------------------------------------------------------------
+void StateTimeline::FlushThread(UINT flushIntervalMs)
+{
+	std::unique_lock<std::mutex> lock(_flushLock);
+	while (!_stopping)
+	{
+		_flushWake.wait_for(lock, std::chrono::milliseconds(flushIntervalMs));
+		lock.unlock();
+		Flush();
+		lock.lock();
+	}
+}
+
+//------------------------------------------------------------------------------
+// Start
+//------------------------------------------------------------------------------
+BOOL StateTimeline::Start(const CHAR* path, UINT flushIntervalMs)
+{
+	if (IsRecording() || _file != NULL)
+		return FALSE;
+	_file = fopen(path, "w");
+	if (_file == NULL)
+		return FALSE;
+
+	// Discard events left over from a previous recording
+	{
+		std::lock_guard<std::mutex> lock(_buffersLock);
+		for (Buffer* buffer = m_pBuffers; buffer != NULL; buffer = buffer->next)
+		{
+			buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_release);
+			buffer->dropped.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	_firstEvent = TRUE;
+	_nextTid = 0;
+	_machines.clear();
+	_passes.clear();
+	_ticksPerUs = (DOUBLE)TraceClock::GetTicksPerSecond() / 1e6;
+	_startTicks = TraceClock::Now();
+
+	fprintf(_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	CHAR json[256];
+	snprintf(json, sizeof(json),
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"State machines\"}}", MACHINES_PID);
+	WriteEvent(json);
+	snprintf(json, sizeof(json),
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"External events\"}}", THREADS_PID);
+	WriteEvent(json);
+
+	_stopping = FALSE;
+	m_recording.store(TRUE, std::memory_order_relaxed);
+	_flusher = std::thread(&StateTimeline::FlushThread, flushIntervalMs);
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+// Stop
+//------------------------------------------------------------------------------
+void StateTimeline::Stop()
+{
+	if (!IsRecording())
+		return;
+	m_recording.store(FALSE, std::memory_order_relaxed);
+
+	{
+		std::lock_guard<std::mutex> lock(_flushLock);
+		_stopping = TRUE;
+	}
+	_flushWake.notify_one();
+	_flusher.join();
+	Flush();
+
+	// Close the slices of the states the machines are still in
+	UINT64 end = TraceClock::Now();
+	for (std::map<const void*, MachineTrack>::iterator it = _machines.begin(); it != _machines.end(); ++it)
+	{
+		if (it->second.open)
+			WriteStateSlice(it->second, end);
+	}
+
+	fprintf(_file, "\n]}\n");
+	fclose(_file);
+	_file = NULL;
+}
+
+//------------------------------------------------------------------------------
+// GetDropped
+//------------------------------------------------------------------------------
+UINT64 StateTimeline::GetDropped()
+{
+	UINT64 dropped = 0;
+	std::lock_guard<std::mutex> lock(_buffersLock);
+	for (Buffer* buffer = m_pBuffers; buffer != NULL; buffer = buffer->next)
+		dropped += buffer->dropped.load(std::memory_order_relaxed);
+	return dropped;
+}
@@ -0,0 +1,135 @@
+#ifndef _STATE_TIMELINE_H
+#define _STATE_TIMELINE_H
+
+#include "TraceClock.h"
+#include <atomic>
+
+// Define STATE_MACHINE_TIMELINE to compile the state residency timeline hooks.
+// Normally defined by the build (see the STATE_MACHINE_TIMELINE CMake option).
+// Recording is then switched on at runtime with StateTimeline::Start().
+//#define STATE_MACHINE_TIMELINE
+
+// Events buffered per thread between flushes. Must be a power of two.
+#ifndef STATE_MACHINE_TIMELINE_EVENTS
+#define STATE_MACHINE_TIMELINE_EVENTS 8192
+#endif
+
+/// @brief State residency timeline in the Chrome trace event JSON format, which
+/// chrome://tracing and ui.perfetto.dev open locally. Each state machine instance
+/// gets its own track showing a slice for every stay in a state, with instant
+/// events marking guard rejections and ignored events. Each thread gets a track
+/// showing a slice per external event, so the internal event cascade run by one
+/// external event lines up under it.
+///
+/// The state engine appends events to a buffer owned by the calling thread. A
+/// background thread drains the buffers and writes the file, so the state
+/// machines never wait on I/O. If a buffer fills between flushes, further events
+/// are dropped and counted.
+class StateTimeline
+{
+public:
+	/// Timeline event types
+	enum Type
+	{
+		EVENT_BEGIN,			///< External event processing started
+		EVENT_END,				///< External event processing ended
+		EVENT_STATE,			///< A state was entered or re-entered
+		EVENT_GUARD_REJECTED,	///< A guard condition blocked a transition
+		EVENT_IGNORED			///< An external event was ignored
+	};
+
+	/// Start recording and open the output file.
+	/// @param[in] path - the JSON output file.
+	/// @param[in] flushIntervalMs - the time between background flushes.
+	/// @return TRUE if the file was opened. FALSE if already started or the file
+	///		cannot be created.
+	static BOOL Start(const CHAR* path, UINT flushIntervalMs = 100);
+
+	/// Stop recording, flush the remaining events, close the open state slices and
+	/// finish the file. A timeline still recording at exit is stopped by a static
+	/// destructor.
+	static void Stop();
+
+	/// Is the timeline recording?
+	/// @return TRUE between Start() and Stop().
+	static BOOL IsRecording() { return m_recording.load(std::memory_order_relaxed); }
+
+	/// Gets the number of events dropped because a thread's buffer was full.
+	/// @return The dropped event count since Start().
+	static UINT64 GetDropped();
+
+	/// Record an event. Called by the state machine.
+	/// @param[in] type - the event type.
+	/// @param[in] machine - the state machine.
+	/// @param[in] machineName - the state machine type name, a static string.
+	/// @param[in] state - the state entered, or the target state rejected or
+	///		ignored in.
+	/// @param[in] stateName - the state name, a static string or NULL.
+	static void Record(Type type, const void* machine, const CHAR* machineName,
+		BYTE state, const CHAR* stateName)
+	{
+		if (!IsRecording())
+			return;
+
+		Buffer* buffer = m_pBuffer;
+		if (buffer == NULL)
+			buffer = CreateBuffer();
+
+		UINT64 head = buffer->head.load(std::memory_order_relaxed);
+		if (head - buffer->tail.load(std::memory_order_acquire) >= STATE_MACHINE_TIMELINE_EVENTS)
+		{
+			buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		TimelineEvent& event = buffer->events[head & (STATE_MACHINE_TIMELINE_EVENTS - 1)];
+		event.timestamp = TraceClock::Now();
+		event.machine = machine;
+		event.machineName = machineName;
+		event.stateName = stateName;
+		event.state = state;
+		event.type = (BYTE)type;
+		buffer->head.store(head + 1, std::memory_order_release);
+	}
+
+private:
+	/// @brief A buffered event. Names point to static strings.
+	struct TimelineEvent
+	{
+		UINT64 timestamp;
+		const void* machine;
+		const CHAR* machineName;
+		const CHAR* stateName;
+		BYTE state;
+		BYTE type;
+	};
+
+	/// @brief A thread's event queue, written by the thread and read by the
+	/// flusher. Buffers outlive their threads so no events are lost.
+	struct Buffer
+	{
+		std::atomic<UINT64> head;		///< Events written
+		std::atomic<UINT64> tail;		///< Events flushed
+		std::atomic<UINT64> dropped;	///< Events dropped while full
+		UINT32 thread;					///< Thread number in creation order
+		Buffer* next;
+		TimelineEvent events[STATE_MACHINE_TIMELINE_EVENTS];
+	};
+
+	/// Create and register the calling thread's buffer.
+	static Buffer* CreateBuffer();
+
+	/// Drain every buffer and write the events. Called by the flusher thread.
+	static void Flush();
+
+	/// Background flusher thread.
+	static void FlushThread(UINT flushIntervalMs);
+
+	static inline std::atomic<BOOL> m_recording{FALSE};
+
+	/// The calling thread's buffer and the list of every thread's buffer
+	static inline thread_local Buffer* m_pBuffer = NULL;
+	static inline Buffer* m_pBuffers = NULL;
+};
+
+#endif
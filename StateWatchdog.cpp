@@ -0,0 +1,464 @@
+#include "StateWatchdog.h"
+#include "StateMachine.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+// Nested actions tracked per thread for the watchdog thread, such as a state
+// function sending an event to another state machine
+static const INT MAX_NESTING = 8;
+
+/// @brief An action published to the watchdog thread. The sequence is odd while
+/// the fields are being written. The claim holds the sequence while the action
+/// runs, the sequence plus one once the watchdog thread reports it, and 0 once
+/// the action returns, so an action is counted either as running or as an
+/// overrun when it returns, never both.
+struct ActionFrame
+{
+	std::atomic<UINT64> sequence;
+	std::atomic<UINT64> claim;
+	std::atomic<const void*> machine;
+	std::atomic<StateWatchdog*> watchdog;
+	std::atomic<const CHAR*> eventName;
+	std::atomic<UINT64> start;
+	std::atomic<UINT32> stateAction;
+};
+
+/// @brief The actions running on a thread
+struct ActionSlot
+{
+	std::atomic<INT> depth;
+	ActionFrame frames[MAX_NESTING];
+	ActionSlot* next;
+};
+
+static std::mutex _registryLock;
+static StateWatchdog* _watchdogs = NULL;
+static UINT64 _defaultBudgetNs = 0;
+static std::atomic<WatchdogHandler> _handler(NULL);
+
+static std::mutex _slotsLock;
+static ActionSlot* _slots = NULL;
+static thread_local ActionSlot* _slot = NULL;
+
+static std::mutex _monitorLock;
+static std::condition_variable _monitorWake;
+static BOOL _monitorStopping = FALSE;
+static std::thread _monitor;
+
+/// Stops a watchdog thread still running at exit, which would otherwise end the
+/// program in std::terminate when the thread object is destroyed. Declared after
+/// the thread so it is destroyed first.
+static struct MonitorStopper
+{
+	~MonitorStopper() { StateWatchdog::StopMonitor(); }
+} _monitorStopper;
+
+//------------------------------------------------------------------------------
+// Demangle
+//------------------------------------------------------------------------------
+static std::string Demangle(const CHAR* name)
+{
+	if (name == NULL)
+		return std::string();
+#if defined(__GNUG__)
+	INT status = 0;
+	CHAR* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+	if (status == 0 && demangled != NULL)
+	{
+		std::string result(demangled);
+		free(demangled);
+		return result;
+	}
+#endif
+	return std::string(name);
+}
+
+//------------------------------------------------------------------------------
+// PrintReport
+//------------------------------------------------------------------------------
+static void PrintReport(const WatchdogReport& report)
+{
+	CHAR state[32];
+	if (report.stateName != NULL)
+		snprintf(state, sizeof(state), "%s", report.stateName);
+	else
+		snprintf(state, sizeof(state), "%u", report.state);
+	fprintf(stderr, "StateWatchdog: %s %s %s action %s %llu ns, budget %llu ns, event %s\n",
+		report.machineName, state, StateLatency::GetActionName(report.action),
+		report.running ? "still running after" : "took", report.durationNs, report.budgetNs,
+		report.eventName);
+}
+
+//------------------------------------------------------------------------------
+// ToTicks
+//------------------------------------------------------------------------------
+static UINT64 ToTicks(UINT64 ns)
+{
+	return (UINT64)((DOUBLE)ns * (DOUBLE)TraceClock::GetTicksPerSecond() / 1e9 + 0.5);
+}
+
+//------------------------------------------------------------------------------
+// StateWatchdog
+//------------------------------------------------------------------------------
+StateWatchdog::StateWatchdog(const CHAR* typeName) :
+	m_typeName(typeName),
+	m_stateNames(NULL),
+	m_classBudgetNs(0),
+	m_next(NULL)
+{
+	m_machineName = strdup(Demangle(typeName).c_str());
+	for (INT state = 0; state < 256; state++)
+	{
+		m_stateBudgetNs[state] = 0;
+		m_budgets[state].store(NO_BUDGET, std::memory_order_relaxed);
+		m_overruns[state].store(0, std::memory_order_relaxed);
+		m_running[state].store(0, std::memory_order_relaxed);
+		m_worst[state].store(0, std::memory_order_relaxed);
+	}
+}
+
+//------------------------------------------------------------------------------
+// FindLocked
+//------------------------------------------------------------------------------
+StateWatchdog* StateWatchdog::FindLocked(const CHAR* typeName)
+{
+	for (StateWatchdog* watchdog = _watchdogs; watchdog != NULL; watchdog = watchdog->m_next)
+	{
+		if (watchdog->m_typeName == typeName || strcmp(watchdog->m_typeName, typeName) == 0)
+			return watchdog;
+	}
+
+	StateWatchdog* watchdog = new StateWatchdog(typeName);
+	watchdog->UpdateBudgets();
+	watchdog->m_next = _watchdogs;
+	_watchdogs = watchdog;
+	return watchdog;
+}
+
+//------------------------------------------------------------------------------
+// Find
+//------------------------------------------------------------------------------
+StateWatchdog* StateWatchdog::Find(StateMachine* machine)
+{
+	std::lock_guard<std::mutex> lock(_registryLock);
+	StateWatchdog* watchdog = FindLocked(typeid(*machine).name());
+
+	// Budgets may be set before the first state machine of the class runs
+	if (watchdog->m_stateNames.load(std::memory_order_relaxed) == NULL)
+	{
+		const CHAR** names = new const CHAR*[256];
+		for (INT state = 0; state < 256; state++)
+			names[state] = state < machine->GetMaxStates() ? machine->GetStateName((BYTE)state) : NULL;
+		watchdog->m_stateNames.store(names, std::memory_order_release);
+	}
+	return watchdog;
+}
+
+//------------------------------------------------------------------------------
+// UpdateBudgets
+//------------------------------------------------------------------------------
+void StateWatchdog::UpdateBudgets()
+{
+	for (INT state = 0; state < 256; state++)
+	{
+		UINT64 budgetNs = m_stateBudgetNs[state];
+		if (budgetNs == 0)
+			budgetNs = m_classBudgetNs;
+		if (budgetNs == 0)
+			budgetNs = _defaultBudgetNs;
+		m_budgets[state].store(budgetNs != 0 ? ToTicks(budgetNs) : NO_BUDGET, std::memory_order_relaxed);
+	}
+}
+
+//------------------------------------------------------------------------------
+// SetDefaultBudget
+//------------------------------------------------------------------------------
+void StateWatchdog::SetDefaultBudget(UINT64 budgetNs)
+{
+	std::lock_guard<std::mutex> lock(_registryLock);
+	_defaultBudgetNs = budgetNs;
+	for (StateWatchdog* watchdog = _watchdogs; watchdog != NULL; watchdog = watchdog->m_next)
+		watchdog->UpdateBudgets();
+}
+
+//------------------------------------------------------------------------------
+// SetBudget
+//------------------------------------------------------------------------------
+void StateWatchdog::SetBudget(const std::type_info& type, UINT64 budgetNs)
+{
+	std::lock_guard<std::mutex> lock(_registryLock);
+	StateWatchdog* watchdog = FindLocked(type.name());
+	watchdog->m_classBudgetNs = budgetNs;
+	watchdog->UpdateBudgets();
+}
+
+//------------------------------------------------------------------------------
+// SetBudget
+//------------------------------------------------------------------------------
+void StateWatchdog::SetBudget(const std::type_info& type, BYTE state, UINT64 budgetNs)
+{
+	std::lock_guard<std::mutex> lock(_registryLock);
+	StateWatchdog* watchdog = FindLocked(type.name());
+	watchdog->m_stateBudgetNs[state] = budgetNs;
+	watchdog->UpdateBudgets();
+}
+
+//------------------------------------------------------------------------------
+// SetHandler
+//------------------------------------------------------------------------------
+void StateWatchdog::SetHandler(WatchdogHandler handler)
+{
+	_handler.store(handler, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// Overrun
+//------------------------------------------------------------------------------
+void StateWatchdog::Overrun(const void* machine, BYTE state, INT action, const EventData* data, UINT64 ticks,
+	BOOL reported)
+{
+	if (!reported)
+		m_overruns[state].fetch_add(1, std::memory_order_relaxed);
+	UINT64 worst = m_worst[state].load(std::memory_order_relaxed);
+	while (ticks > worst && !m_worst[state].compare_exchange_weak(worst, ticks, std::memory_order_relaxed))
+		;
+	Report(machine, state, action, data != NULL ? typeid(*data).name() : NULL, ticks, FALSE);
+}
+
+//------------------------------------------------------------------------------
+// Report
+//------------------------------------------------------------------------------
+void StateWatchdog::Report(const void* machine, BYTE state, INT action, const CHAR* eventName,
+	UINT64 ticks, BOOL running)
+{
+	const CHAR** names = m_stateNames.load(std::memory_order_acquire);
+	std::string event = Demangle(eventName);
+
+	WatchdogReport report;
+	report.machine = machine;
+	report.machineName = m_machineName;
+	report.stateName = names != NULL ? names[state] : NULL;
+	report.state = state;
+	report.action = action;
+	report.eventName = event.c_str();
+	report.durationNs = TraceClock::ToNanoseconds(ticks);
+	report.budgetNs = (UINT64)((DOUBLE)m_budgets[state].load(std::memory_order_relaxed) * 1e9 /
+		(DOUBLE)TraceClock::GetTicksPerSecond() + 0.5);
+	report.running = running;
+
+	WatchdogHandler handler = _handler.load(std::memory_order_relaxed);
+	if (handler != NULL)
+		handler(report);
+	else
+		PrintReport(report);
+}
+
+//------------------------------------------------------------------------------
+// Publish
+//------------------------------------------------------------------------------
+void StateWatchdog::Publish(const void* machine, BYTE state, INT action, const EventData* data, UINT64 start)
+{
+	ActionSlot* slot = _slot;
+	if (slot == NULL)
+	{
+		slot = new ActionSlot();
+		slot->depth.store(0, std::memory_order_relaxed);
+		for (INT i = 0; i < MAX_NESTING; i++)
+		{
+			slot->frames[i].sequence.store(0, std::memory_order_relaxed);
+			slot->frames[i].claim.store(0, std::memory_order_relaxed);
+		}
+		std::lock_guard<std::mutex> lock(_slotsLock);
+		slot->next = _slots;
+		_slots = slot;
+		_slot = slot;
+	}
+
+	INT depth = slot->depth.load(std::memory_order_relaxed);
+	if (depth < MAX_NESTING)
+	{
+		ActionFrame& frame = slot->frames[depth];
+		UINT64 sequence = frame.sequence.load(std::memory_order_relaxed);
+		frame.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		frame.machine.store(machine, std::memory_order_relaxed);
+		frame.watchdog.store(this, std::memory_order_relaxed);
+		frame.eventName.store(data != NULL ? typeid(*data).name() : NULL, std::memory_order_relaxed);
+		frame.start.store(start, std::memory_order_relaxed);
+		frame.stateAction.store((UINT32)state | ((UINT32)action << 8), std::memory_order_relaxed);
+		frame.claim.store(sequence + 2, std::memory_order_relaxed);
+		frame.sequence.store(sequence + 2, std::memory_order_release);
+	}
+	slot->depth.store(depth + 1, std::memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+// Unpublish
+//------------------------------------------------------------------------------
+BOOL StateWatchdog::Unpublish()
+{
+	// The monitor may start between an action's Enter() and Leave()
+	ActionSlot* slot = _slot;
+	if (slot == NULL)
+		return FALSE;
+	INT depth = slot->depth.load(std::memory_order_relaxed);
+	if (depth <= 0)
+		return FALSE;
+
+	// Take the claim back from the watchdog thread, unless it reported the action
+	BOOL reported = FALSE;
+	if (depth <= MAX_NESTING)
+		reported = (slot->frames[depth - 1].claim.exchange(0, std::memory_order_acq_rel) & 1) != 0;
+	slot->depth.store(depth - 1, std::memory_order_release);
+	return reported;
+}
+
+//------------------------------------------------------------------------------
+// MonitorThread
+//------------------------------------------------------------------------------
+void StateWatchdog::MonitorThread(UINT intervalMs)
+{
+	std::unique_lock<std::mutex> lock(_monitorLock);
+	while (!_monitorStopping)
+	{
+		_monitorWake.wait_for(lock, std::chrono::milliseconds(intervalMs));
+		if (_monitorStopping)
+			break;
+		lock.unlock();
+
+		UINT64 now = TraceClock::Now();
+		std::lock_guard<std::mutex> slotsLock(_slotsLock);
+		for (ActionSlot* slot = _slots; slot != NULL; slot = slot->next)
+		{
+			INT depth = slot->depth.load(std::memory_order_acquire);
+			if (depth <= 0 || depth > MAX_NESTING)
+				continue;
+
+			ActionFrame& frame = slot->frames[depth - 1];
+			UINT64 sequence = frame.sequence.load(std::memory_order_acquire);
+			if ((sequence & 1) != 0 || frame.claim.load(std::memory_order_relaxed) != sequence)
+				continue;
+			const void* machine = frame.machine.load(std::memory_order_relaxed);
+			StateWatchdog* watchdog = frame.watchdog.load(std::memory_order_relaxed);
+			const CHAR* eventName = frame.eventName.load(std::memory_order_relaxed);
+			UINT64 start = frame.start.load(std::memory_order_relaxed);
+			UINT32 stateAction = frame.stateAction.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (frame.sequence.load(std::memory_order_relaxed) != sequence ||
+				slot->depth.load(std::memory_order_relaxed) < depth)
+				continue;
+
+			BYTE state = (BYTE)(stateAction & 0xFF);
+			// Claim the action so it is reported once, unless it just returned
+			UINT64 claim = sequence;
+			if (now > start && now - start > watchdog->m_budgets[state].load(std::memory_order_relaxed) &&
+				frame.claim.compare_exchange_strong(claim, sequence + 1, std::memory_order_acq_rel))
+			{
+				watchdog->m_running[state].fetch_add(1, std::memory_order_relaxed);
+				watchdog->Report(machine, state, (INT)(stateAction >> 8), eventName, now - start, TRUE);
+			}
+		}
+
+		lock.lock();
+	}
+}
+
+//------------------------------------------------------------------------------
+// StartMonitor
+//------------------------------------------------------------------------------
+void StateWatchdog::StartMonitor(UINT intervalMs)
+{
+	if (m_monitoring.load(std::memory_order_relaxed))
+		return;
+	_monitorStopping = FALSE;
+	m_monitoring.store(TRUE, std::memory_order_relaxed);
+	_monitor = std::thread(&StateWatchdog::MonitorThread, intervalMs);
+}
+
+//------------------------------------------------------------------------------
+// StopMonitor
+//------------------------------------------------------------------------------
+void StateWatchdog::StopMonitor()
+{
+	if (!m_monitoring.load(std::memory_order_relaxed))
+		return;
+	m_monitoring.store(FALSE, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(_monitorLock);
+		_monitorStopping = TRUE;
+	}
+	_monitorWake.notify_one();
+	_monitor.join();
+}
+
+//------------------------------------------------------------------------------
+// GetStats
+//------------------------------------------------------------------------------
+INT StateWatchdog::GetStats(WatchdogStats* stats, INT maxStats)
+{
+	std::lock_guard<std::mutex> lock(_registryLock);
+	INT count = 0;
+	for (StateWatchdog* watchdog = _watchdogs; watchdog != NULL; watchdog = watchdog->m_next)
+	{
+		const CHAR** names = watchdog->m_stateNames.load(std::memory_order_acquire);
+		for (INT state = 0; state < 256 && count < maxStats; state++)
+		{
+			UINT64 overruns = watchdog->m_overruns[state].load(std::memory_order_relaxed);
+			UINT64 running = watchdog->m_running[state].load(std::memory_order_relaxed);
+			if (overruns == 0 && running == 0)
+				continue;
+			WatchdogStats& entry = stats[count++];
+			entry.machineName = watchdog->m_machineName;
+			entry.stateName = names != NULL ? names[state] : NULL;
+			entry.state = (BYTE)state;
+			entry.overruns = overruns;
+			entry.running = running;
+			entry.worstNs = TraceClock::ToNanoseconds(watchdog->m_worst[state].load(std::memory_order_relaxed));
+		}
+	}
+	return count;
+}
+
+//------------------------------------------------------------------------------
+// GetOverruns
+//------------------------------------------------------------------------------
+UINT64 StateWatchdog::GetOverruns()
+{
+	std::lock_guard<std::mutex> lock(_registryLock);
+	UINT64 total = 0;
+	for (StateWatchdog* watchdog = _watchdogs; watchdog != NULL; watchdog = watchdog->m_next)
+	{
+		for (INT state = 0; state < 256; state++)
+		{
+			total += watchdog->m_overruns[state].load(std::memory_order_relaxed);
+			total += watchdog->m_running[state].load(std::memory_order_relaxed);
+		}
+	}
+	return total;
+}
+
+//------------------------------------------------------------------------------
+// Reset
+//------------------------------------------------------------------------------
+void StateWatchdog::Reset()
+{
+	std::lock_guard<std::mutex> lock(_registryLock);
+	for (StateWatchdog* watchdog = _watchdogs; watchdog != NULL; watchdog = watchdog->m_next)
+	{
+		for (INT state = 0; state < 256; state++)
+		{
+			watchdog->m_overruns[state].store(0, std::memory_order_relaxed);
+			watchdog->m_running[state].store(0, std::memory_order_relaxed);
+			watchdog->m_worst[state].store(0, std::memory_order_relaxed);
+		}
+	}
+}
@@ -0,0 +1,175 @@
+#ifndef _STATE_WATCHDOG_H
+#define _STATE_WATCHDOG_H
+
+#include "StateLatency.h"
+#include <atomic>
+#include <typeinfo>
+
+class EventData;
+
+// Define STATE_MACHINE_WATCHDOG to check every state, guard, entry and exit action
+// against a time budget. Normally defined by the build (see the
+// STATE_MACHINE_WATCHDOG CMake option).
+//#define STATE_MACHINE_WATCHDOG
+
+/// An action overrun report
+typedef struct
+{
+	const void* machine;		///< The state machine
+	const CHAR* machineName;	///< State machine type name
+	const CHAR* stateName;		///< State name or NULL if unnamed
+	BYTE state;					///< State the action belongs to
+	INT action;					///< StateLatency::Action
+	const CHAR* eventName;		///< Event data type name
+	UINT64 durationNs;			///< Time taken, or so far if still running
+	UINT64 budgetNs;			///< The budget exceeded
+	BOOL running;				///< TRUE if reported by the watchdog thread while the action runs
+} WatchdogReport;
+
+/// Called for each overrun, on the thread that ran the action or, for a running
+/// action, on the watchdog thread. Must not call back into the state machine.
+typedef void (*WatchdogHandler)(const WatchdogReport& report);
+
+/// Overrun counts of one state of one state machine class
+typedef struct
+{
+	const CHAR* machineName;	///< State machine type name
+	const CHAR* stateName;		///< State name or NULL if unnamed
+	BYTE state;					///< State number
+	UINT64 overruns;			///< Actions finishing over budget
+	UINT64 running;				///< Actions found over budget while still running
+	UINT64 worstNs;				///< Longest overrunning action
+} WatchdogStats;
+
+/// @brief Slow action watchdog. Because the state engine runs each event to
+/// completion, one slow action delays every event queued behind it. Each action
+/// is timed and checked against the budget of its state once it returns, which
+/// costs a clock read and a compare. Budgets are set per state machine class,
+/// optionally overridden per state. An optional watchdog thread also finds
+/// actions that are still running past their budget, such as a hung action.
+///
+/// Overruns are counted per class and state and passed to the report handler,
+/// which by default prints them to stderr.
+class StateWatchdog
+{
+public:
+	/// Set the budget of every action of every state machine class without its
+	/// own budget.
+	/// @param[in] budgetNs - the budget in nanoseconds, or 0 for none.
+	static void SetDefaultBudget(UINT64 budgetNs);
+
+	/// Set the budget of every action of a state machine class.
+	/// @param[in] type - the state machine class, such as typeid(Motor).
+	/// @param[in] budgetNs - the budget in nanoseconds, or 0 to use the default.
+	static void SetBudget(const std::type_info& type, UINT64 budgetNs);
+
+	/// Set the budget of the actions of one state of a state machine class.
+	/// @param[in] type - the state machine class.
+	/// @param[in] state - the state.
+	/// @param[in] budgetNs - the budget in nanoseconds, or 0 to use the class budget.
+	static void SetBudget(const std::type_info& type, BYTE state, UINT64 budgetNs);
+
+	/// Set the function called for each overrun.
+	/// @param[in] handler - the handler, or NULL to print to stderr.
+	static void SetHandler(WatchdogHandler handler);
+
+	/// Start the watchdog thread that reports actions still running past their
+	/// budget. Each action is then also published to the thread, a few more
+	/// stores per action. A thread still running at exit is stopped by a static
+	/// destructor.
+	/// @param[in] intervalMs - the time between checks.
+	static void StartMonitor(UINT intervalMs = 10);
+
+	/// Stop the watchdog thread.
+	static void StopMonitor();
+
+	/// Take an overrun count snapshot of every state with overruns.
+	/// @param[out] stats - array receiving one entry per state.
+	/// @param[in] maxStats - the number of entries in stats.
+	/// @return The number of entries stored.
+	static INT GetStats(WatchdogStats* stats, INT maxStats);
+
+	/// Gets the total number of overruns of every class.
+	/// @return The overrun count, running actions included.
+	static UINT64 GetOverruns();
+
+	/// Discard the overrun counts.
+	static void Reset();
+
+	/// Gets the watchdog of a state machine class, creating it on first use.
+	/// @param[in] machine - a state machine of the class, providing the names.
+	/// @return The watchdog, which lives until the program exits.
+	static StateWatchdog* Find(StateMachine* machine);
+
+	/// Called by the state engine before an action runs.
+	/// @param[in] machine - the state machine.
+	/// @param[in] state - the state the action belongs to.
+	/// @param[in] action - the action kind.
+	/// @param[in] data - the event data.
+	/// @param[in] start - the action start time in TraceClock ticks.
+	void Enter(const void* machine, BYTE state, INT action, const EventData* data, UINT64 start)
+	{
+		if (m_monitoring.load(std::memory_order_relaxed))
+			Publish(machine, state, action, data, start);
+	}
+
+	/// Called by the state engine after an action returns.
+	/// @param[in] machine - the state machine.
+	/// @param[in] state - the state the action belongs to.
+	/// @param[in] action - the action kind.
+	/// @param[in] data - the event data.
+	/// @param[in] ticks - the action duration in TraceClock ticks.
+	void Leave(const void* machine, BYTE state, INT action, const EventData* data, UINT64 ticks)
+	{
+		BOOL reported = FALSE;
+		if (m_monitoring.load(std::memory_order_relaxed))
+			reported = Unpublish();
+		if (ticks > m_budgets[state].load(std::memory_order_relaxed))
+			Overrun(machine, state, action, data, ticks, reported);
+	}
+
+private:
+	/// Per state budget with no budget set
+	static const UINT64 NO_BUDGET = ~0ULL;
+
+	StateWatchdog(const CHAR* typeName);
+	StateWatchdog(const StateWatchdog&);
+	StateWatchdog& operator=(const StateWatchdog&);
+
+	/// Gets the watchdog of a class by type name, creating it on first use.
+	/// Called with the registry lock held.
+	static StateWatchdog* FindLocked(const CHAR* typeName);
+
+	/// Recompute the per state budgets in ticks. Called with the registry lock held.
+	void UpdateBudgets();
+
+	/// Count and report an overrun. An action the watchdog thread already reported
+	/// as running is reported again with its duration but counted once.
+	void Overrun(const void* machine, BYTE state, INT action, const EventData* data, UINT64 ticks,
+		BOOL reported);
+	void Report(const void* machine, BYTE state, INT action, const CHAR* eventName,
+		UINT64 ticks, BOOL running);
+
+	/// Publish or clear the running action of the calling thread. Unpublish()
+	/// returns TRUE if the watchdog thread reported the action as running.
+	void Publish(const void* machine, BYTE state, INT action, const EventData* data, UINT64 start);
+	static BOOL Unpublish();
+
+	/// Watchdog thread.
+	static void MonitorThread(UINT intervalMs);
+
+	const CHAR* const m_typeName;
+	CHAR* m_machineName;
+	std::atomic<const CHAR**> m_stateNames;
+	UINT64 m_classBudgetNs;
+	UINT64 m_stateBudgetNs[256];
+	std::atomic<UINT64> m_budgets[256];
+	std::atomic<UINT64> m_overruns[256];
+	std::atomic<UINT64> m_running[256];
+	std::atomic<UINT64> m_worst[256];
+	StateWatchdog* m_next;
+
+	static inline std::atomic<BOOL> m_monitoring{FALSE};
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "ThreadPool.h"
+
+//----------------------------------------------------------------------------
+// ThreadPool
+//----------------------------------------------------------------------------
+ThreadPool::ThreadPool(INT threads) :
+	m_stop(FALSE)
+{
+	if (threads <= 0)
+		threads = (INT)std::thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+
+	for (INT i = 0; i < threads; i++)
+		m_threads.push_back(std::thread(&ThreadPool::Run, this));
+}
+
+//----------------------------------------------------------------------------
+// ~ThreadPool
+//----------------------------------------------------------------------------
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = TRUE;
+	}
+	m_ready.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); i++)
+		m_threads[i].join();
+}
+
+//----------------------------------------------------------------------------
+// Post
+//----------------------------------------------------------------------------
+void ThreadPool::Post(ThreadPoolTask task, void* context)
+{
+	Task posted = { task, context };
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(posted);
+	}
+	m_ready.notify_one();
+}
+
+//----------------------------------------------------------------------------
+// Run
+//----------------------------------------------------------------------------
+void ThreadPool::Run()
+{
+	for (;;)
+	{
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (m_tasks.empty() && !m_stop)
+				m_ready.wait(lock);
+
+			// Drain the queue before stopping
+			if (m_tasks.empty())
+				return;
+			task = m_tasks.front();
+			m_tasks.pop_front();
+		}
+		task.task(task.context);
+	}
+}
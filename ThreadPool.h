@@ -0,0 +1,55 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include "DataTypes.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// A task run by a ThreadPool worker.
+/// @param[in] context - the context given to ThreadPool::Post().
+typedef void (*ThreadPoolTask)(void* context);
+
+/// @brief A fixed set of worker threads running posted tasks in FIFO order.
+class ThreadPool
+{
+public:
+	/// Constructor
+	/// @param[in] threads - the number of worker threads, or 0 for one per 
+	///		hardware thread.
+	ThreadPool(INT threads = 0);
+
+	/// Destructor. Runs the tasks already posted, then joins the workers.
+	~ThreadPool();
+
+	/// Queue a task to run on a worker thread.
+	/// @param[in] task - the task function.
+	/// @param[in] context - passed to the task.
+	void Post(ThreadPoolTask task, void* context);
+
+	/// Gets the number of worker threads.
+	/// @return The worker thread count.
+	INT GetThreadCount() const { return (INT)m_threads.size(); }
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void Run();
+
+	struct Task
+	{
+		ThreadPoolTask task;
+		void* context;
+	};
+
+	std::vector<std::thread> m_threads;
+	std::deque<Task> m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_ready;
+	BOOL m_stop;
+};
+
+#endif
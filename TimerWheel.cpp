@@ -0,0 +1,246 @@
+#include "TimerWheel.h"
+#include "Fault.h"
+#include <string.h>
+
+// Timers further out than the outermost level covers are parked at its limit
+static const UINT64 MAX_DELTA = 0xFFFFFFFFULL;
+
+//----------------------------------------------------------------------------
+// TimerWheel
+//----------------------------------------------------------------------------
+TimerWheel::TimerWheel() :
+	m_now(0),
+	m_armed(0)
+{
+	for (INT level = 0; level < LEVELS; level++)
+	{
+		for (INT slot = 0; slot < SLOTS; slot++)
+		{
+			WheelTimer& head = m_slots[level][slot];
+			head.m_next = head.m_prev = &head;
+		}
+	}
+	memset(m_occupied, 0, sizeof(m_occupied));
+}
+
+//----------------------------------------------------------------------------
+// ~TimerWheel
+//----------------------------------------------------------------------------
+TimerWheel::~TimerWheel()
+{
+	for (INT level = 0; level < LEVELS; level++)
+	{
+		for (INT slot = 0; slot < SLOTS; slot++)
+		{
+			WheelTimer& head = m_slots[level][slot];
+			while (head.m_next != &head)
+				Unlink(*head.m_next);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// Unlink
+//----------------------------------------------------------------------------
+void TimerWheel::Unlink(WheelTimer& timer)
+{
+	timer.m_prev->m_next = timer.m_next;
+	timer.m_next->m_prev = timer.m_prev;
+	timer.m_next = timer.m_prev = NULL;
+}
+
+//----------------------------------------------------------------------------
+// Arm
+//----------------------------------------------------------------------------
+void TimerWheel::Arm(WheelTimer& timer, UINT64 ticks)
+{
+	if (timer.IsArmed())
+		Unlink(timer);
+	else
+		m_armed++;
+
+	timer.m_expiry = m_now + (ticks ? ticks : 1);
+	Insert(timer);
+}
+
+//----------------------------------------------------------------------------
+// Cancel
+//----------------------------------------------------------------------------
+void TimerWheel::Cancel(WheelTimer& timer)
+{
+	if (!timer.IsArmed())
+		return;
+	Unlink(timer);
+	ASSERT_TRUE(m_armed > 0);
+	m_armed--;
+}
+
+//----------------------------------------------------------------------------
+// Insert
+//----------------------------------------------------------------------------
+void TimerWheel::Insert(WheelTimer& timer)
+{
+	UINT64 delta = timer.m_expiry - m_now;
+	UINT64 slotTick = timer.m_expiry;
+	if (delta > MAX_DELTA)
+	{
+		delta = MAX_DELTA;
+		slotTick = m_now + MAX_DELTA;
+	}
+
+	// The level is the first whose span covers the time remaining. The slot is
+	// that level's digit of the expiry tick.
+	INT level = 0;
+	while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1))))
+		level++;
+	INT slot = (INT)((slotTick >> (SLOT_BITS * level)) & SLOT_MASK);
+
+	// Append to the slot list
+	WheelTimer& head = m_slots[level][slot];
+	timer.m_next = &head;
+	timer.m_prev = head.m_prev;
+	head.m_prev->m_next = &timer;
+	head.m_prev = &timer;
+	m_occupied[level][slot / 64] |= 1ULL << (slot % 64);
+}
+
+//----------------------------------------------------------------------------
+// Cascade
+//----------------------------------------------------------------------------
+void TimerWheel::Cascade(INT level, INT slot)
+{
+	WheelTimer& head = m_slots[level][slot];
+	m_occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+
+	// Re-insert each timer relative to the current tick, moving it inward
+	while (head.m_next != &head)
+	{
+		WheelTimer& timer = *head.m_next;
+		Unlink(timer);
+		Insert(timer);
+	}
+}
+
+//----------------------------------------------------------------------------
+// Expire
+//----------------------------------------------------------------------------
+void TimerWheel::Expire(INT slot)
+{
+	WheelTimer& head = m_slots[0][slot];
+	m_occupied[0][slot / 64] &= ~(1ULL << (slot % 64));
+	if (head.m_next == &head)
+		return;
+
+	// Move the slot onto a local list first. A callback may arm or cancel any
+	// timer, including others expiring on this tick.
+	WheelTimer expired;
+	expired.m_next = head.m_next;
+	expired.m_prev = head.m_prev;
+	expired.m_next->m_prev = &expired;
+	expired.m_prev->m_next = &expired;
+	head.m_next = head.m_prev = &head;
+
+	while (expired.m_next != &expired)
+	{
+		WheelTimer& timer = *expired.m_next;
+		Unlink(timer);
+		m_armed--;
+		if (timer.m_callback != NULL)
+			timer.m_callback(&timer, timer.m_context);
+	}
+}
+
+//----------------------------------------------------------------------------
+// FindSlot
+//----------------------------------------------------------------------------
+INT TimerWheel::FindSlot(INT level, INT from) const
+{
+	// Returns the first possibly occupied slot at or after from, or -1
+	for (INT word = from / 64; word < SLOTS / 64; word++)
+	{
+		UINT64 bits = m_occupied[level][word];
+		if (word == from / 64)
+			bits &= ~0ULL << (from % 64);
+		if (bits == 0)
+			continue;
+
+		INT bit = 0;
+		while ((bits & 1) == 0)
+		{
+			bits >>= 1;
+			bit++;
+		}
+		return word * 64 + bit;
+	}
+	return -1;
+}
+
+//----------------------------------------------------------------------------
+// Advance
+//----------------------------------------------------------------------------
+void TimerWheel::Advance(UINT64 ticks)
+{
+	const UINT64 target = m_now + ticks;
+
+	while (m_now < target)
+	{
+		if (m_armed == 0)
+		{
+			m_now = target;
+			break;
+		}
+
+		// Skip to the next tick with work: an occupied level 0 slot, or the start
+		// of the next level 0 revolution where the outer levels cascade
+		UINT64 next = m_now + 1;
+		if ((next & SLOT_MASK) != 0)
+		{
+			INT slot = FindSlot(0, (INT)(next & SLOT_MASK));
+			if (slot < 0)
+				next = (next | SLOT_MASK) + 1;
+			else
+				next = (next & ~(UINT64)SLOT_MASK) | (UINT64)slot;
+			if (next > target)
+			{
+				m_now = target;
+				break;
+			}
+		}
+		m_now = next;
+
+		INT index = (INT)(m_now & SLOT_MASK);
+		if (index == 0)
+		{
+			// Cascade each outer level whose digit rolled over
+			for (INT level = 1; level < LEVELS; level++)
+			{
+				INT slot = (INT)((m_now >> (SLOT_BITS * level)) & SLOT_MASK);
+				Cascade(level, slot);
+				if (slot != 0)
+					break;
+			}
+		}
+
+		Expire(index);
+	}
+}
+
+//----------------------------------------------------------------------------
+// GetTicksToNextExpiry
+//----------------------------------------------------------------------------
+UINT64 TimerWheel::GetTicksToNextExpiry() const
+{
+	if (m_armed == 0)
+		return 0;
+
+	// A timer due within this level 0 revolution, else the next cascade
+	UINT64 next = m_now + 1;
+	if ((next & SLOT_MASK) != 0)
+	{
+		INT slot = FindSlot(0, (INT)(next & SLOT_MASK));
+		if (slot >= 0)
+			return ((next & ~(UINT64)SLOT_MASK) | (UINT64)slot) - m_now;
+		next = (next | SLOT_MASK) + 1;
+	}
+	return next - m_now;
+}
@@ -0,0 +1,117 @@
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#include "DataTypes.h"
+
+class WheelTimer;
+
+/// Called when a wheel timer expires.
+/// @param[in] timer - the expired timer, no longer armed.
+/// @param[in] context - the context given to WheelTimer::SetCallback().
+typedef void (*WheelTimerCallback)(WheelTimer* timer, void* context);
+
+/// @brief An intrusive timer node. The timer is owned by the client, typically
+/// embedded within the object being timed, so arming and cancelling never allocate.
+/// A timer must be cancelled, or have expired, before it is destroyed.
+class WheelTimer
+{
+public:
+	WheelTimer() : m_next(NULL), m_prev(NULL), m_expiry(0), m_callback(NULL), m_context(NULL) {}
+
+	/// Set the function called when the timer expires.
+	/// @param[in] callback - the expiry callback.
+	/// @param[in] context - passed to the callback.
+	void SetCallback(WheelTimerCallback callback, void* context) { m_callback = callback; m_context = context; }
+
+	/// Is the timer waiting to expire?
+	/// @return TRUE if armed.
+	BOOL IsArmed() const { return m_next != NULL; }
+
+	/// Gets the tick the timer expires on.
+	/// @return The expiry tick. Only valid while armed.
+	UINT64 GetExpiry() const { return m_expiry; }
+
+private:
+	friend class TimerWheel;
+
+	WheelTimer* m_next;
+	WheelTimer* m_prev;
+	UINT64 m_expiry;
+	WheelTimerCallback m_callback;
+	void* m_context;
+};
+
+/// @brief A hierarchical timing wheel. Four levels of 256 slots cover 2^32 ticks
+/// with O(1) arm and cancel. Timers in the outer levels cascade inward as time
+/// advances, so each timer moves at most three times before expiring. Timers
+/// further out than 2^32 ticks are parked in the outermost level and re-cascaded.
+///
+/// The wheel is tick based and doesn't read a clock. The owning thread calls
+/// Advance() or AdvanceTo() with elapsed ticks, for instance once per millisecond,
+/// and expired timer callbacks run on that thread. GetTicksToNextExpiry() tells
+/// the thread how long it may sleep. The wheel is not thread-safe; use one wheel
+/// per thread driving its own state machines.
+class TimerWheel
+{
+public:
+	TimerWheel();
+
+	/// Destructor. Armed timers are disarmed without their callbacks.
+	~TimerWheel();
+
+	/// Arm a timer. A timer already armed is re-armed.
+	/// @param[in] timer - the timer to arm.
+	/// @param[in] ticks - the ticks from now until expiry. 0 is treated as 1.
+	void Arm(WheelTimer& timer, UINT64 ticks);
+
+	/// Cancel a timer. Does nothing if the timer isn't armed.
+	/// @param[in] timer - a timer armed on this wheel, or not armed.
+	void Cancel(WheelTimer& timer);
+
+	/// Advance the wheel, running the callback of each timer that expires.
+	/// @param[in] ticks - the number of ticks elapsed.
+	void Advance(UINT64 ticks);
+
+	/// Advance the wheel to an absolute tick.
+	/// @param[in] now - the current tick. Earlier ticks are ignored.
+	void AdvanceTo(UINT64 now) { if (now > m_now) Advance(now - m_now); }
+
+	/// Gets the current tick.
+	/// @return The tick the wheel has advanced to.
+	UINT64 GetNow() const { return m_now; }
+
+	/// Gets the number of ticks until the next timer expires. The result may be
+	/// short of the true expiry when the next timer is in an outer level, in which
+	/// case advancing by the result cascades it and a later call is exact.
+	/// @return The ticks to the next expiry, or 0 if no timer is armed.
+	UINT64 GetTicksToNextExpiry() const;
+
+	/// Gets the number of armed timers.
+	/// @return The armed timer count.
+	UINT64 GetArmedCount() const { return m_armed; }
+
+private:
+	enum { LEVELS = 4, SLOT_BITS = 8, SLOTS = 1 << SLOT_BITS, SLOT_MASK = SLOTS - 1 };
+
+	TimerWheel(const TimerWheel&);
+	TimerWheel& operator=(const TimerWheel&);
+
+	void Insert(WheelTimer& timer);
+	void Cascade(INT level, INT slot);
+	void Expire(INT slot);
+	INT FindSlot(INT level, INT from) const;
+
+	static void Unlink(WheelTimer& timer);
+
+	/// Circular list heads, one per slot. Each is a sentinel timer.
+	WheelTimer m_slots[LEVELS][SLOTS];
+
+	/// A bit per slot that may be non-empty lets Advance() skip runs of empty
+	/// ticks. Cancel() leaves the bit set; it is cleared when the slot is next visited.
+	UINT64 m_occupied[LEVELS][SLOTS / 64];
+
+	UINT64 m_now;
+	UINT64 m_armed;
+};
+
+#endif
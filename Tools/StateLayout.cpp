@@ -0,0 +1,164 @@
+#include "StateMapLayout.h"
+#include "StateMachine.h"
+#include <ctype.h>
+#include <set>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Prints the profile guided state order of each state machine class in a
+// transition profile written by TransitionCoverage::WriteProfile(), with the
+// cache lines the hot state map rows and transition map cells take before and
+// after reordering.
+//
+//     StateLayout statemachine.profile [fraction]
+//
+// fraction is the share of the state map reads the counted rows cover, 0.9 by
+// default. The output is C++ source: a States enumeration in hot order, named
+// from the state names, and a table of the new number of each current state for
+// reordering the state map and transition map entries to match. States a base 
+// class declares keep their numbers, so take only the derived class states from
+// the order of a derived class.
+
+/// Gets the state enumeration identifier of a state, such as ST_WAIT_FOR_ACCELERATION
+/// for a state named WaitForAcceleration.
+/// @param[in] name - the state name, or NULL if unnamed.
+/// @param[in] state - the current state number.
+/// @return The identifier.
+static std::string GetIdentifier(const CHAR* name, BYTE state)
+{
+	if (name == NULL)
+	{
+		CHAR number[16];
+		snprintf(number, sizeof(number), "ST_STATE_%u", state);
+		return number;
+	}
+
+	std::string identifier = "ST_";
+	for (const CHAR* p = name; *p != 0; p++)
+	{
+		// A word starts at a capital after a lower case letter or digit, or at the
+		// last capital of an acronym
+		unsigned char c = (unsigned char)*p;
+		if (p != name && isupper(c))
+		{
+			unsigned char previous = (unsigned char)p[-1];
+			if (islower(previous) || isdigit(previous) || (isupper(previous) && islower((unsigned char)p[1])))
+				identifier += '_';
+		}
+		identifier += isalnum(c) ? (CHAR)toupper(c) : '_';
+	}
+	return identifier;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "usage: %s profile-file [fraction]\n", argv[0]);
+		return 2;
+	}
+
+	DOUBLE fraction = argc == 3 ? atof(argv[2]) : 0.9;
+	if (fraction <= 0.0 || fraction > 1.0)
+	{
+		fprintf(stderr, "%s: fraction must be above 0 and at most 1\n", argv[0]);
+		return 2;
+	}
+
+	FILE* in = fopen(argv[1], "r");
+	if (in == NULL)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	std::vector<TransitionCoverageCell> cells;
+	BOOL valid = StateMapLayout::ReadProfile(in, &cells);
+	fclose(in);
+	if (!valid)
+	{
+		fprintf(stderr, "%s: not a valid transition profile\n", argv[1]);
+		return 1;
+	}
+
+	std::set<std::string> machines;
+	for (size_t i = 0; i < cells.size(); i++)
+		machines.insert(cells[i].machineName);
+
+	for (std::set<std::string>::const_iterator it = machines.begin(); it != machines.end(); ++it)
+	{
+		UINT64 heat[256];
+		BYTE order[256];
+		StateMapLayout::GetHeat(&cells[0], (INT)cells.size(), it->c_str(), heat);
+		INT hot = StateMapLayout::GetHotOrder(heat, order);
+		if (hot == 0)
+			continue;
+
+		// State names as recorded, numbers for states declared without names. The
+		// profile lists every transition map cell, so names every mapped state.
+		const CHAR* names[256] = { NULL };
+		INT states = 0;
+		for (size_t i = 0; i < cells.size(); i++)
+		{
+			if (*it != cells[i].machineName)
+				continue;
+			if (cells[i].stateName != NULL)
+				names[cells[i].state] = cells[i].stateName;
+			if (cells[i].state >= states)
+				states = cells[i].state + 1;
+			if (cells[i].target < StateMachine::EVENT_PARENT)
+			{
+				if (cells[i].targetName != NULL)
+					names[cells[i].target] = cells[i].targetName;
+				if (cells[i].target >= states)
+					states = cells[i].target + 1;
+			}
+		}
+
+		// The row of each state once reordered, and the state of each row
+		BYTE slots[256], rows[256];
+		StateMapLayout::MakeSlots(order, hot, slots);
+		for (INT state = 0; state < states; state++)
+			rows[slots[state]] = (BYTE)state;
+
+		printf("// %s: %d hot states of %d\n", it->c_str(), hot, states);
+		printf("// Cache lines for %.0f%% of reads, state order -> hot order:\n", fraction * 100.0);
+		printf("//   StateMapRow         %4d -> %d\n",
+			StateMapLayout::CountLines(heat, NULL, sizeof(StateMapRow), fraction),
+			StateMapLayout::CountLines(heat, slots, sizeof(StateMapRow), fraction));
+		printf("//   StateMapRowEx       %4d -> %d\n",
+			StateMapLayout::CountLines(heat, NULL, sizeof(StateMapRowEx), fraction),
+			StateMapLayout::CountLines(heat, slots, sizeof(StateMapRowEx), fraction));
+		printf("//   Transition map row  %4d -> %d\n",
+			StateMapLayout::CountLines(heat, NULL, sizeof(BYTE), fraction),
+			StateMapLayout::CountLines(heat, slots, sizeof(BYTE), fraction));
+
+		printf("enum States\n{\n");
+		for (INT row = 0; row < states; row++)
+		{
+			BYTE state = rows[row];
+			std::string identifier = GetIdentifier(names[state], state);
+			printf("\t%-31s // %u", (identifier + ",").c_str(), state);
+			if (heat[state] != 0)
+				printf(", %llu reads", heat[state]);
+			printf("\n");
+		}
+		printf("\tST_MAX_STATES\n};\n");
+
+		// Class names may be qualified or templates
+		std::string table = *it;
+		for (size_t i = 0; i < table.size(); i++)
+		{
+			if (!isalnum((unsigned char)table[i]))
+				table[i] = '_';
+		}
+		printf("// New number of each current state\n");
+		printf("static const BYTE %s_STATE_SLOTS[] = {", table.c_str());
+		for (INT state = 0; state < states; state++)
+			printf("%s %u", state == 0 ? "" : ",", slots[state]);
+		printf(" };\n\n");
+	}
+	return 0;
+}
@@ -0,0 +1,42 @@
+#include "StateMachineTrace.h"
+#include <stdio.h>
+
+// Converts a transition trace written by StateMachineTrace::Dump() to text.
+//
+//     TraceDecode statemachine.trace [output.txt]
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "usage: %s trace-file [text-file]\n", argv[0]);
+		return 2;
+	}
+
+	FILE* in = fopen(argv[1], "rb");
+	if (in == NULL)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	FILE* out = stdout;
+	if (argc == 3 && (out = fopen(argv[2], "w")) == NULL)
+	{
+		perror(argv[2]);
+		fclose(in);
+		return 1;
+	}
+
+	INT records = StateMachineTrace::Decode(in, out);
+	fclose(in);
+	if (out != stdout)
+		fclose(out);
+
+	if (records < 0)
+	{
+		fprintf(stderr, "%s: not a valid transition trace\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include "TraceClock.h"
+#include <atomic>
+#if WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Timestamp counter calibration interval
+static const UINT64 CALIBRATE_NS = 10000000;
+
+#ifdef TRACE_CLOCK_TSC
+// Calibration start, taken when the program loads so that GetTicksPerSecond()
+// rarely has to wait
+static const UINT64 _startTicks = TraceClock::Now();
+static const UINT64 _startNs = TraceClock::NowNs();
+#endif
+
+static std::atomic<UINT64> _ticksPerSecond(0);
+
+//------------------------------------------------------------------------------
+// NowNs
+//------------------------------------------------------------------------------
+UINT64 TraceClock::NowNs()
+{
+#if WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (UINT64)((double)count.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (UINT64)ts.tv_sec * 1000000000ULL + (UINT64)ts.tv_nsec;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// GetTicksPerSecond
+//------------------------------------------------------------------------------
+UINT64 TraceClock::GetTicksPerSecond()
+{
+	UINT64 ticksPerSecond = _ticksPerSecond.load(std::memory_order_relaxed);
+	if (ticksPerSecond != 0)
+		return ticksPerSecond;
+
+#ifdef TRACE_CLOCK_TSC
+	UINT64 ns = NowNs();
+	while (ns - _startNs < CALIBRATE_NS)
+		ns = NowNs();
+	UINT64 ticks = Now();
+	ticksPerSecond = (UINT64)((double)(ticks - _startTicks) * 1e9 / (double)(ns - _startNs));
+#else
+	(void)CALIBRATE_NS;
+	ticksPerSecond = 1000000000ULL;
+#endif
+
+	_ticksPerSecond.store(ticksPerSecond, std::memory_order_relaxed);
+	return ticksPerSecond;
+}
+
+//------------------------------------------------------------------------------
+// ToNanoseconds
+//------------------------------------------------------------------------------
+UINT64 TraceClock::ToNanoseconds(UINT64 ticks)
+{
+	return (UINT64)((double)ticks * 1e9 / (double)GetTicksPerSecond());
+}
@@ -0,0 +1,57 @@
+#ifndef _TRACE_CLOCK_H
+#define _TRACE_CLOCK_H
+
+#include "DataTypes.h"
+
+// The trace clock reads the CPU timestamp counter on x86-64, a few cycles with no
+// system call, and the monotonic raw clock elsewhere. Define TRACE_CLOCK_MONOTONIC
+// to always use the monotonic clock, for instance on CPUs without an invariant TSC.
+//#define TRACE_CLOCK_MONOTONIC
+
+#if !defined(TRACE_CLOCK_MONOTONIC) && (defined(__x86_64__) || defined(_M_X64))
+#define TRACE_CLOCK_TSC
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#elif !WIN32
+#include <time.h>
+#endif
+
+/// @brief Low overhead timestamps for the state machine instrumentation. Ticks are
+/// converted to time with GetTicksPerSecond().
+class TraceClock
+{
+public:
+	/// Gets the current time.
+	/// @return The time in ticks.
+	static UINT64 Now()
+	{
+#if defined(TRACE_CLOCK_TSC)
+		return __rdtsc();
+#elif WIN32
+		return NowNs();
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+		return (UINT64)ts.tv_sec * 1000000000ULL + (UINT64)ts.tv_nsec;
+#endif
+	}
+
+	/// Gets the tick rate. With the timestamp counter, the first call calibrates
+	/// it against the monotonic clock, waiting up to 10ms.
+	/// @return The ticks per second.
+	static UINT64 GetTicksPerSecond();
+
+	/// Convert ticks to nanoseconds.
+	/// @param[in] ticks - a tick count, such as the difference of two Now() calls.
+	/// @return The nanoseconds.
+	static UINT64 ToNanoseconds(UINT64 ticks);
+
+	/// Gets the monotonic clock.
+	/// @return The time in nanoseconds.
+	static UINT64 NowNs();
+};
+
+#endif
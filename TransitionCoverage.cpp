@@ -0,0 +1,343 @@
+#include "TransitionCoverage.h"
+#include "StateMachine.h"
+#include <math.h>
+#include <mutex>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+static std::mutex _classesLock;
+static std::atomic<TransitionCoverage*> _classes(NULL);
+
+const CHAR TransitionCoverage::PROFILE_HEADER[] = "StateMachine transition profile 1";
+
+//------------------------------------------------------------------------------
+// InitCell
+//------------------------------------------------------------------------------
+static void InitCell(TransitionCoverage::Cell& cell, BYTE target)
+{
+	cell.hits.store(0, std::memory_order_relaxed);
+	cell.rejected.store(0, std::memory_order_relaxed);
+	cell.target = target;
+	cell.resolved.store(target, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// GetTargetLabel
+//------------------------------------------------------------------------------
+static const CHAR* GetTargetLabel(BYTE target, const CHAR* name, CHAR* buffer, size_t size)
+{
+	switch (target)
+	{
+	case StateMachine::EVENT_IGNORED:	return "EVENT_IGNORED";
+	case StateMachine::CANNOT_HAPPEN:	return "CANNOT_HAPPEN";
+	case StateMachine::EVENT_PARENT:	return "EVENT_PARENT";
+	default:
+		if (name != NULL)
+			return name;
+		snprintf(buffer, size, "%u", target);
+		return buffer;
+	}
+}
+
+//------------------------------------------------------------------------------
+// TransitionCoverage
+//------------------------------------------------------------------------------
+TransitionCoverage::TransitionCoverage(StateMachine* machine) :
+	m_typeName(typeid(*machine).name()),
+	m_states(machine->GetMaxStates()),
+	m_events(NULL),
+	m_next(NULL)
+{
+#if defined(__GNUG__)
+	INT status = 0;
+	CHAR* demangled = abi::__cxa_demangle(m_typeName, NULL, NULL, &status);
+	if (status == 0 && demangled != NULL)
+		m_machineName = demangled;
+	else
+		m_machineName = strdup(m_typeName);
+#else
+	m_machineName = _strdup(m_typeName);
+#endif
+
+	m_stateNames = new const CHAR*[m_states];
+	for (INT state = 0; state < m_states; state++)
+		m_stateNames[state] = machine->GetStateName((BYTE)state);
+
+	m_edges = new Cell[m_states * m_states];
+	for (INT i = 0; i < m_states * m_states; i++)
+		InitCell(m_edges[i], (BYTE)(i % m_states));
+}
+
+//------------------------------------------------------------------------------
+// FindLocked
+//------------------------------------------------------------------------------
+TransitionCoverage* TransitionCoverage::FindLocked(StateMachine* machine)
+{
+	const CHAR* typeName = typeid(*machine).name();
+	TransitionCoverage* coverage = _classes.load(std::memory_order_relaxed);
+	for (; coverage != NULL; coverage = coverage->m_next.load(std::memory_order_relaxed))
+	{
+		if (coverage->m_typeName == typeName || strcmp(coverage->m_typeName, typeName) == 0)
+			return coverage;
+	}
+
+	coverage = new TransitionCoverage(machine);
+	coverage->m_next.store(_classes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	_classes.store(coverage, std::memory_order_release);
+	return coverage;
+}
+
+//------------------------------------------------------------------------------
+// Find
+//------------------------------------------------------------------------------
+TransitionCoverage* TransitionCoverage::Find(StateMachine* machine)
+{
+	std::lock_guard<std::mutex> lock(_classesLock);
+	return FindLocked(machine);
+}
+
+//------------------------------------------------------------------------------
+// Register
+//------------------------------------------------------------------------------
+TransitionCoverage::EventRow* TransitionCoverage::Register(const CHAR* name,
+	const BYTE* transitions, BYTE states)
+{
+	std::lock_guard<std::mutex> lock(_classesLock);
+	for (EventRow* row = m_events.load(std::memory_order_relaxed); row != NULL; row = row->next)
+	{
+		if (row->transitions == transitions)
+			return row;
+	}
+
+	EventRow* row = new EventRow();
+	row->name = name;
+	row->transitions = transitions;
+	row->states = states;
+	row->cells = new Cell[states];
+	for (INT state = 0; state < states; state++)
+		InitCell(row->cells[state], transitions[state]);
+	row->next = m_events.load(std::memory_order_relaxed);
+	m_events.store(row, std::memory_order_release);
+	return row;
+}
+
+//------------------------------------------------------------------------------
+// GetCellCount
+//------------------------------------------------------------------------------
+INT TransitionCoverage::GetCellCount() const
+{
+	INT count = m_states * m_states;
+	for (EventRow* row = m_events.load(std::memory_order_acquire); row != NULL; row = row->next)
+		count += row->states;
+	return count;
+}
+
+//------------------------------------------------------------------------------
+// GetCells
+//------------------------------------------------------------------------------
+INT TransitionCoverage::GetCells(TransitionCoverageCell* cells, INT maxCells)
+{
+	INT count = 0;
+	for (TransitionCoverage* coverage = _classes.load(std::memory_order_acquire); coverage != NULL;
+		coverage = coverage->m_next.load(std::memory_order_relaxed))
+	{
+		// Transition map cells, every one listed so cells never hit show up
+		for (EventRow* row = coverage->m_events.load(std::memory_order_acquire); row != NULL; row = row->next)
+		{
+			for (INT state = 0; state < row->states && count < maxCells; state++)
+			{
+				const Cell& cell = row->cells[state];
+				TransitionCoverageCell& entry = cells[count++];
+				entry.machineName = coverage->m_machineName;
+				entry.eventName = row->name;
+				entry.state = (BYTE)state;
+				entry.stateName = coverage->m_stateNames[state];
+				entry.target = cell.target;
+				entry.targetName = entry.target < coverage->m_states ? coverage->m_stateNames[entry.target] : NULL;
+				entry.resolved = cell.resolved.load(std::memory_order_relaxed);
+				entry.resolvedName = entry.resolved < coverage->m_states ? coverage->m_stateNames[entry.resolved] : NULL;
+				entry.hits = cell.hits.load(std::memory_order_relaxed);
+				entry.ignored = entry.resolved == StateMachine::EVENT_IGNORED ? entry.hits : 0;
+				entry.rejected = cell.rejected.load(std::memory_order_relaxed);
+			}
+		}
+
+		// Edges taken outside a transition map, only those taken
+		for (INT i = 0; i < coverage->m_states * coverage->m_states && count < maxCells; i++)
+		{
+			const Cell& edge = coverage->m_edges[i];
+			UINT64 hits = edge.hits.load(std::memory_order_relaxed);
+			if (hits == 0)
+				continue;
+			TransitionCoverageCell& entry = cells[count++];
+			entry.machineName = coverage->m_machineName;
+			entry.eventName = NULL;
+			entry.state = (BYTE)(i / coverage->m_states);
+			entry.stateName = coverage->m_stateNames[entry.state];
+			entry.target = (BYTE)(i % coverage->m_states);
+			entry.targetName = coverage->m_stateNames[entry.target];
+			entry.resolved = entry.target;
+			entry.resolvedName = entry.targetName;
+			entry.hits = hits;
+			entry.ignored = 0;
+			entry.rejected = edge.rejected.load(std::memory_order_relaxed);
+		}
+	}
+	return count;
+}
+
+//------------------------------------------------------------------------------
+// Snapshot
+//------------------------------------------------------------------------------
+std::vector<TransitionCoverageCell> TransitionCoverage::Snapshot()
+{
+	INT maxCells = 0;
+	for (TransitionCoverage* coverage = _classes.load(std::memory_order_acquire); coverage != NULL;
+		coverage = coverage->m_next.load(std::memory_order_relaxed))
+		maxCells += coverage->GetCellCount();
+
+	std::vector<TransitionCoverageCell> cells(maxCells > 0 ? maxCells : 1);
+	cells.resize(GetCells(&cells[0], maxCells));
+	return cells;
+}
+
+//------------------------------------------------------------------------------
+// Dump
+//------------------------------------------------------------------------------
+void TransitionCoverage::Dump(FILE* fp)
+{
+	std::vector<TransitionCoverageCell> cells = Snapshot();
+
+	INT hit = 0, total = 0;
+	fprintf(fp, "%-24s %-20s %-20s %-20s %10s %10s %10s\n", "Machine", "Event", "State", "Target",
+		"Hits", "Ignored", "Rejected");
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		const TransitionCoverageCell& cell = cells[i];
+		CHAR state[32], target[32];
+		fprintf(fp, "%-24s %-20s %-20s %-20s %10llu %10llu %10llu\n", cell.machineName,
+			cell.eventName != NULL ? cell.eventName : "(no map)",
+			GetTargetLabel(cell.state, cell.stateName, state, sizeof(state)),
+			GetTargetLabel(cell.target, cell.targetName, target, sizeof(target)),
+			cell.hits, cell.ignored, cell.rejected);
+
+		// A CANNOT_HAPPEN cell is covered by never being hit
+		if (cell.eventName != NULL && cell.target != StateMachine::CANNOT_HAPPEN)
+		{
+			total++;
+			if (cell.hits != 0)
+				hit++;
+		}
+	}
+	fprintf(fp, "Transition map coverage: %d of %d cells hit\n", hit, total);
+}
+
+//------------------------------------------------------------------------------
+// WriteGraphviz
+//------------------------------------------------------------------------------
+void TransitionCoverage::WriteGraphviz(FILE* fp)
+{
+	std::vector<TransitionCoverageCell> cells = Snapshot();
+
+	fprintf(fp, "digraph StateMachines {\n");
+	fprintf(fp, "\tnode [shape=box, style=rounded];\n");
+
+	INT cluster = 0;
+	for (TransitionCoverage* coverage = _classes.load(std::memory_order_acquire); coverage != NULL;
+		coverage = coverage->m_next.load(std::memory_order_relaxed), cluster++)
+	{
+		UINT64 maxHits = 1;
+		for (size_t i = 0; i < cells.size(); i++)
+		{
+			if (cells[i].machineName == coverage->m_machineName && cells[i].hits > maxHits)
+				maxHits = cells[i].hits;
+		}
+
+		fprintf(fp, "\tsubgraph cluster_%d {\n", cluster);
+		fprintf(fp, "\t\tlabel=\"%s\";\n", coverage->m_machineName);
+		for (INT state = 0; state < coverage->m_states; state++)
+		{
+			CHAR name[32];
+			fprintf(fp, "\t\ts%d_%d [label=\"%s\"];\n", cluster, state,
+				GetTargetLabel((BYTE)state, coverage->m_stateNames[state], name, sizeof(name)));
+		}
+
+		for (size_t i = 0; i < cells.size(); i++)
+		{
+			const TransitionCoverageCell& cell = cells[i];
+			if (cell.machineName != coverage->m_machineName)
+				continue;
+
+			// Ignored events loop back to the state they were ignored in. An EVENT_PARENT
+			// entry is drawn to the transition it resolved to.
+			BOOL ignored = cell.resolved == StateMachine::EVENT_IGNORED;
+			BYTE target = ignored ? cell.state : cell.resolved;
+			if (target >= coverage->m_states)
+				continue;
+
+			// Edges taken outside a transition map are labelled by count alone
+			fprintf(fp, "\t\ts%d_%d -> s%d_%d [label=\"", cluster, cell.state, cluster, target);
+			if (cell.eventName != NULL)
+				fprintf(fp, "%s%s%s ", cell.eventName, 
+					cell.target == StateMachine::EVENT_PARENT ? " (parent)" : "", ignored ? " (ignored)" : "");
+			fprintf(fp, "%llu", cell.hits);
+			if (cell.rejected != 0)
+				fprintf(fp, ", %llu rejected", cell.rejected);
+			if (cell.hits == 0)
+				fprintf(fp, "\", style=dashed, color=gray];\n");
+			else
+			{
+				// Width grows with the log of the hit count relative to the hottest edge
+				DOUBLE width = 1.0 + 4.0 * log((DOUBLE)cell.hits + 1.0) / log((DOUBLE)maxHits + 1.0);
+				fprintf(fp, "\", penwidth=%.2f%s];\n", width,
+					ignored ? ", style=dotted" : "");
+			}
+		}
+		fprintf(fp, "\t}\n");
+	}
+	fprintf(fp, "}\n");
+}
+
+//------------------------------------------------------------------------------
+// WriteProfile
+//------------------------------------------------------------------------------
+void TransitionCoverage::WriteProfile(FILE* fp)
+{
+	std::vector<TransitionCoverageCell> cells = Snapshot();
+	fprintf(fp, "%s\n", PROFILE_HEADER);
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		const TransitionCoverageCell& cell = cells[i];
+		fprintf(fp, "%s\t%s\t%u\t%u\t%llu\t%s\t%s\n", cell.machineName,
+			cell.eventName != NULL ? cell.eventName : "", cell.state, cell.resolved, cell.hits,
+			cell.stateName != NULL ? cell.stateName : "", cell.resolvedName != NULL ? cell.resolvedName : "");
+	}
+}
+
+//------------------------------------------------------------------------------
+// Reset
+//------------------------------------------------------------------------------
+void TransitionCoverage::Reset()
+{
+	for (TransitionCoverage* coverage = _classes.load(std::memory_order_acquire); coverage != NULL;
+		coverage = coverage->m_next.load(std::memory_order_relaxed))
+	{
+		for (EventRow* row = coverage->m_events.load(std::memory_order_acquire); row != NULL; row = row->next)
+		{
+			for (INT state = 0; state < row->states; state++)
+			{
+				row->cells[state].hits.store(0, std::memory_order_relaxed);
+				row->cells[state].rejected.store(0, std::memory_order_relaxed);
+			}
+		}
+		for (INT i = 0; i < coverage->m_states * coverage->m_states; i++)
+		{
+			coverage->m_edges[i].hits.store(0, std::memory_order_relaxed);
+			coverage->m_edges[i].rejected.store(0, std::memory_order_relaxed);
+		}
+	}
+}
@@ -0,0 +1,177 @@
+#ifndef _TRANSITION_COVERAGE_H
+#define _TRANSITION_COVERAGE_H
+
+#include "DataTypes.h"
+#include <atomic>
+#include <stdio.h>
+#include <vector>
+
+// Define STATE_MACHINE_COVERAGE to count the hits of every transition map cell.
+// Normally defined by the build (see the STATE_MACHINE_COVERAGE CMake option).
+//#define STATE_MACHINE_COVERAGE
+
+class StateMachine;
+
+/// Counts of one transition map cell, or of one edge taken outside a transition map
+typedef struct
+{
+	const CHAR* machineName;	///< State machine type name
+	const CHAR* eventName;		///< External event function, or NULL for an edge taken
+								///< outside a transition map, such as by an internal event
+	BYTE state;					///< Current state
+	const CHAR* stateName;		///< Current state name or NULL if unnamed
+	BYTE target;				///< Transition map entry, such as a state or EVENT_IGNORED
+	const CHAR* targetName;		///< Target state name or NULL
+	BYTE resolved;				///< The transition an EVENT_PARENT entry resolved to, 
+								///< otherwise target
+	const CHAR* resolvedName;	///< Resolved state name or NULL
+	UINT64 hits;				///< Events sent in the current state
+	UINT64 ignored;				///< Hits ignored
+	UINT64 rejected;			///< Hits rejected by the target state guard condition
+} TransitionCoverageCell;
+
+/// @brief Transition coverage and hotness counters. Each BEGIN_TRANSITION_MAP /
+/// END_TRANSITION_MAP external event function gets a row of counters indexed by
+/// current state like its transition map, counting the events sent, ignored and
+/// rejected by a guard condition in each state. Transitions not made through a
+/// transition map, such as internal events, are counted per (source, target)
+/// state pair. Counters are relaxed atomics, so any thread may send events.
+///
+/// Dump() lists every cell including those never hit, and WriteGraphviz() draws
+/// the state diagram of each class with edges weighted by hit count.
+class TransitionCoverage
+{
+public:
+	/// @brief The counters of one transition map cell.
+	struct Cell
+	{
+		std::atomic<UINT64> hits;
+		std::atomic<UINT64> rejected;
+		BYTE target;					///< The declared transition map entry
+		std::atomic<BYTE> resolved;		///< The transition target resolved to
+	};
+
+	/// @brief The counters of one external event function, one cell per state.
+	struct EventRow
+	{
+		const CHAR* name;			///< Event function name
+		const BYTE* transitions;	///< The transition map
+		BYTE states;				///< Transition map entries
+		Cell* cells;
+		EventRow* next;
+
+		/// Count an event sent in a state.
+		/// @param[in] state - the current state.
+		/// @param[in] resolved - the transition taken, with EVENT_PARENT resolved.
+		/// @return The cell counted.
+		Cell* Hit(BYTE state, BYTE resolved)
+		{
+			Cell* cell = &cells[state];
+			cell->hits.fetch_add(1, std::memory_order_relaxed);
+			if (resolved != cell->target)
+				cell->resolved.store(resolved, std::memory_order_relaxed);
+			return cell;
+		}
+	};
+
+	/// Gets the counters of an external event function of this class, creating 
+	/// them on first use. An event function inherited from a base class gets a row 
+	/// in each class it is sent to. Called by END_TRANSITION_MAP.
+	/// @param[in] name - the event function name.
+	/// @param[in] transitions - the transition map, identifying the row.
+	/// @param[in] states - the transition map entries, which a hierarchical state
+	///		machine may have fewer of than states.
+	/// @return The event counters, which live until the program exits.
+	EventRow* GetRow(const CHAR* name, const BYTE* transitions, BYTE states)
+	{
+		for (EventRow* row = m_events.load(std::memory_order_acquire); row != NULL; row = row->next)
+		{
+			if (row->transitions == transitions)
+				return row;
+		}
+		return Register(name, transitions, states);
+	}
+
+	/// Gets the counters of a state machine class, creating them on first use.
+	/// @param[in] machine - a state machine of the class, providing the names.
+	/// @return The class counters, which live until the program exits.
+	static TransitionCoverage* Find(StateMachine* machine);
+
+	/// Count a transition or guard rejection. Called by the state engine.
+	/// @param[in] cell - the cell of the external event being run, or NULL.
+	/// @param[in] source - the current state.
+	/// @param[in] target - the new state.
+	/// @param[in] external - TRUE for the first transition of an external event.
+	/// @param[in] rejected - TRUE if a guard condition rejected the transition.
+	void Transition(Cell* cell, BYTE source, BYTE target, BOOL external, BOOL rejected)
+	{
+		if (external && cell != NULL)
+		{
+			// The hit was counted by the transition map
+			if (rejected)
+				cell->rejected.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		Cell& edge = m_edges[source * m_states + target];
+		edge.hits.fetch_add(1, std::memory_order_relaxed);
+		if (rejected)
+			edge.rejected.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/// Take a snapshot of every transition map cell and every edge taken outside
+	/// a transition map, of every class.
+	/// @param[out] cells - array receiving one entry per cell.
+	/// @param[in] maxCells - the number of entries in cells.
+	/// @return The number of entries stored.
+	static INT GetCells(TransitionCoverageCell* cells, INT maxCells);
+
+	/// Write a table of every cell, including cells never hit.
+	/// @param[in] fp - the output file.
+	static void Dump(FILE* fp);
+
+	/// Write a Graphviz state diagram per class. Edge labels and widths follow the
+	/// hit counts; edges never taken are dashed.
+	/// @param[in] fp - the output file.
+	static void WriteGraphviz(FILE* fp);
+
+	/// Write a profile, a tab separated line per cell of machine, event, state, 
+	/// target, hits, state name and target name, after a PROFILE_HEADER line. Every
+	/// transition map cell is listed, naming every mapped state, and every edge 
+	/// taken outside a transition map. The target is the transition taken, with 
+	/// EVENT_PARENT resolved. See StateMapLayout.
+	/// @param[in] fp - the output file.
+	static void WriteProfile(FILE* fp);
+
+	/// Discard the counts of every class.
+	static void Reset();
+
+	/// The first line of a profile
+	static const CHAR PROFILE_HEADER[];
+
+private:
+	TransitionCoverage(StateMachine* machine);
+	TransitionCoverage(const TransitionCoverage&);
+	TransitionCoverage& operator=(const TransitionCoverage&);
+
+	/// Add the counters of an external event function unless another thread did.
+	EventRow* Register(const CHAR* name, const BYTE* transitions, BYTE states);
+
+	/// Gets the class counters. Called with the registry lock held.
+	static TransitionCoverage* FindLocked(StateMachine* machine);
+
+	/// Gets the number of cells of the class.
+	INT GetCellCount() const;
+
+	/// Take a snapshot of every cell of every class.
+	static std::vector<TransitionCoverageCell> Snapshot();
+
+	const CHAR* const m_typeName;
+	CHAR* m_machineName;
+	const BYTE m_states;
+	const CHAR** m_stateNames;
+	std::atomic<EventRow*> m_events;
+	Cell* m_edges;
+	std::atomic<TransitionCoverage*> m_next;
+};
+
+#endif
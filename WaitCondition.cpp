@@ -0,0 +1,141 @@
+#include "WaitCondition.h"
+#include "StateMachine.h"
+#include <vector>
+
+//----------------------------------------------------------------------------
+// WaitCondition
+//----------------------------------------------------------------------------
+WaitCondition::WaitCondition()
+{
+	m_head.m_next = m_head.m_prev = &m_head;
+}
+
+//----------------------------------------------------------------------------
+// ~WaitCondition
+//----------------------------------------------------------------------------
+WaitCondition::~WaitCondition()
+{
+	while (HasWaiters())
+		Remove(*m_head.m_next);
+}
+
+//----------------------------------------------------------------------------
+// Add
+//----------------------------------------------------------------------------
+void WaitCondition::Add(WaitLink& link)
+{
+	link.m_pCondition = this;
+	link.m_next = &m_head;
+	link.m_prev = m_head.m_prev;
+	m_head.m_prev->m_next = &link;
+	m_head.m_prev = &link;
+}
+
+//----------------------------------------------------------------------------
+// Remove
+//----------------------------------------------------------------------------
+void WaitCondition::Remove(WaitLink& link)
+{
+	if (link.m_pCondition == NULL)
+		return;
+	link.m_prev->m_next = link.m_next;
+	link.m_next->m_prev = link.m_prev;
+	link.m_next = link.m_prev = NULL;
+	link.m_pCondition = NULL;
+}
+
+//----------------------------------------------------------------------------
+// Wake
+//----------------------------------------------------------------------------
+void WaitCondition::Wake(BOOL all)
+{
+	// Move the waiters to be woken onto a local list first. A woken machine may
+	// park again, here or on another condition, or unpark other waiters.
+	WaitLink woken;
+	woken.m_next = woken.m_prev = &woken;
+
+	WaitLink* link = m_head.m_next;
+	while (link != &m_head)
+	{
+		WaitLink* next = link->m_next;
+		if (all || IsSatisfied(*link))
+		{
+			Remove(*link);
+			link->m_pCondition = this;
+			link->m_next = &woken;
+			link->m_prev = woken.m_prev;
+			woken.m_prev->m_next = link;
+			woken.m_prev = link;
+		}
+		link = next;
+	}
+
+	while (woken.m_next != &woken)
+	{
+		WaitLink* waiter = woken.m_next;
+		Remove(*waiter);
+		waiter->m_pMachine->Wake();
+	}
+}
+
+//----------------------------------------------------------------------------
+// WaitValue::Set
+//----------------------------------------------------------------------------
+void WaitValue::Set(INT64 value)
+{
+	m_value = value;
+	if (HasWaiters())
+		Wake(FALSE);
+}
+
+//----------------------------------------------------------------------------
+// WaitValue::IsSatisfied
+//----------------------------------------------------------------------------
+BOOL WaitValue::IsSatisfied(const WaitLink& link) const
+{
+	switch (link.m_compare)
+	{
+	case WAIT_EQUAL:			return m_value == link.m_threshold;
+	case WAIT_NOT_EQUAL:		return m_value != link.m_threshold;
+	case WAIT_LESS:				return m_value < link.m_threshold;
+	case WAIT_LESS_EQUAL:		return m_value <= link.m_threshold;
+	case WAIT_GREATER:			return m_value > link.m_threshold;
+	case WAIT_GREATER_EQUAL:	return m_value >= link.m_threshold;
+	default:					return FALSE;
+	}
+}
+
+#if !WIN32
+//----------------------------------------------------------------------------
+// WaitFd::Poll
+//----------------------------------------------------------------------------
+INT WaitFd::Poll(WaitFd* const* fds, INT count, INT timeoutMs)
+{
+	std::vector<struct pollfd> pollFds;
+	std::vector<WaitFd*> waited;
+	pollFds.reserve(count);
+	waited.reserve(count);
+	for (INT i = 0; i < count; i++)
+	{
+		if (fds[i] == NULL || !fds[i]->HasWaiters())
+			continue;
+		struct pollfd pfd;
+		pfd.fd = fds[i]->m_fd;
+		pfd.events = fds[i]->m_events;
+		pfd.revents = 0;
+		pollFds.push_back(pfd);
+		waited.push_back(fds[i]);
+	}
+
+	INT ready = poll(pollFds.empty() ? NULL : &pollFds[0], (nfds_t)pollFds.size(), timeoutMs);
+	if (ready <= 0)
+		return ready;
+
+	for (size_t i = 0; i < pollFds.size(); i++)
+	{
+		if (pollFds[i].revents != 0)
+			waited[i]->WakeAll();
+	}
+	return ready;
+}
+#endif
@@ -0,0 +1,150 @@
+#ifndef _WAIT_CONDITION_H
+#define _WAIT_CONDITION_H
+
+#include "DataTypes.h"
+#if !WIN32
+#include <poll.h>
+#endif
+
+class StateMachine;
+class WaitCondition;
+
+/// @brief Intrusive link parking a state machine on a WaitCondition. Each
+/// StateMachine embeds one, so a machine waits on at most one condition at a time
+/// and parking never allocates.
+class WaitLink
+{
+public:
+	WaitLink() : m_next(NULL), m_prev(NULL), m_pCondition(NULL), m_pMachine(NULL), m_threshold(0), m_compare(0) {}
+
+	/// Is the state machine parked on a condition?
+	/// @return TRUE if waiting.
+	BOOL IsWaiting() const { return m_pCondition != NULL; }
+
+private:
+	friend class WaitCondition;
+	friend class WaitValue;
+	friend class StateMachine;
+
+	WaitLink* m_next;
+	WaitLink* m_prev;
+	WaitCondition* m_pCondition;
+	StateMachine* m_pMachine;
+
+	/// Per waiter arguments used by WaitValue
+	INT64 m_threshold;
+	INT m_compare;
+};
+
+/// @brief A condition state machines park on with StateMachine::WaitFor(). A
+/// parked machine costs nothing until the condition fires, which wakes it with an
+/// external event to the state given when it parked. A machine leaving its state
+/// by any other route is unparked by the state engine.
+///
+/// Conditions are not thread-safe. Fire them on the thread that runs the state
+/// machines waiting on them.
+class WaitCondition
+{
+public:
+	WaitCondition();
+
+	/// Destructor. Waiters are released without being woken.
+	virtual ~WaitCondition();
+
+	/// Are any state machines parked on this condition?
+	/// @return TRUE if there are waiters.
+	BOOL HasWaiters() const { return m_head.m_next != &m_head; }
+
+	/// Wake every state machine parked on this condition.
+	void WakeAll() { Wake(TRUE); }
+
+protected:
+	/// Checked for each waiter when it parks and when Wake() is called. A waiter
+	/// already satisfied when it parks transitions at once.
+	/// @param[in] link - the waiter.
+	/// @return TRUE if the waiter should wake.
+	virtual BOOL IsSatisfied(const WaitLink& link) const { (void)link; return FALSE; }
+
+	/// Wake waiters. Each is unparked before its state machine runs, so a woken
+	/// machine may park on this condition again without being woken twice.
+	/// @param[in] all - TRUE to wake every waiter, FALSE to wake only waiters
+	///		satisfying IsSatisfied().
+	void Wake(BOOL all);
+
+private:
+	friend class StateMachine;
+
+	WaitCondition(const WaitCondition&);
+	WaitCondition& operator=(const WaitCondition&);
+
+	void Add(WaitLink& link);
+	static void Remove(WaitLink& link);
+
+	/// Circular list head of the parked state machines
+	WaitLink m_head;
+};
+
+/// @brief A value state machines wait on reaching a threshold, such as a sensor
+/// reading. Set() wakes only the waiters whose comparison now holds.
+class WaitValue : public WaitCondition
+{
+public:
+	/// Comparison of the value against a waiter threshold
+	enum Compare
+	{
+		WAIT_EQUAL,
+		WAIT_NOT_EQUAL,
+		WAIT_LESS,
+		WAIT_LESS_EQUAL,
+		WAIT_GREATER,
+		WAIT_GREATER_EQUAL
+	};
+
+	WaitValue(INT64 value = 0) : m_value(value) {}
+
+	/// Update the value and wake the waiters it satisfies.
+	/// @param[in] value - the new value.
+	void Set(INT64 value);
+
+	/// Gets the value.
+	/// @return The current value.
+	INT64 Get() const { return m_value; }
+
+protected:
+	virtual BOOL IsSatisfied(const WaitLink& link) const;
+
+private:
+	INT64 m_value;
+};
+
+#if !WIN32
+/// @brief A file descriptor state machines wait on becoming ready, such as a
+/// socket or a pipe. Poll() blocks the calling thread in poll() on every
+/// descriptor with waiters and wakes those that are ready.
+class WaitFd : public WaitCondition
+{
+public:
+	/// Constructor
+	/// @param[in] fd - the file descriptor.
+	/// @param[in] events - the poll() events to wait for.
+	WaitFd(INT fd, SHORT events = POLLIN) : m_fd(fd), m_events(events) {}
+
+	/// Gets the file descriptor.
+	/// @return The file descriptor.
+	INT GetFd() const { return m_fd; }
+
+	/// Wait for descriptors to become ready and wake their waiters.
+	/// @param[in] fds - the descriptors. Those without waiters are skipped.
+	/// @param[in] count - the number of descriptors.
+	/// @param[in] timeoutMs - the longest time to block, or -1 for no limit. Use
+	///		TimerWheel::GetTicksToNextExpiry() to also serve timers.
+	/// @return The number of descriptors ready, 0 on timeout or -1 on error.
+	static INT Poll(WaitFd* const* fds, INT count, INT timeoutMs);
+
+private:
+	INT m_fd;
+	SHORT m_events;
+};
+#endif
+
+#endif
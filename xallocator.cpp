@@ -1,8 +1,18 @@
 #include "xallocator.h"
 #include "Allocator.h"
 #include "Fault.h"
+#ifdef ALLOC_SAMPLING
+#include "AllocProfiler.h"
+#endif
 #include <iostream>
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <atomic>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 using namespace std;
 
@@ -11,42 +21,229 @@ using namespace std;
 #endif
 
 #if WIN32
-// @TODO Create a lock for non-Windows platforms when using an operating system
 static CRITICAL_SECTION _criticalSection; 
+#else
+#include <pthread.h>
+static pthread_mutex_t _mutex;
 #endif 
 
 static BOOL _xallocInitialized = FALSE;
 
+// Number of allocators published to the lock-free statistics snapshot
+static std::atomic<INT> _allocatorCount(0);
+
+// High water mark policy applied to each allocator. See xalloc_set_high_water_mark().
+static size_t _highWaterMark = 0;
+static UINT _trimKeepBlocks = 0;
+
+// Blocks larger than the largest size class obtained from the system heap
+static StatCounter<UINT64> _systemBlocksInUse;
+static StatCounter<size_t> _systemBytesInUse;
+
+// xrealloc() calls satisfied within the existing block (hits) or moved to a 
+// block from another size class (misses)
+static StatCounter<UINT64> _reallocHits;
+static StatCounter<UINT64> _reallocMisses;
+
+// Action taken when a pool allocator is exhausted. See xalloc_set_overflow_policy().
+static XallocOverflowPolicy _overflowPolicy = XALLOC_OVERFLOW_ASSERT;
+
+// Backing memory for allocators created from now on. NULL is the system heap.
+static MemoryProvider* _memoryProvider = NULL;
+
+// Blocks borrowed from a larger size class because the requested class was exhausted
+static StatCounter<UINT64> _borrows;
+
+// Allocations that returned NULL because the size class was exhausted
+static StatCounter<UINT64> _failures;
+
 // Define STATIC_POOLS to switch from heap blocks mode to static pools mode
 //#define STATIC_POOLS 
 #ifdef STATIC_POOLS
-	// Update this section as necessary if you want to use static memory pools.
-	// See also xalloc_init() and xalloc_destroy() for additional updates required.
-	#define MAX_ALLOCATORS	12
+	/// @brief A static pool size class. The pool block size in bytes, including the
+	/// Allocator* block header, the number of blocks and an optional block alignment.
+	/// Static storage for the Allocator instance and its blocks is generated per class.
+	template <size_t BlockSize, UINT Blocks, size_t Alignment = 0>
+	struct XallocPool
+	{
+		static const size_t BLOCK_SIZE = BlockSize;
+		static const UINT BLOCKS = Blocks;
+		static const size_t ALIGNMENT = Alignment;
+
+		static_assert(BlockSize % sizeof(Allocator*) == 0, "Block size must keep blocks pointer aligned");
+		static_assert(Alignment == 0 || BlockSize % Alignment == 0, "Block size must be a multiple of the alignment");
+		static_assert(Blocks > 0, "Pool must have at least one block");
+
+		/// Construct the allocator within its static storage.
+		/// @return The allocator instance.
+		static Allocator* Create()
+		{
+			return new (allocator) Allocator(BlockSize, Blocks, memory, "xallocator", 0, Alignment);
+		}
+
+		alignas(Allocator) static inline CHAR allocator[sizeof(Allocator)];
+		alignas(Alignment > 16 ? Alignment : 16) static inline CHAR memory[BlockSize * Blocks];
+	};
+
+	/// @brief The list of static pools, sorted by ascending block size. Generates the 
+	/// pool construction and destruction code and a table mapping a block size to 
+	/// the smallest default alignment pool holding it. 
+	template <class... Pools>
+	struct XallocPools
+	{
+		static const INT COUNT = sizeof...(Pools);
+
+		/// The largest block size of any default alignment pool. Aligned pools pad the
+		/// block header out to their alignment so never serve unaligned requests.
+		static constexpr size_t MaxBlockSize()
+		{
+			const size_t sizes[] = { Pools::BLOCK_SIZE... };
+			const size_t alignments[] = { Pools::ALIGNMENT... };
+			size_t max = 0;
+			for (INT i = 0; i < COUNT; i++)
+			{
+				if (alignments[i] == 0 && sizes[i] > max)
+					max = sizes[i];
+			}
+			return max;
+		}
+
+		/// Granularity of the block size lookup table
+		static const size_t GRANULE = sizeof(Allocator*);
+		static const size_t LOOKUP_SIZE = MaxBlockSize() / GRANULE + 1;
+
+		/// A lookup table entry per GRANULE bytes of block size holding a pool index
+		struct Lookup
+		{
+			BYTE index[LOOKUP_SIZE];
+		};
+
+		/// Build the block size lookup table at compile time. Every entry up to 
+		/// MaxBlockSize() selects a default alignment pool; larger requests come 
+		/// from the system heap.
+		static constexpr Lookup BuildLookup()
+		{
+			const size_t sizes[] = { Pools::BLOCK_SIZE... };
+			const size_t alignments[] = { Pools::ALIGNMENT... };
+			Lookup lookup = {};
+			for (size_t granule = 0; granule < LOOKUP_SIZE; granule++)
+			{
+				for (INT i = COUNT - 1; i >= 0; i--)
+				{
+					if (alignments[i] == 0 && sizes[i] >= granule * GRANULE)
+						lookup.index[granule] = (BYTE)i;
+				}
+			}
+			return lookup;
+		}
+
+		/// Check pools are sorted by ascending block size
+		static constexpr bool IsSorted()
+		{
+			const size_t sizes[] = { Pools::BLOCK_SIZE... };
+			for (INT i = 1; i < COUNT; i++)
+			{
+				if (sizes[i] < sizes[i-1])
+					return false;
+			}
+			return true;
+		}
+
+		static_assert(COUNT > 0 && COUNT < 256, "Between 1 and 255 static pools required");
+		static_assert(IsSorted(), "Static pools must be sorted by ascending block size");
+		static_assert(((Pools::ALIGNMENT == 0) || ...), "At least one default alignment pool required");
+
+		/// Construct every pool allocator.
+		/// @param[out] allocators - array of COUNT allocator pointers to populate.
+		static void Create(Allocator** allocators)
+		{
+			INT i = 0;
+			((allocators[i++] = Pools::Create()), ...);
+		}
+	};
+
+	// Static pool size classes. Update this list as necessary, or define 
+	// XALLOC_STATIC_POOLS_CONFIG to the name of a header file declaring its own 
+	// XallocStaticPools, for instance sized from a measured allocation histogram. 
+	#ifdef XALLOC_STATIC_POOLS_CONFIG
+	#include XALLOC_STATIC_POOLS_CONFIG
+	#else
 	#define MAX_BLOCKS		32
+	typedef XallocPools<
+		XallocPool<8, MAX_BLOCKS>,
+		XallocPool<16, MAX_BLOCKS>,
+		XallocPool<32, MAX_BLOCKS>,
+		XallocPool<64, MAX_BLOCKS>,
+		XallocPool<128, MAX_BLOCKS>,
+		XallocPool<256, MAX_BLOCKS>,
+		XallocPool<400, MAX_BLOCKS>,
+		XallocPool<512, MAX_BLOCKS>,
+		XallocPool<768, MAX_BLOCKS>,
+		XallocPool<1024, MAX_BLOCKS>,
+		XallocPool<2048, MAX_BLOCKS>,
+		XallocPool<4096, MAX_BLOCKS>
+	> XallocStaticPools;
+	#endif
+
+	#define MAX_ALLOCATORS	XallocStaticPools::COUNT
 
-	// Create static storage for each static allocator instance
-	CHAR* _allocator8 [sizeof(AllocatorPool<CHAR[8], MAX_BLOCKS>)];
-	CHAR* _allocator16 [sizeof(AllocatorPool<CHAR[16], MAX_BLOCKS>)];
-	CHAR* _allocator32 [sizeof(AllocatorPool<CHAR[32], MAX_BLOCKS>)];
-	CHAR* _allocator64 [sizeof(AllocatorPool<CHAR[64], MAX_BLOCKS>)];
-	CHAR* _allocator128 [sizeof(AllocatorPool<CHAR[128], MAX_BLOCKS>)];
-	CHAR* _allocator256 [sizeof(AllocatorPool<CHAR[256], MAX_BLOCKS>)];
-	CHAR* _allocator396 [sizeof(AllocatorPool<CHAR[396], MAX_BLOCKS>)];
-	CHAR* _allocator512 [sizeof(AllocatorPool<CHAR[512], MAX_BLOCKS>)];
-	CHAR* _allocator768 [sizeof(AllocatorPool<CHAR[768], MAX_BLOCKS>)];
-	CHAR* _allocator1024 [sizeof(AllocatorPool<CHAR[1024], MAX_BLOCKS>)];
-	CHAR* _allocator2048 [sizeof(AllocatorPool<CHAR[2048], MAX_BLOCKS>)];	
-	CHAR* _allocator4096 [sizeof(AllocatorPool<CHAR[4096], MAX_BLOCKS>)];
+	// Requests larger than the largest default alignment static pool come from 
+	// the system heap
+	#define XALLOC_MAX_BLOCK_SIZE	XallocStaticPools::MaxBlockSize()
+
+	// Block size to pool index lookup table generated at compile time
+	static constexpr XallocStaticPools::Lookup _poolLookup = XallocStaticPools::BuildLookup();
 
 	// Array of pointers to all allocator instances
 	static Allocator* _allocators[MAX_ALLOCATORS];
 
 #else
-	#define MAX_ALLOCATORS  15
+	#define MAX_ALLOCATORS  24
 	static Allocator* _allocators[MAX_ALLOCATORS];
+
+	// Requests with a block size above XALLOC_MAX_BLOCK_SIZE come from the system 
+	// heap rather than creating ever larger size classes
+	#ifndef XALLOC_MAX_BLOCK_SIZE
+	#define XALLOC_MAX_BLOCK_SIZE	32768
+	#endif
+
+	// Define XALLOC_CHUNK_BLOCKS to a non-zero value to have each heap allocator 
+	// obtain its blocks in contiguous, geometrically growing chunks rather than 
+	// one heap allocation per block. The value is the block count of the first chunk. 
+	//#define XALLOC_CHUNK_BLOCKS	8
+	#ifndef XALLOC_CHUNK_BLOCKS
+	#define XALLOC_CHUNK_BLOCKS		0
+	#endif
+
+	// Block size classes loaded by xalloc_set_size_classes() or from the 
+	// XALLOC_SIZE_CLASSES environment variable at xalloc_init(). When empty, the
+	// default powers of two classes are used. 
+	#define MAX_SIZE_CLASSES	MAX_ALLOCATORS
+	static size_t _sizeClasses[MAX_SIZE_CLASSES];
+	static INT _sizeClassCount = 0;
+
+	// Block size to size class lookup table, rebuilt whenever the size classes 
+	// change. A class index per pointer sized granule of block size selects the 
+	// class block size and its default alignment allocator once created, so 
+	// xmalloc() never searches the size class table or the allocator array. 
+	#define CLASS_LOOKUP_SIZE	(XALLOC_MAX_BLOCK_SIZE / sizeof(Allocator*) + 1)
+	#define MAX_CLASSES			64
+	static BYTE _classLookup[CLASS_LOOKUP_SIZE];
+	static size_t _classSizes[MAX_CLASSES];
+	static Allocator* _classAllocators[MAX_CLASSES];
+	static INT _classCount = 0;
 #endif	// STATIC_POOLS
 
+// Define XALLOC_PROFILE to record a histogram of the requested block sizes. Use 
+// xalloc_size_class_report() to compare the wasted bytes of the current size 
+// classes against a recommended table minimizing internal fragmentation.
+//#define XALLOC_PROFILE
+#ifdef XALLOC_PROFILE
+	// Request count per pointer sized granule of block size, including the header
+	#define HISTOGRAM_SIZE	(XALLOC_MAX_BLOCK_SIZE / sizeof(Allocator*) + 1)
+	static UINT _sizeHistogram[HISTOGRAM_SIZE];
+#endif
+
 // For C++ applications, must define AUTOMATIC_XALLOCATOR_INIT_DESTROY to 
 // correctly ensure allocators are initialized before any static user C++ 
 // construtor/destructor executes which might call into the xallocator API. 
@@ -96,6 +293,15 @@ static void lock_init()
 #if WIN32
 	BOOL success = InitializeCriticalSectionAndSpinCount(&_criticalSection, 0x00000400);
 	ASSERT_TRUE(success != 0);
+#else
+	// Recursive like a critical section, since xalloc_stats() output may itself
+	// allocate when global operator new is routed to xallocator
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	INT result = pthread_mutex_init(&_mutex, &attr);
+	ASSERT_TRUE(result == 0);
+	pthread_mutexattr_destroy(&attr);
 #endif
 	_xallocInitialized = TRUE;
 }
@@ -105,6 +311,8 @@ static void lock_destroy()
 {
 #if WIN32
 	DeleteCriticalSection(&_criticalSection);
+#else
+	pthread_mutex_destroy(&_mutex);
 #endif
 	_xallocInitialized = FALSE;
 }
@@ -117,6 +325,8 @@ static inline void lock_get()
 
 #if WIN32
 	EnterCriticalSection(&_criticalSection); 
+#else
+	pthread_mutex_lock(&_mutex);
 #endif
 }
 
@@ -128,9 +338,22 @@ static inline void lock_release()
 
 #if WIN32
 	LeaveCriticalSection(&_criticalSection);
+#else
+	pthread_mutex_unlock(&_mutex);
 #endif
 }
 
+/// Gets the size of the header preceding the client's area within a block. The 
+/// header holds the Allocator* and, for aligned allocators, pads the client's area 
+/// out to the block alignment. 
+/// @param[in] allocator - the allocator instance owning the block.
+/// @return The header size in bytes.
+static inline size_t get_block_header_size(Allocator* allocator)
+{
+	size_t alignment = allocator->GetAlignment();
+	return alignment > sizeof(Allocator*) ? alignment : sizeof(Allocator*);
+}
+
 /// Stored a pointer to the allocator instance within the block region. 
 ///	a pointer to the client's area within the block.
 /// @param[in] block - a pointer to the raw memory block. 
@@ -138,15 +361,14 @@ static inline void lock_release()
 /// @return	A pointer to the client's address within the raw memory block. 
 static inline void *set_block_allocator(void* block, Allocator* allocator)
 {
-	// Cast the raw block memory to a Allocator pointer
-	Allocator** pAllocatorInBlock = static_cast<Allocator**>(block);
+	// Advance the pointer past the block header to the client's memory region
+	CHAR* clientsMemoryPtr = static_cast<CHAR*>(block) + get_block_header_size(allocator);
 
-	// Write the size into the memory block
-	*pAllocatorInBlock = allocator;
+	// Write the allocator into the Allocator* position just before the client's region
+	Allocator** pAllocatorInBlock = reinterpret_cast<Allocator**>(clientsMemoryPtr);
+	*--pAllocatorInBlock = allocator;
 
-	// Advance the pointer past the Allocator* block size and return a pointer to
-	// the client's memory region
-	return ++pAllocatorInBlock;
+	return clientsMemoryPtr;
 }
 
 /// Gets the size of the memory block stored within the block.
@@ -166,28 +388,92 @@ static inline Allocator* get_block_allocator(void* block)
 
 /// Returns the raw memory block pointer given a client memory pointer. 
 /// @param[in] block - a pointer to the client memory block. 
+/// @param[in] allocator - the allocator instance stored within the block.
 /// @return	A pointer to the original raw memory block address. 
-static inline void *get_block_ptr(void* block)
+static inline void *get_block_ptr(void* block, Allocator* allocator)
 {
-	// Cast the client memory to a Allocator* pointer
-	Allocator** pAllocatorInBlock = static_cast<Allocator**>(block);
+	// Back up past the block header and return the original raw memory block pointer
+	return static_cast<CHAR*>(block) - get_block_header_size(allocator);
+}
+
+/// Header preceding the client's area of a block obtained directly from the 
+/// system heap. The Allocator* position holds NULL to identify these blocks.
+struct SystemBlockHeader
+{
+	void* block;
+	size_t size;
+	Allocator* allocator;
+};
+
+/// Allocates a block too large for any size class from the system heap. 
+/// @param[in] size - the client requested size of the block.
+/// @param[in] alignment - the client's required alignment, or 0 for default.
+/// @return	A pointer to the client's memory block or NULL if the heap is exhausted.
+static void* system_malloc(size_t size, size_t alignment)
+{
+	// Header is padded to keep the client's area 16 byte or alignment aligned
+	size_t headerSize = (sizeof(SystemBlockHeader) + 15) & ~(size_t)15;
+	if (alignment > headerSize)
+		headerSize = alignment;
+
+	void* block = Allocator::SystemAllocate(headerSize + size, alignment);
+	if (block == 0)
+		return 0;
+
+	CHAR* clientsMemoryPtr = static_cast<CHAR*>(block) + headerSize;
+	SystemBlockHeader* header = reinterpret_cast<SystemBlockHeader*>(clientsMemoryPtr) - 1;
+	header->block = block;
+	header->size = size;
+	header->allocator = NULL;
+
+	lock_get();
+	_systemBlocksInUse++;
+	_systemBytesInUse += size;
+	lock_release();
+
+#ifdef ALLOC_SAMPLING
+	AllocProfiler::OnAllocate(block, headerSize + size, "system heap");
+#endif
+
+	return clientsMemoryPtr;
+}
+
+/// Frees a block obtained with system_malloc().
+/// @param[in] ptr - a pointer to the client's memory block.
+static void system_free(void* ptr)
+{
+	SystemBlockHeader* header = static_cast<SystemBlockHeader*>(ptr) - 1;
+
+	lock_get();
+	_systemBlocksInUse--;
+	_systemBytesInUse -= header->size;
+	lock_release();
+
+	Allocator::SystemFree(header->block);
+}
 
-	// Back up one Allocator* position and return the original raw memory block pointer
-	return --pAllocatorInBlock;
+/// Gets the client's usable size of a block obtained with system_malloc().
+/// @param[in] ptr - a pointer to the client's memory block.
+/// @return	The block size requested by the client.
+static inline size_t system_size(void* ptr)
+{
+	return (static_cast<SystemBlockHeader*>(ptr) - 1)->size;
 }
 
-/// Returns an allocator instance matching the size provided
+/// Returns an allocator instance matching the size and alignment provided
 /// @param[in] size - allocator block size
+/// @param[in] alignment - allocator block alignment or 0 for default alignment
 /// @return Allocator instance handling requested block size or NULL
 /// if no allocator exists. 
-static inline Allocator* find_allocator(size_t size)
+static inline Allocator* find_allocator(size_t size, size_t alignment)
 {
 	for (INT i=0; i<MAX_ALLOCATORS; i++)
 	{
 		if (_allocators[i] == 0)
 			break;
 		
-		if (_allocators[i]->GetBlockSize() == size)
+		if (_allocators[i]->GetBlockSize() == size && 
+			_allocators[i]->GetAlignment() == alignment)
 			return _allocators[i];
 	}
 	
@@ -196,18 +482,93 @@ static inline Allocator* find_allocator(size_t size)
 
 /// Insert an allocator instance into the array
 /// @param[in] allocator - An allocator instance
-static inline void insert_allocator(Allocator* allocator)
+/// @return TRUE if inserted, FALSE if the array is full.
+static inline BOOL insert_allocator(Allocator* allocator)
 {
 	for (INT i=0; i<MAX_ALLOCATORS; i++)
 	{
 		if (_allocators[i] == 0)
 		{
 			_allocators[i] = allocator;
-			return;
+			_allocatorCount.store(i + 1, std::memory_order_release);
+			return TRUE;
 		}
 	}
 	
-	ASSERT();
+	return FALSE;
+}
+
+/// Map the xallocator overflow policy onto the Allocator overflow policy. When 
+/// borrowing, the allocator itself fails so that xallocator can try a larger class.
+/// @return The Allocator overflow policy.
+static inline Allocator::OverflowPolicy get_overflow_policy()
+{
+	switch (_overflowPolicy)
+	{
+	case XALLOC_OVERFLOW_HEAP:
+		return Allocator::OVERFLOW_HEAP;
+	case XALLOC_OVERFLOW_BORROW:
+	case XALLOC_OVERFLOW_FAIL:
+		return Allocator::OVERFLOW_FAIL;
+	default:
+		return Allocator::OVERFLOW_ASSERT;
+	}
+}
+
+/// Find the allocator with the next larger block size and the same alignment.
+/// @param[in] blockSize - the current block size.
+/// @param[in] alignment - the block alignment.
+/// @return The next larger allocator, or NULL if none exists.
+static Allocator* find_next_allocator(size_t blockSize, size_t alignment)
+{
+	Allocator* next = NULL;
+	for (INT i=0; i<MAX_ALLOCATORS; i++)
+	{
+		if (_allocators[i] == 0)
+			break;
+
+		if (_allocators[i]->GetBlockSize() > blockSize &&
+			_allocators[i]->GetAlignment() == alignment &&
+			(next == NULL || _allocators[i]->GetBlockSize() < next->GetBlockSize()))
+			next = _allocators[i];
+	}
+	return next;
+}
+
+/// Allocate a raw block from an allocator. If the allocator is exhausted and the 
+/// overflow policy is XALLOC_OVERFLOW_BORROW, the block is borrowed from the next 
+/// larger allocator with the same alignment. Must be called with the lock held.
+/// @param[in,out] allocator - the allocator to use. Set to the lending allocator
+///		if the block was borrowed.
+/// @param[in] size - the raw block size including the block header.
+/// @return	A pointer to the raw block, or NULL if no block is available.
+static void* allocate_block(Allocator** allocator, size_t size)
+{
+	void* block = (*allocator)->Allocate(size);
+	if (block != NULL)
+		return block;
+
+	if (_overflowPolicy == XALLOC_OVERFLOW_BORROW)
+	{
+		size_t alignment = (*allocator)->GetAlignment();
+		Allocator* lender = find_next_allocator((*allocator)->GetBlockSize(), alignment);
+		while (lender != NULL)
+		{
+			block = lender->Allocate(size);
+			if (block != NULL)
+			{
+				_borrows++;
+				*allocator = lender;
+				return block;
+			}
+
+			// The lender is exhausted too so move up to the next size class
+			lender = find_next_allocator(lender->GetBlockSize(), alignment);
+		}
+	}
+
+	_failures++;
+	return NULL;
 }
 
 /// This function must be called exactly one time *before* any other xallocator
@@ -219,33 +580,32 @@ extern "C" void xalloc_init()
 #ifdef STATIC_POOLS
 	// For STATIC_POOLS mode, the allocators must be initialized before any other
 	// static user class constructor is run. Therefore, use placement new to initialize
-	// each allocator into the previously reserved static memory locations.
-	new (&_allocator8) AllocatorPool<CHAR[8], MAX_BLOCKS>();
-	new (&_allocator16) AllocatorPool<CHAR[16], MAX_BLOCKS>();
-	new (&_allocator32) AllocatorPool<CHAR[32], MAX_BLOCKS>();
-	new (&_allocator64) AllocatorPool<CHAR[64], MAX_BLOCKS>();
-	new (&_allocator128) AllocatorPool<CHAR[128], MAX_BLOCKS>();
-	new (&_allocator256) AllocatorPool<CHAR[256], MAX_BLOCKS>();
-	new (&_allocator396) AllocatorPool<CHAR[396], MAX_BLOCKS>();
-	new (&_allocator512) AllocatorPool<CHAR[512], MAX_BLOCKS>();
-	new (&_allocator768) AllocatorPool<CHAR[768], MAX_BLOCKS>();
-	new (&_allocator1024) AllocatorPool<CHAR[1024], MAX_BLOCKS>();
-	new (&_allocator2048) AllocatorPool<CHAR[2048], MAX_BLOCKS>();
-	new (&_allocator4096) AllocatorPool<CHAR[4096], MAX_BLOCKS>();
-
-	// Populate allocator array with all instances 
-	_allocators[0] = (Allocator*)&_allocator8;
-	_allocators[1] = (Allocator*)&_allocator16;
-	_allocators[2] = (Allocator*)&_allocator32;
-	_allocators[3] = (Allocator*)&_allocator64;
-	_allocators[4] = (Allocator*)&_allocator128;
-	_allocators[5] = (Allocator*)&_allocator256;
-	_allocators[6] = (Allocator*)&_allocator396;
-	_allocators[7] = (Allocator*)&_allocator512;
-	_allocators[8] = (Allocator*)&_allocator768;
-	_allocators[9] = (Allocator*)&_allocator1024;
-	_allocators[10] = (Allocator*)&_allocator2048;
-	_allocators[11] = (Allocator*)&_allocator4096;
+	// each allocator into the previously reserved static memory locations and 
+	// populate the allocator array with all instances.
+	XallocStaticPools::Create(_allocators);
+	_allocatorCount.store(MAX_ALLOCATORS, std::memory_order_release);
+#else
+	// Load a size class table such as XALLOC_SIZE_CLASSES=24,48,112,400 emitted by
+	// xalloc_size_class_report(). Parsed in place since the heap may not be usable.
+	const CHAR* env = getenv("XALLOC_SIZE_CLASSES");
+	if (env != NULL)
+	{
+		size_t sizes[MAX_SIZE_CLASSES];
+		INT count = 0;
+		while (*env != 0 && count < MAX_SIZE_CLASSES)
+		{
+			CHAR* end;
+			sizes[count++] = strtoul(env, &end, 10);
+			if (end == env || (*end != ',' && *end != 0))
+			{
+				count = 0;
+				break;
+			}
+			env = (*end == ',') ? end + 1 : end;
+		}
+		if (count > 0)
+			xalloc_set_size_classes(sizes, count);
+	}
 #endif
 }
 
@@ -255,6 +615,11 @@ extern "C" void xalloc_destroy()
 {
 	lock_get();
 
+	// When global operator new/delete is routed to xallocator, the C++ runtime 
+	// may still free blocks after this point. Leave the allocators intact and 
+	// let the memory be reclaimed when the process exits.
+#ifndef XALLOCATOR_GLOBAL_NEW
+	_allocatorCount.store(0, std::memory_order_release);
 #ifdef STATIC_POOLS
 	for (INT i=0; i<MAX_ALLOCATORS; i++)
 	{
@@ -266,54 +631,178 @@ extern "C" void xalloc_destroy()
 	{
 		if (_allocators[i] == 0)
 			break;
-		delete _allocators[i];
+		_allocators[i]->~Allocator();
+		Allocator::SystemFree(_allocators[i]);
 		_allocators[i] = 0;
 	}
+	_classCount = 0;
 #endif
+#endif	// XALLOCATOR_GLOBAL_NEW
 
 	lock_release();
 
 	lock_destroy();
 }
 
+/// Get an Allocator instance handling the block size and alignment. If a Allocator
+/// instance is not currently available then a new Allocator instance is created.
+///	@param[in] blockSize - the raw block size including the block header.
+///	@param[in] alignment - the block alignment or 0 for default alignment.
+///	@return An Allocator instance that handles the blocks.
+static Allocator* get_allocator(size_t blockSize, size_t alignment)
+{
+#ifdef STATIC_POOLS
+	// The static pools don't exist until xalloc_init() constructs them
+	if (_xallocInitialized == FALSE)
+		return NULL;
+
+	// Without a matching pool the block comes from the system heap. Aligned 
+	// pools may be larger than XALLOC_MAX_BLOCK_SIZE.
+	return find_allocator(blockSize, alignment);
+#else
+	// Blocks larger than the largest size class come from the system heap
+	if (blockSize > XALLOC_MAX_BLOCK_SIZE)
+		return NULL;
+
+	Allocator* allocator = find_allocator(blockSize, alignment);
+
+	// If there is not an allocator already created to handle this block size
+	if (allocator == NULL)  
+	{
+		// Create a new allocator to handle blocks of the size required. The 
+		// instance itself is never obtained with operator new, which may be
+		// routed back into xallocator. 
+		void* memory = Allocator::SystemAllocate(sizeof(Allocator));
+		if (memory == NULL)
+			return NULL;
+		allocator = new (memory) Allocator(blockSize, 0, 0, "xallocator", XALLOC_CHUNK_BLOCKS, alignment, _memoryProvider);
+		allocator->SetHighWaterMark(_highWaterMark, _trimKeepBlocks);
+		allocator->SetOverflowPolicy(get_overflow_policy());
+
+		// Insert allocator into array. If full, use the system heap instead.
+		if (!insert_allocator(allocator))
+		{
+			allocator->~Allocator();
+			Allocator::SystemFree(memory);
+			return NULL;
+		}
+	}
+	
+	return allocator;
+#endif
+}
+
+#ifndef STATIC_POOLS
+/// Compute the size class block size serving a raw block size from the loaded
+/// size class table or the default classes. Used to build the lookup table.
+///	@param[in] blockSize - the raw block size including the block header.
+///	@return The size class block size.
+static size_t compute_size_class(size_t blockSize)
+{
+	// Use the loaded size class table, if any
+	for (INT i=0; i<_sizeClassCount; i++)
+	{
+		if (_sizeClasses[i] >= blockSize)
+			return _sizeClasses[i];
+	}
+
+	// Based on the size, find the next higher powers of two value.
+	// Most blocks are powers of two, however some common allocator block 
+	// sizes can be explicitly defined to minimize wasted storage. This offers
+	// application specific tuning. Block sizes are kept a multiple of the 
+	// pointer size so every block within a pool stays pointer aligned. 
+	if (blockSize > 256 && blockSize <= 400)
+		return 400;
+	else if (blockSize > 512 && blockSize <= 768)
+		return 768;
+	else
+		return nexthigher<size_t>(blockSize);
+}
+
+/// Build the block size to size class lookup table. Every class is a multiple of 
+/// the pointer size, so a granule's class also serves each smaller size rounding 
+/// up to it. Existing default alignment allocators are cached per class. Must be 
+/// called with the lock held.
+static void build_class_lookup()
+{
+	_classCount = 0;
+	for (size_t granule = 0; granule < CLASS_LOOKUP_SIZE; granule++)
+	{
+		size_t sizeClass = compute_size_class(granule * sizeof(Allocator*));
+		if (_classCount == 0 || _classSizes[_classCount-1] != sizeClass)
+		{
+			ASSERT_TRUE(_classCount < MAX_CLASSES);
+			_classSizes[_classCount] = sizeClass;
+			_classAllocators[_classCount] = find_allocator(sizeClass, 0);
+			_classCount++;
+		}
+		_classLookup[granule] = (BYTE)(_classCount - 1);
+	}
+}
+
+/// Get the size class index serving a raw block size. 
+///	@param[in] blockSize - the raw block size, at most XALLOC_MAX_BLOCK_SIZE.
+///	@return The index into the size class lookup table.
+static inline INT get_class_index(size_t blockSize)
+{
+	// The table is built on first use since xmalloc() may precede xalloc_init()
+	if (_classCount == 0)
+		build_class_lookup();
+	return _classLookup[(blockSize + sizeof(Allocator*) - 1) / sizeof(Allocator*)];
+}
+#endif
+
+/// Get the size class block size serving a raw block size. 
+///	@param[in] blockSize - the raw block size including the block header.
+///	@return The size class block size.
+static inline size_t get_size_class(size_t blockSize)
+{
+#ifdef STATIC_POOLS
+	size_t granule = (blockSize + XallocStaticPools::GRANULE - 1) / XallocStaticPools::GRANULE;
+	return _allocators[_poolLookup.index[granule]]->GetBlockSize();
+#else
+	if (blockSize > XALLOC_MAX_BLOCK_SIZE)
+		return compute_size_class(blockSize);
+	return _classSizes[get_class_index(blockSize)];
+#endif
+}
+
 /// Get an Allocator instance based upon the client's requested block size.
 /// If a Allocator instance is not currently available to handle the size,
 ///	then a new Allocator instance is create.
 ///	@param[in] size - the client's requested block size.
 ///	@return An Allocator instance that handles blocks of the requested
-///	size.
+///	size, or NULL if the block must come from the system heap.
 extern "C" Allocator* xallocator_get_allocator(size_t size)
 {
-	// Based on the size, find the next higher powers of two value.
+#ifdef XALLOC_PROFILE
 	// Add sizeof(Allocator*) to the requested block size to hold the size
-	// within the block memory region. Most blocks are powers of two,
-	// however some common allocator block sizes can be explicitly defined
-	// to minimize wasted storage. This offers application specific tuning.
-	size_t blockSize = size + sizeof(Allocator*);
-	if (blockSize > 256 && blockSize <= 396)
-		blockSize = 396;
-	else if (blockSize > 512 && blockSize <= 768)
-		blockSize = 768;
-	else
-		blockSize = nexthigher<size_t>(blockSize);
-
-	Allocator* allocator = find_allocator(blockSize);
+	// within the block memory region
+	if (size + sizeof(Allocator*) <= XALLOC_MAX_BLOCK_SIZE)
+		_sizeHistogram[(size + 2 * sizeof(Allocator*) - 1) / sizeof(Allocator*)]++;
+#endif
 
 #ifdef STATIC_POOLS
-	ASSERT_TRUE(allocator != NULL);
+	// Select the smallest static pool holding the block using the lookup table
+	// generated from the static pool size classes
+	size_t blockSize = size + sizeof(Allocator*);
+	if (blockSize > XALLOC_MAX_BLOCK_SIZE || _xallocInitialized == FALSE)
+		return NULL;
+	size_t granule = (blockSize + XallocStaticPools::GRANULE - 1) / XallocStaticPools::GRANULE;
+	return _allocators[_poolLookup.index[granule]];
 #else
-	// If there is not an allocator already created to handle this block size
-	if (allocator == NULL)  
-	{
-		// Create a new allocator to handle blocks of the size required
-		allocator = new Allocator(blockSize, 0, 0, "xallocator");
+	// Add sizeof(Allocator*) to the requested block size to hold the size
+	// within the block memory region
+	size_t blockSize = size + sizeof(Allocator*);
+	if (blockSize > XALLOC_MAX_BLOCK_SIZE)
+		return NULL;
 
-		// Insert allocator into array
-		insert_allocator(allocator);
-	}
+	// Select the size class with the lookup table and create its allocator once
+	INT index = get_class_index(blockSize);
+	if (_classAllocators[index] == NULL)
+		_classAllocators[index] = get_allocator(_classSizes[index], 0);
+	return _classAllocators[index];
 #endif
-	
-	return allocator;
 }
 
 /// Allocates a memory block of the requested size. The blocks are created from
@@ -326,15 +815,58 @@ extern "C" void *xmalloc(size_t size)
 
 	// Allocate a raw memory block 
 	Allocator* allocator = xallocator_get_allocator(size);
-	void* blockMemoryPtr = allocator->Allocate(sizeof(Allocator*) + size);
+	void* blockMemoryPtr = NULL;
+	if (allocator != NULL)
+		blockMemoryPtr = allocate_block(&allocator, sizeof(Allocator*) + size);
 
 	lock_release();
 
+	// Blocks larger than any size class come from the system heap
+	if (allocator == NULL)
+		return system_malloc(size, 0);
+
+	// The size class is exhausted and the overflow policy fails fast
+	if (blockMemoryPtr == NULL)
+		return NULL;
+
 	// Set the block Allocator* within the raw memory block region
 	void* clientsMemoryPtr = set_block_allocator(blockMemoryPtr, allocator);
 	return clientsMemoryPtr;
 }
 
+/// Allocates a memory block of the requested size and alignment. Alignments
+/// larger than the pointer size are served from aligned size classes whose
+/// block header is padded out to the alignment.
+///	@param[in] alignment - the client's required alignment, a power of two.
+///	@param[in] size - the client requested size of the block.
+/// @return	A pointer to the client's aligned memory block.
+extern "C" void *xmalloc_aligned(size_t alignment, size_t size)
+{
+	ASSERT_TRUE((alignment & (alignment - 1)) == 0);
+
+	// Every xmalloc block is already pointer aligned
+	if (alignment <= sizeof(Allocator*))
+		return xmalloc(size);
+
+	lock_get();
+
+	// The block header takes one alignment unit ahead of the client's region
+	size_t blockSize = nexthigher<size_t>(size + alignment);
+	Allocator* allocator = get_allocator(blockSize, alignment);
+	void* blockMemoryPtr = NULL;
+	if (allocator != NULL)
+		blockMemoryPtr = allocate_block(&allocator, blockSize);
+
+	lock_release();
+
+	if (allocator == NULL)
+		return system_malloc(size, alignment);
+	if (blockMemoryPtr == NULL)
+		return NULL;
+
+	return set_block_allocator(blockMemoryPtr, allocator);
+}
+
 /// Frees a memory block previously allocated with xalloc. The blocks are returned
 ///	to the fixed block allocator that originally created it.
 ///	@param[in] ptr - a pointer to a block created with xalloc.
@@ -346,8 +878,15 @@ extern "C" void xfree(void* ptr)
 	// Extract the original allocator instance from the caller's block pointer
 	Allocator* allocator = get_block_allocator(ptr);
 
+	// A NULL allocator is a block from the system heap
+	if (allocator == NULL)
+	{
+		system_free(ptr);
+		return;
+	}
+
 	// Convert the client pointer into the original raw block pointer
-	void* blockPtr = get_block_ptr(ptr);
+	void* blockPtr = get_block_ptr(ptr, allocator);
 
 	lock_get();
 
@@ -357,7 +896,9 @@ extern "C" void xfree(void* ptr)
 	lock_release();
 }
 
-/// Reallocates a memory block previously allocated with xalloc.
+/// Reallocates a memory block previously allocated with xalloc. If the new size
+/// still fits within the existing block, the same block is returned. Otherwise 
+/// the client data is moved directly into a block from the new size class.
 ///	@param[in] ptr - a pointer to a block created with xalloc.
 ///	@param[in] size - the client requested block size to create.
 extern "C" void *xrealloc(void *oldMem, size_t size)
@@ -370,32 +911,116 @@ extern "C" void *xrealloc(void *oldMem, size_t size)
 		xfree(oldMem);
 		return 0;
 	}
-	else 
+
+	// Get the original allocator instance from the old memory block
+	Allocator* oldAllocator = get_block_allocator(oldMem);
+	size_t oldSize = xmalloc_usable_size(oldMem);
+
+	lock_get();
+
+	// If the requested size fits within the existing block then keep it
+	if (size <= oldSize)
 	{
-		// Create a new memory block
-		void* newMem = xmalloc(size);
-		if (newMem != 0) 
-		{
-			// Get the original allocator instance from the old memory block
-			Allocator* oldAllocator = get_block_allocator(oldMem);
-			size_t oldSize = oldAllocator->GetBlockSize() - sizeof(Allocator*);
+		_reallocHits++;
+		lock_release();
+		return oldMem;
+	}
 
-			// Copy the bytes from the old memory block into the new (as much as will fit)
-			memcpy(newMem, oldMem, (oldSize < size) ? oldSize : size);
+	// Get a block from the allocator handling the new size
+	_reallocMisses++;
+	Allocator* newAllocator = xallocator_get_allocator(size);
+	void* newBlockPtr = NULL;
+	if (newAllocator != NULL)
+		newBlockPtr = allocate_block(&newAllocator, sizeof(Allocator*) + size);
 
-			// Free the old memory block
-			xfree(oldMem);
+	lock_release();
 
-			// Return the client pointer to the new memory block
-			return newMem;
-		}
+	// On failure the old block is left untouched
+	void* newMem;
+	if (newAllocator != NULL)
+		newMem = newBlockPtr ? set_block_allocator(newBlockPtr, newAllocator) : 0;
+	else
+		newMem = system_malloc(size, 0);
+	if (newMem == 0)
 		return 0;
+
+	// Copy the bytes from the old memory block into the new. The old block
+	// is smaller than the requested size so all of the old block is copied.
+	memcpy(newMem, oldMem, oldSize);
+
+	// Return the old block to its allocator or the system heap
+	if (oldAllocator == NULL)
+	{
+		system_free(oldMem);
+	}
+	else
+	{
+		lock_get();
+		oldAllocator->Deallocate(get_block_ptr(oldMem, oldAllocator));
+		lock_release();
 	}
+
+	// Return the client pointer to the new memory block
+	return newMem;
+}
+
+/// Gets the number of bytes the client may use within a block. 
+///	@param[in] ptr - a pointer to a block created with xalloc.
+extern "C" size_t xmalloc_usable_size(void* ptr)
+{
+	if (ptr == 0)
+		return 0;
+
+	Allocator* allocator = get_block_allocator(ptr);
+	if (allocator == NULL)
+		return system_size(ptr);
+	return allocator->GetBlockSize() - get_block_header_size(allocator);
 }
 
 /// Output xallocator usage statistics
 extern "C" void xalloc_stats()
 {
+	// Rendered from a snapshot so allocation is never stalled by the output
+	XallocClassStats classes[MAX_ALLOCATORS];
+	XallocStats stats;
+	INT count = xalloc_get_stats(&stats, classes, MAX_ALLOCATORS);
+
+	for (INT i=0; i<count; i++)
+	{
+		cout << "xallocator";
+		cout << " Block Size: " << classes[i].blockSize;
+		if (classes[i].alignment != 0)
+			cout << " Alignment: " << classes[i].alignment;
+		cout << " Block Count: " << classes[i].blockCount;
+		cout << " Blocks In Use: " << classes[i].blocksInUse;
+		cout << " Peak Blocks In Use: " << classes[i].peakBlocksInUse;
+		if (classes[i].chunkCount != 0)
+			cout << " Chunk Count: " << classes[i].chunkCount;
+		cout << " Bytes Reserved: " << classes[i].bytesReserved;
+		cout << " Peak Bytes Reserved: " << classes[i].peakBytesReserved;
+		cout << " Bytes In Use: " << classes[i].bytesInUse;
+		cout << " Allocations: " << classes[i].allocations;
+		if (classes[i].overflows != 0)
+			cout << " Overflows: " << classes[i].overflows;
+		cout << endl;
+	}
+
+	cout << "System Heap Blocks In Use: " << stats.systemBlocksInUse;
+	cout << " Bytes In Use: " << stats.systemBytesInUse;
+	cout << endl;
+	cout << "xrealloc Hits: " << stats.reallocHits;
+	cout << " Misses: " << stats.reallocMisses;
+	cout << endl;
+	cout << "Borrowed Blocks: " << stats.borrows;
+	cout << " Failed Allocations: " << stats.failures;
+	cout << endl;
+}
+
+/// Release idle memory from every allocator back to the system.
+extern "C" size_t xalloc_trim()
+{
+	size_t released = 0;
+
 	lock_get();
 
 	for (INT i=0; i<MAX_ALLOCATORS; i++)
@@ -403,15 +1028,493 @@ extern "C" void xalloc_stats()
 		if (_allocators[i] == 0)
 			break;
 
-		if (_allocators[i]->GetName() != NULL)
-			cout << _allocators[i]->GetName();
-		cout << " Block Size: " << _allocators[i]->GetBlockSize();
-		cout << " Block Count: " << _allocators[i]->GetBlockCount();
-		cout << " Blocks In Use: " << _allocators[i]->GetBlocksInUse();
-		cout << endl;
+		size_t reserved = _allocators[i]->GetBytesReserved();
+		_allocators[i]->Trim(0);
+		released += reserved - _allocators[i]->GetBytesReserved();
+	}
+
+	lock_release();
+
+#ifdef __GLIBC__
+	// Have the C runtime return the freed pages to the operating system
+	if (released)
+		malloc_trim(0);
+#endif
+
+	return released;
+}
+
+/// Set the high water mark trim policy on all allocators.
+extern "C" void xalloc_set_high_water_mark(size_t bytes, UINT keepBlocks)
+{
+	lock_get();
+
+	_highWaterMark = bytes;
+	_trimKeepBlocks = keepBlocks;
+
+	for (INT i=0; i<MAX_ALLOCATORS; i++)
+	{
+		if (_allocators[i] == 0)
+			break;
+		_allocators[i]->SetHighWaterMark(bytes, keepBlocks);
+	}
+
+	lock_release();
+}
+
+/// Set the overflow policy on all allocators.
+extern "C" void xalloc_set_overflow_policy(XallocOverflowPolicy policy)
+{
+	lock_get();
+
+	_overflowPolicy = policy;
+
+	for (INT i=0; i<MAX_ALLOCATORS; i++)
+	{
+		if (_allocators[i] == 0)
+			break;
+		_allocators[i]->SetOverflowPolicy(get_overflow_policy());
+	}
+
+	lock_release();
+}
+
+/// Get the overflow counters summed over all allocators.
+extern "C" void xalloc_get_overflow_stats(UINT64* overflows, UINT64* borrows, UINT64* failures)
+{
+	lock_get();
+
+	UINT64 totalOverflows = 0;
+	for (INT i=0; i<MAX_ALLOCATORS; i++)
+	{
+		if (_allocators[i] == 0)
+			break;
+		totalOverflows += _allocators[i]->GetOverflows();
+	}
+
+	if (overflows)
+		*overflows = totalOverflows;
+	if (borrows)
+		*borrows = _borrows;
+	if (failures)
+		*failures = _failures;
+
+	lock_release();
+}
+
+/// Set the backing memory provider for allocators created later.
+void xalloc_set_memory_provider(MemoryProvider* provider)
+{
+	lock_get();
+	_memoryProvider = provider;
+	lock_release();
+}
+
+/// Load a size class table.
+extern "C" BOOL xalloc_set_size_classes(const size_t* sizes, INT count)
+{
+#ifdef STATIC_POOLS
+	// Static pools are sized at compile time with XALLOC_STATIC_POOLS_CONFIG
+	(void)sizes;
+	(void)count;
+	return FALSE;
+#else
+	if (count < 0 || count > MAX_SIZE_CLASSES)
+		return FALSE;
+
+	// Sizes must ascend and keep blocks pointer aligned
+	for (INT i=0; i<count; i++)
+	{
+		if (sizes[i] % sizeof(Allocator*) != 0 || sizes[i] > XALLOC_MAX_BLOCK_SIZE ||
+			(i > 0 && sizes[i] <= sizes[i-1]))
+			return FALSE;
+	}
+
+	lock_get();
+
+	// Blocks from the previous classes still free back to their own allocators
+	for (INT i=0; i<count; i++)
+		_sizeClasses[i] = sizes[i];
+	_sizeClassCount = count;
+	build_class_lookup();
+
+	lock_release();
+	return TRUE;
+#endif
+}
+
+#ifdef XALLOC_PROFILE
+/// Get the wasted bytes when the histogram is served by a size class table. 
+/// Requests above the largest class aren't served by the table and waste nothing.
+/// @param[in] sizes - ascending block size classes.
+/// @param[in] count - the number of classes.
+/// @param[in] print - TRUE to output the requests and wasted bytes per class.
+/// @return The total wasted bytes.
+static size_t get_wasted_bytes(const size_t* sizes, INT count, BOOL print)
+{
+	size_t total = 0;
+	size_t granule = 0;
+	for (INT i=0; i<count; i++)
+	{
+		UINT requests = 0;
+		size_t wasted = 0;
+		for (; granule < HISTOGRAM_SIZE && granule * sizeof(Allocator*) <= sizes[i]; granule++)
+		{
+			requests += _sizeHistogram[granule];
+			wasted += (size_t)_sizeHistogram[granule] * (sizes[i] - granule * sizeof(Allocator*));
+		}
+		total += wasted;
+
+		if (print && requests != 0)
+		{
+			cout << " Block Size: " << sizes[i];
+			cout << " Requests: " << requests;
+			cout << " Wasted Bytes: " << wasted;
+			cout << endl;
+		}
+	}
+	return total;
+}
+#endif
+
+/// Recommend a size class table for the recorded histogram.
+extern "C" INT xalloc_recommend_size_classes(size_t* sizes, INT maxClasses)
+{
+#ifdef XALLOC_PROFILE
+	lock_get();
+
+	// The candidate classes are the observed block sizes
+	INT n = 0;
+	for (size_t granule = 0; granule < HISTOGRAM_SIZE; granule++)
+	{
+		if (_sizeHistogram[granule] != 0)
+			n++;
+	}
+
+	INT k = maxClasses < n ? maxClasses : n;
+	if (k <= 0)
+	{
+		lock_release();
+		return 0;
+	}
+
+	// Working memory never comes from the heap routed through xallocator
+	size_t* size = (size_t*)Allocator::SystemAllocate(sizeof(size_t) * n);
+	size_t* requests = (size_t*)Allocator::SystemAllocate(sizeof(size_t) * (n + 1));
+	size_t* bytes = (size_t*)Allocator::SystemAllocate(sizeof(size_t) * (n + 1));
+	size_t* prev = (size_t*)Allocator::SystemAllocate(sizeof(size_t) * n);
+	size_t* cur = (size_t*)Allocator::SystemAllocate(sizeof(size_t) * n);
+	INT* first = (INT*)Allocator::SystemAllocate(sizeof(INT) * k * n);
+	if (!size || !requests || !bytes || !prev || !cur || !first)
+	{
+		k = 0;
+	}
+	else
+	{
+		// Prefix sums of the request counts and bytes make the waste of serving 
+		// candidates i..j with class size[j] a constant time calculation
+		requests[0] = bytes[0] = 0;
+		INT j = 0;
+		for (size_t granule = 0; granule < HISTOGRAM_SIZE; granule++)
+		{
+			if (_sizeHistogram[granule] == 0)
+				continue;
+			size[j] = granule * sizeof(Allocator*);
+			requests[j+1] = requests[j] + _sizeHistogram[granule];
+			bytes[j+1] = bytes[j] + _sizeHistogram[granule] * size[j];
+			j++;
+		}
+		#define WASTE(i, j)	(size[j] * (requests[(j)+1] - requests[i]) - (bytes[(j)+1] - bytes[i]))
+
+		// Dynamic program: cur[j] is the least waste serving candidates 0..j with 
+		// c+1 classes where the largest class is size[j], and first[c][j] is the 
+		// first candidate served by that largest class
+		for (j = 0; j < n; j++)
+		{
+			prev[j] = WASTE(0, j);
+			first[j] = 0;
+		}
+		for (INT c = 1; c < k; c++)
+		{
+			for (j = 0; j < n; j++)
+			{
+				// Keeping c classes is allowed, marked with a -1
+				cur[j] = prev[j];
+				first[c * n + j] = -1;
+				for (INT i = c; i <= j; i++)
+				{
+					size_t waste = prev[i-1] + WASTE(i, j);
+					if (waste < cur[j])
+					{
+						cur[j] = waste;
+						first[c * n + j] = i;
+					}
+				}
+			}
+			size_t* swap = prev;
+			prev = cur;
+			cur = swap;
+		}
+		#undef WASTE
+
+		// The largest class must hold the largest observed size. Walk the 
+		// choices back to recover the class sizes in ascending order.
+		INT c = k - 1;
+		INT count = 0;
+		for (j = n - 1; j >= 0 && c >= 0; c--)
+		{
+			INT i = first[c * n + j];
+			if (i < 0)
+				continue;
+			sizes[count++] = size[j];
+			j = i - 1;
+		}
+		for (INT lo = 0, hi = count - 1; lo < hi; lo++, hi--)
+		{
+			size_t swap = sizes[lo];
+			sizes[lo] = sizes[hi];
+			sizes[hi] = swap;
+		}
+		k = count;
+	}
+
+	Allocator::SystemFree(size);
+	Allocator::SystemFree(requests);
+	Allocator::SystemFree(bytes);
+	Allocator::SystemFree(prev);
+	Allocator::SystemFree(cur);
+	Allocator::SystemFree(first);
+
+	lock_release();
+	return k;
+#else
+	(void)sizes;
+	(void)maxClasses;
+	return 0;
+#endif
+}
+
+/// Output the size class report.
+extern "C" void xalloc_size_class_report(INT maxClasses)
+{
+#ifdef XALLOC_PROFILE
+	lock_get();
+
+	// The classes currently serving the recorded sizes
+	static size_t current[HISTOGRAM_SIZE];
+	INT currentCount = 0;
+	UINT total = 0;
+	for (size_t granule = 1; granule < HISTOGRAM_SIZE; granule++)
+	{
+		if (_sizeHistogram[granule] == 0)
+			continue;
+		total += _sizeHistogram[granule];
+		size_t sizeClass = get_size_class(granule * sizeof(Allocator*));
+		if (currentCount == 0 || current[currentCount-1] != sizeClass)
+			current[currentCount++] = sizeClass;
 	}
 
+	cout << "Size Class Report Requests: " << total << endl;
+	cout << "Current Size Classes:" << endl;
+	size_t currentWaste = get_wasted_bytes(current, currentCount, TRUE);
+	cout << "Current Wasted Bytes: " << currentWaste << endl;
+
+	if (maxClasses <= 0)
+		maxClasses = currentCount;
+	size_t recommended[MAX_ALLOCATORS];
+	if (maxClasses > MAX_ALLOCATORS)
+		maxClasses = MAX_ALLOCATORS;
+	INT recommendedCount = xalloc_recommend_size_classes(recommended, maxClasses);
+
+	cout << "Recommended Size Classes:" << endl;
+	size_t recommendedWaste = get_wasted_bytes(recommended, recommendedCount, TRUE);
+	cout << "Recommended Wasted Bytes: " << recommendedWaste << endl;
+
+	// Emit the table for XALLOC_STATIC_POOLS_CONFIG and XALLOC_SIZE_CLASSES
+	cout << "#define MAX_BLOCKS\t32" << endl;
+	cout << "typedef XallocPools<" << endl;
+	for (INT i=0; i<recommendedCount; i++)
+	{
+		cout << "\tXallocPool<" << recommended[i] << ", MAX_BLOCKS>";
+		cout << (i + 1 < recommendedCount ? "," : "") << endl;
+	}
+	cout << "> XallocStaticPools;" << endl;
+
+	cout << "XALLOC_SIZE_CLASSES=";
+	for (INT i=0; i<recommendedCount; i++)
+		cout << (i ? "," : "") << recommended[i];
+	cout << endl;
+
 	lock_release();
+#else
+	(void)maxClasses;
+	cout << "Size class report requires XALLOC_PROFILE" << endl;
+#endif
+}
+
+/// Take a lock-free statistics snapshot.
+extern "C" INT xalloc_get_stats(XallocStats* stats, XallocClassStats* classes, INT maxClasses)
+{
+	// Allocators are published in order and never removed until xalloc_destroy()
+	INT count = _allocatorCount.load(std::memory_order_acquire);
+	if (count > maxClasses)
+		count = maxClasses;
+
+	XallocStats totals = {};
+	for (INT i=0; i<count; i++)
+	{
+		Allocator* allocator = _allocators[i];
+		XallocClassStats& c = classes[i];
+		c.blockSize = allocator->GetBlockSize();
+		c.alignment = allocator->GetAlignment();
+		c.blockCount = allocator->GetBlockCount();
+		c.blocksInUse = allocator->GetBlocksInUse();
+		c.peakBlocksInUse = allocator->GetPeakBlocksInUse();
+		c.chunkCount = allocator->GetChunkCount();
+		c.bytesReserved = allocator->GetBytesReserved();
+		c.peakBytesReserved = allocator->GetPeakBytesReserved();
+		c.bytesInUse = allocator->GetBytesInUse();
+		c.allocations = allocator->GetAllocations();
+		c.deallocations = allocator->GetDeallocations();
+		c.overflows = allocator->GetOverflows();
+
+		totals.bytesReserved += c.bytesReserved;
+		totals.bytesInUse += c.bytesInUse;
+		totals.allocations += c.allocations;
+		totals.deallocations += c.deallocations;
+	}
+
+	if (stats)
+	{
+		*stats = totals;
+		stats->classCount = count;
+		stats->systemBlocksInUse = _systemBlocksInUse;
+		stats->systemBytesInUse = _systemBytesInUse;
+		stats->reallocHits = _reallocHits;
+		stats->reallocMisses = _reallocMisses;
+		stats->borrows = _borrows;
+		stats->failures = _failures;
+	}
+	return count;
+}
+
+/// @brief Describes one numeric per size class statistic for the renderers.
+struct XallocClassMetric
+{
+	const CHAR* name;
+	const CHAR* type;
+	const CHAR* help;
+	UINT64 XallocClassStats::*field;
+};
+
+static const XallocClassMetric _classMetrics[] = 
+{
+	{ "block_count", "gauge", "Blocks created", &XallocClassStats::blockCount },
+	{ "blocks_in_use", "gauge", "Blocks in use", &XallocClassStats::blocksInUse },
+	{ "peak_blocks_in_use", "gauge", "Highest blocks in use", &XallocClassStats::peakBlocksInUse },
+	{ "chunk_count", "gauge", "Heap chunks", &XallocClassStats::chunkCount },
+	{ "bytes_reserved", "gauge", "Bytes reserved from the heap or pool", &XallocClassStats::bytesReserved },
+	{ "peak_bytes_reserved", "gauge", "Highest bytes reserved", &XallocClassStats::peakBytesReserved },
+	{ "bytes_in_use", "gauge", "Bytes in blocks in use", &XallocClassStats::bytesInUse },
+	{ "allocations_total", "counter", "Allocations", &XallocClassStats::allocations },
+	{ "deallocations_total", "counter", "Deallocations", &XallocClassStats::deallocations },
+	{ "overflows_total", "counter", "Allocations served by an overflow allocator", &XallocClassStats::overflows },
+};
+
+/// @brief Appends formatted text to a fixed buffer, tracking the full length
+/// like snprintf() so that callers can size the buffer.
+class StatsWriter
+{
+public:
+	StatsWriter(CHAR* buffer, size_t size) : m_buffer(buffer), m_size(size), m_length(0) 
+	{
+		if (m_size)
+			m_buffer[0] = 0;
+	}
+
+	void Write(const CHAR* format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		size_t left = m_length < m_size ? m_size - m_length : 0;
+		INT written = vsnprintf(left ? m_buffer + m_length : NULL, left, format, args);
+		va_end(args);
+		if (written > 0)
+			m_length += written;
+	}
+
+	INT GetLength() const { return (INT)m_length; }
+
+private:
+	CHAR* m_buffer;
+	size_t m_size;
+	size_t m_length;
+};
+
+/// Render the statistics as JSON.
+extern "C" INT xalloc_stats_json(CHAR* buffer, size_t size)
+{
+	XallocClassStats classes[MAX_ALLOCATORS];
+	XallocStats stats;
+	INT count = xalloc_get_stats(&stats, classes, MAX_ALLOCATORS);
+
+	StatsWriter out(buffer, size);
+	out.Write("{\"classes\":[");
+	for (INT i=0; i<count; i++)
+	{
+		out.Write("%s{\"block_size\":%llu,\"alignment\":%llu", i ? "," : "",
+			(unsigned long long)classes[i].blockSize, (unsigned long long)classes[i].alignment);
+		for (size_t m=0; m<sizeof(_classMetrics)/sizeof(_classMetrics[0]); m++)
+			out.Write(",\"%s\":%llu", _classMetrics[m].name, 
+				(unsigned long long)(classes[i].*_classMetrics[m].field));
+		out.Write("}");
+	}
+	out.Write("],\"bytes_reserved\":%llu,\"bytes_in_use\":%llu,\"allocations_total\":%llu,"
+		"\"deallocations_total\":%llu,\"system_blocks_in_use\":%llu,\"system_bytes_in_use\":%llu,"
+		"\"realloc_hits_total\":%llu,\"realloc_misses_total\":%llu,\"borrows_total\":%llu,"
+		"\"failures_total\":%llu}",
+		(unsigned long long)stats.bytesReserved, (unsigned long long)stats.bytesInUse,
+		(unsigned long long)stats.allocations, (unsigned long long)stats.deallocations,
+		(unsigned long long)stats.systemBlocksInUse, (unsigned long long)stats.systemBytesInUse,
+		(unsigned long long)stats.reallocHits, (unsigned long long)stats.reallocMisses,
+		(unsigned long long)stats.borrows, (unsigned long long)stats.failures);
+	return out.GetLength();
 }
 
+/// Render the statistics in the Prometheus text exposition format.
+extern "C" INT xalloc_stats_prometheus(CHAR* buffer, size_t size)
+{
+	XallocClassStats classes[MAX_ALLOCATORS];
+	XallocStats stats;
+	INT count = xalloc_get_stats(&stats, classes, MAX_ALLOCATORS);
+
+	StatsWriter out(buffer, size);
+	for (size_t m=0; m<sizeof(_classMetrics)/sizeof(_classMetrics[0]); m++)
+	{
+		const XallocClassMetric& metric = _classMetrics[m];
+		out.Write("# HELP xalloc_%s %s per size class.\n", metric.name, metric.help);
+		out.Write("# TYPE xalloc_%s %s\n", metric.name, metric.type);
+		for (INT i=0; i<count; i++)
+		{
+			out.Write("xalloc_%s{block_size=\"%llu\",alignment=\"%llu\"} %llu\n", metric.name,
+				(unsigned long long)classes[i].blockSize, (unsigned long long)classes[i].alignment,
+				(unsigned long long)(classes[i].*metric.field));
+		}
+	}
 
+	const struct { const CHAR* name; const CHAR* type; UINT64 value; } totals[] = 
+	{
+		{ "system_blocks_in_use", "gauge", stats.systemBlocksInUse },
+		{ "system_bytes_in_use", "gauge", stats.systemBytesInUse },
+		{ "realloc_hits_total", "counter", stats.reallocHits },
+		{ "realloc_misses_total", "counter", stats.reallocMisses },
+		{ "borrows_total", "counter", stats.borrows },
+		{ "failures_total", "counter", stats.failures },
+	};
+	for (size_t t=0; t<sizeof(totals)/sizeof(totals[0]); t++)
+	{
+		out.Write("# TYPE xalloc_%s %s\n", totals[t].name, totals[t].type);
+		out.Write("xalloc_%s %llu\n", totals[t].name, (unsigned long long)totals[t].value);
+	}
+	return out.GetLength();
+}
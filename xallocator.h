@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include "DataTypes.h"
+#ifdef __cplusplus
+#include <new>
+#endif
 
 // @see https://github.com/endurodave/xallocator
 // David Lafreniere
@@ -53,34 +56,222 @@ void xalloc_init();
 /// Embedded systems that never exit need not call this function at all. 
 void xalloc_destroy();
 
-/// Allocate a block of memory
+/// Allocate a block of memory. Sizes larger than the largest size class are 
+/// obtained from the system heap.
 /// @param[in] size - the size of the block to allocate. 
 void *xmalloc(size_t size);
 
+/// Allocate a block of memory aligned to a power of two boundary, such as a 
+/// cache line or SIMD register width. Free the block with xfree().
+/// @param[in] alignment - the required alignment in bytes, a power of two. 
+/// @param[in] size - the size of the block to allocate. 
+void *xmalloc_aligned(size_t alignment, size_t size);
+
 /// Frees a previously xalloc allocated block
 /// @param[in] ptr - a pointer to a previously allocated memory using xalloc.
 void xfree(void* ptr);
 
+/// Gets the number of bytes the client may use within an xalloc block. This is
+/// at least the size requested when the block was allocated. 
+/// @param[in] ptr - a pointer to a previously allocated memory using xalloc.
+/// @return The usable size in bytes, or 0 if ptr is NULL.
+size_t xmalloc_usable_size(void* ptr);
+
 /// Reallocates an existing xalloc block to a new size
 /// @param[in] ptr - a pointer to a previously allocated memory using xalloc.
 /// @param[in] size - the size of the new block
 void *xrealloc(void *ptr, size_t size);	
 
-/// Output allocator statistics to the standard output
+/// Output allocator statistics to the standard output. See xalloc_get_stats().
 void xalloc_stats();
 
-// Macro to overload new/delete with xalloc/xfree  
+/// Return idle heap memory held by the allocators back to the system. Only 
+/// applies to heap allocators; static pools keep their fixed memory budget. 
+/// @return The number of bytes released.
+size_t xalloc_trim();
+
+/// Set a high water mark policy on every allocator, including allocators created
+/// later. Once an allocator reserves more than the high water mark, idle memory
+/// above keepBlocks free blocks is periodically released as blocks are freed. 
+/// @param[in] bytes - the per allocator high water mark in bytes, or 0 to disable.
+/// @param[in] keepBlocks - the number of free blocks each allocator retains.
+void xalloc_set_high_water_mark(size_t bytes, UINT keepBlocks);
+
+/// Load a heap allocator block size class table, replacing the default powers of
+/// two classes. Also loaded at xalloc_init() from the XALLOC_SIZE_CLASSES 
+/// environment variable as a comma separated list. Static pools are sized at compile
+/// time instead (see XALLOC_STATIC_POOLS_CONFIG). 
+/// @param[in] sizes - ascending block sizes, including the block header, each a 
+///		multiple of the pointer size. Larger requests use the default classes.
+/// @param[in] count - the number of classes, or 0 to restore the default classes.
+/// @return TRUE if loaded, FALSE if the table is invalid or in STATIC_POOLS mode.
+BOOL xalloc_set_size_classes(const size_t* sizes, INT count);
+
+/// Recommend a block size class table minimizing the internal fragmentation of the
+/// request sizes recorded in XALLOC_PROFILE mode.
+/// @param[out] sizes - the recommended ascending block sizes.
+/// @param[in] maxClasses - the maximum number of classes to recommend.
+/// @return The number of classes, or 0 if nothing was recorded or not profiling.
+INT xalloc_recommend_size_classes(size_t* sizes, INT maxClasses);
+
+/// Output the wasted bytes per size class of the current and the recommended tables 
+/// for the request sizes recorded in XALLOC_PROFILE mode. The recommended table is
+/// emitted both as an XallocStaticPools definition and as XALLOC_SIZE_CLASSES.
+/// @param[in] maxClasses - the maximum number of recommended classes, or 0 to use
+///		the number of current classes.
+void xalloc_size_class_report(INT maxClasses);
+
+/// Action taken when a static pool size class has no free blocks left
+typedef enum
+{
+	XALLOC_OVERFLOW_ASSERT,		///< Call the new-handler if one is set, otherwise ASSERT() (default)
+	XALLOC_OVERFLOW_HEAP,		///< Chain to a secondary heap allocator of the same size class
+	XALLOC_OVERFLOW_BORROW,		///< Borrow a block from the next larger size class
+	XALLOC_OVERFLOW_FAIL		///< Return NULL
+} XallocOverflowPolicy;
+
+/// Set the overflow policy on every allocator, including allocators created later.
+/// Only static pools can be exhausted; heap allocators grow on demand. With 
+/// XALLOC_OVERFLOW_BORROW a request fails only once every larger class is exhausted.
+/// @param[in] policy - the overflow policy.
+void xalloc_set_overflow_policy(XallocOverflowPolicy policy);
+
+/// Get the overflow counters summed over all allocators. Any argument may be NULL.
+/// @param[out] overflows - allocations served by a secondary heap allocator.
+/// @param[out] borrows - allocations borrowed from a larger size class.
+/// @param[out] failures - allocations that returned NULL.
+void xalloc_get_overflow_stats(UINT64* overflows, UINT64* borrows, UINT64* failures);
+
+/// Statistics of one size class
+typedef struct
+{
+	UINT64 blockSize;			///< Block size including the block header
+	UINT64 alignment;			///< Block alignment, 0 for the default
+	UINT64 blockCount;			///< Blocks created
+	UINT64 blocksInUse;			///< Blocks in use
+	UINT64 peakBlocksInUse;		///< Highest blocks in use
+	UINT64 chunkCount;			///< Heap chunks
+	UINT64 bytesReserved;		///< Bytes reserved from the heap or pool
+	UINT64 peakBytesReserved;	///< Highest bytes reserved
+	UINT64 bytesInUse;			///< Bytes in blocks in use
+	UINT64 allocations;			///< Allocations
+	UINT64 deallocations;		///< Deallocations
+	UINT64 overflows;			///< Allocations served by an overflow allocator
+} XallocClassStats;
+
+/// Statistics totals
+typedef struct
+{
+	INT classCount;				///< Size classes in the snapshot
+	UINT64 bytesReserved;		///< Bytes reserved by all size classes
+	UINT64 bytesInUse;			///< Bytes in use in all size classes
+	UINT64 allocations;			///< Allocations by all size classes
+	UINT64 deallocations;		///< Deallocations by all size classes
+	UINT64 systemBlocksInUse;	///< Blocks too large for any size class in use
+	UINT64 systemBytesInUse;	///< Bytes of blocks too large for any size class in use
+	UINT64 reallocHits;			///< xrealloc() calls kept within the same block
+	UINT64 reallocMisses;		///< xrealloc() calls moved to another block
+	UINT64 borrows;				///< Blocks borrowed from a larger size class
+	UINT64 failures;			///< Allocations that returned NULL
+} XallocStats;
+
+/// Take a statistics snapshot without taking the allocator lock, so allocation 
+/// is never stalled. Each counter is read atomically; counters are not mutually 
+/// consistent while other threads allocate.
+/// @param[out] stats - the totals, or NULL.
+/// @param[out] classes - array receiving per size class statistics.
+/// @param[in] maxClasses - the number of entries in classes.
+/// @return The number of size classes stored.
+INT xalloc_get_stats(XallocStats* stats, XallocClassStats* classes, INT maxClasses);
+
+/// Render a statistics snapshot as JSON into a buffer.
+/// @param[out] buffer - the output buffer, always null terminated if size is not 0.
+/// @param[in] size - the buffer size in bytes.
+/// @return The full output length like snprintf(). Output was truncated if the 
+///		return value is not less than size.
+INT xalloc_stats_json(CHAR* buffer, size_t size);
+
+/// Render a statistics snapshot in the Prometheus text exposition format.
+/// @param[out] buffer - the output buffer, always null terminated if size is not 0.
+/// @param[in] size - the buffer size in bytes.
+/// @return The full output length like snprintf(). 
+INT xalloc_stats_prometheus(CHAR* buffer, size_t size);
+
+// Over-aligned new/delete overloads used by the XALLOCATOR macro (C++17)
+#if defined(__cplusplus) && defined(__cpp_aligned_new)
+#define XALLOCATOR_ALIGNED \
+        void* operator new(size_t size, std::align_val_t alignment) { \
+            void* ptr = xmalloc_aligned((size_t)alignment, size); \
+            if (ptr == 0) \
+                throw std::bad_alloc(); \
+            return ptr; \
+        } \
+        void* operator new[](size_t size, std::align_val_t alignment) { \
+            void* ptr = xmalloc_aligned((size_t)alignment, size); \
+            if (ptr == 0) \
+                throw std::bad_alloc(); \
+            return ptr; \
+        } \
+        void operator delete(void* pObject, std::align_val_t) { \
+            xfree(pObject); \
+        } \
+        void operator delete(void* pObject, size_t, std::align_val_t) { \
+            xfree(pObject); \
+        } \
+        void operator delete[](void* pObject, std::align_val_t) { \
+            xfree(pObject); \
+        } \
+        void operator delete[](void* pObject, size_t, std::align_val_t) { \
+            xfree(pObject); \
+        }
+#else
+#define XALLOCATOR_ALIGNED
+#endif
+
+// Macro to overload new/delete with xalloc/xfree. xmalloc() returns NULL when a 
+// size class is exhausted under XALLOC_OVERFLOW_FAIL, so throw std::bad_alloc 
+// as a throwing operator new must.
 #define XALLOCATOR \
     public: \
         void* operator new(size_t size) { \
-            return xmalloc(size); \
+            void* ptr = xmalloc(size); \
+            if (ptr == 0) \
+                throw std::bad_alloc(); \
+            return ptr; \
+        } \
+        void* operator new[](size_t size) { \
+            void* ptr = xmalloc(size); \
+            if (ptr == 0) \
+                throw std::bad_alloc(); \
+            return ptr; \
         } \
         void operator delete(void* pObject) { \
             xfree(pObject); \
-        } 
+        } \
+        void operator delete(void* pObject, size_t) { \
+            xfree(pObject); \
+        } \
+        void operator delete[](void* pObject) { \
+            xfree(pObject); \
+        } \
+        void operator delete[](void* pObject, size_t) { \
+            xfree(pObject); \
+        } \
+        XALLOCATOR_ALIGNED
 
 #ifdef __cplusplus 
 }
+
+class MemoryProvider;
+
+/// Set the backing memory provider, such as a PageMemoryProvider, used by heap 
+/// allocators created after the call. Existing allocators keep their provider.
+/// A PageMemoryProvider with huge pages carves the chunks, or the individual blocks
+/// when XALLOC_CHUNK_BLOCKS is 0, from shared huge page arenas. Static pools never
+/// use a provider. 
+/// @param[in] provider - the provider, which must outlive xallocator, or NULL for
+///		the system heap.
+void xalloc_set_memory_provider(MemoryProvider* provider);
 #endif
 
 #endif 
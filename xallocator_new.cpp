@@ -0,0 +1,117 @@
+#include "xallocator.h"
+#include <new>
+#include <string.h>
+#include <errno.h>
+
+// @see https://github.com/endurodave/xallocator
+// David Lafreniere
+
+// Define XALLOCATOR_GLOBAL_NEW to replace the global operator new/delete family
+// with versions routed through xmalloc()/xfree(). Every C++ heap allocation in the
+// application, including STL containers, then uses the fixed block allocators.
+// Requests larger than the largest size class fall back to the system heap.
+// Normally defined by the build (see the XALLOCATOR_GLOBAL_NEW CMake option).
+//#define XALLOCATOR_GLOBAL_NEW
+
+// Define XALLOCATOR_MALLOC_INTERPOSE in addition to XALLOCATOR_GLOBAL_NEW to also
+// replace malloc/free and the related C runtime functions. glibc only.
+//#define XALLOCATOR_MALLOC_INTERPOSE
+
+#ifdef XALLOCATOR_GLOBAL_NEW
+
+/// Allocate with xmalloc(), throwing std::bad_alloc on failure.
+/// @param[in] size - the size of the block to allocate.
+/// @return	A pointer to the client's memory block.
+static inline void* xnew(size_t size)
+{
+	void* ptr = xmalloc(size);
+	if (ptr == 0)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+/// Allocate with xmalloc_aligned(), throwing std::bad_alloc on failure.
+/// @param[in] size - the size of the block to allocate.
+/// @param[in] alignment - the required alignment.
+/// @return	A pointer to the client's memory block.
+static inline void* xnew_aligned(size_t size, std::align_val_t alignment)
+{
+	void* ptr = xmalloc_aligned((size_t)alignment, size);
+	if (ptr == 0)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(size_t size) { return xnew(size); }
+void* operator new[](size_t size) { return xnew(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return xmalloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return xmalloc(size); }
+
+void operator delete(void* ptr) noexcept { xfree(ptr); }
+void operator delete[](void* ptr) noexcept { xfree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { xfree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { xfree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { xfree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { xfree(ptr); }
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t alignment) { return xnew_aligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return xnew_aligned(size, alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+	{ return xmalloc_aligned((size_t)alignment, size); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+	{ return xmalloc_aligned((size_t)alignment, size); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { xfree(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { xfree(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { xfree(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { xfree(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { xfree(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { xfree(ptr); }
+#endif	// __cpp_aligned_new
+
+#if defined(XALLOCATOR_MALLOC_INTERPOSE) && defined(__GLIBC__)
+// Replace the complete set of glibc allocation functions so that memory from
+// any of them can be released by any other. Allocator obtains its own memory
+// with __libc_memalign() so these never recurse into themselves.
+extern "C"
+{
+void* malloc(size_t size) { return xmalloc(size); }
+void free(void* ptr) { xfree(ptr); }
+void* realloc(void* ptr, size_t size) { return xrealloc(ptr, size); }
+size_t malloc_usable_size(void* ptr) { return xmalloc_usable_size(ptr); }
+
+void* calloc(size_t num, size_t size)
+{
+	// Reject multiplication overflow
+	size_t total = num * size;
+	if (size != 0 && total / size != num)
+		return 0;
+
+	void* ptr = xmalloc(total);
+	if (ptr != 0)
+		memset(ptr, 0, total);
+	return ptr;
+}
+
+void* memalign(size_t alignment, size_t size) { return xmalloc_aligned(alignment, size); }
+void* aligned_alloc(size_t alignment, size_t size) { return xmalloc_aligned(alignment, size); }
+void* valloc(size_t size) { return xmalloc_aligned(4096, size); }
+void* pvalloc(size_t size) { return xmalloc_aligned(4096, (size + 4095) & ~(size_t)4095); }
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+	if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+
+	void* mem = xmalloc_aligned(alignment, size);
+	if (mem == 0)
+		return ENOMEM;
+	*ptr = mem;
+	return 0;
+}
+}
+#endif	// XALLOCATOR_MALLOC_INTERPOSE
+
+#endif	// XALLOCATOR_GLOBAL_NEW
+